@@ -0,0 +1,558 @@
+#include "../include/raytracer.h"
+#include "../include/stats.h"
+#include "../include/isa.h"
+#include <boost/random/mersenne_twister.hpp>
+#include <omp.h>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+//Benchmarks of the hot kernels and end to end renders of synthetic packings, written as JSON for regression tracking.
+//Renders are compared against golden images so that a speed-up can be checked not to change the output.
+//The golden images depend on the compiler and machine and are not committed: "make golden" writes them
+//with the tree before a change and "make bench-check" compares the changed tree against them.
+//Packings are generated from a seed with a fixed random generator, so they are the same on every platform.
+
+enum ePacking{
+	PACKING_POLYHEDRA, //Randomly placed and rotated octahedra
+	PACKING_SPHERES,
+	PACKING_LATTICE, //Randomly rotated octahedra on a simple cubic lattice
+	PACKING_SPHERE_SYSTEM, //The spheres of PACKING_SPHERES in the scene's sphere system
+	N_PACKINGS
+};
+
+static const char *packingNames[N_PACKINGS] = {"polyhedra", "spheres", "lattice", "sphere_system"};
+
+struct KernelResult{
+	std::string name;
+	unsigned long long nOps; //Per repetition
+	std::string unit;
+	std::vector<double> seconds; //Of each repetition
+	double extra; //Kernel specific, e.g. cells per ray
+	std::string extraName;
+};
+
+struct RenderResult{
+	std::string packing;
+	uint nObjects;
+	double initSeconds, traceSeconds;
+	unsigned long long nRays;
+	std::string golden; //match, mismatch, missing or updated
+	double meanError, maxError;
+};
+
+//A property of the renders that needs no golden image, e.g. that they do not depend on the threads
+struct CheckResult{
+	std::string name;
+	bool isPassed;
+	uint nDiffering; //Bytes of the images that differ
+};
+
+//Uniform floats from 32-bit Mersenne Twister output, unlike the std distributions the sequence does not depend on the library
+class BenchRandom{
+public:
+	BenchRandom(uint seed): mGen(seed){};
+	float uniform(float min, float max){
+		return min + (max - min) * float(mGen() * (1.0 / 4294967296.0));
+	};
+	glm::vec3 point(float halfSize){
+		float x = uniform(-halfSize, halfSize);
+		float y = uniform(-halfSize, halfSize);
+		float z = uniform(-halfSize, halfSize);
+		return glm::vec3(x, y, z);
+	};
+	glm::vec3 direction(void){
+		glm::vec3 dir;
+		do dir = point(1.0f); while(glm::dot(dir, dir) > 1.0f || glm::dot(dir, dir) < 1e-4f);
+		return glm::normalize(dir);
+	};
+	glm::vec4 rotation(void){ //Axis and angle in degrees, as in the snapshots
+		glm::vec3 axis = direction();
+		float angle = uniform(0.0f, 360.0f);
+		return glm::vec4(angle, axis.x, axis.y, axis.z);
+	};
+private:
+	boost::random::mt19937 mGen;
+};
+
+static double seconds(std::chrono::steady_clock::time_point start){
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+//Octahedron of unit volume, same winding as obj/Octahedron.obj
+static PolyhedronType octahedronType(void){
+	static const float r = 0.9085603f;
+	static const int faces[8][3] = {{0, 1, 2}, {0, 2, 3}, {0, 3, 4}, {0, 4, 1}, {1, 4, 5}, {1, 5, 2}, {5, 4, 3}, {2, 5, 3}};
+	PolyhedronType polyType;
+	polyType.mVertices.push_back(glm::vec3(0.0f, 0.0f, r));
+	polyType.mVertices.push_back(glm::vec3(0.0f, -r, 0.0f));
+	polyType.mVertices.push_back(glm::vec3(r, 0.0f, 0.0f));
+	polyType.mVertices.push_back(glm::vec3(0.0f, r, 0.0f));
+	polyType.mVertices.push_back(glm::vec3(-r, 0.0f, 0.0f));
+	polyType.mVertices.push_back(glm::vec3(0.0f, 0.0f, -r));
+	for(uint i = 0; i < 8; i++) polyType.mTrVertIndices.push_back(glm::ivec3(faces[i][0], faces[i][1], faces[i][2]));
+	return polyType;
+}
+
+static Material packingMaterial(uint i){
+	Material material;
+	material.color = (i % 2 == 0)? colorRGBF(0.04f, 0.3f, 0.6f): colorRGBF(0.3f, 0.6f, 0.04f);
+	material.reflectivity = 0.0f;
+	material.diffusivity = 1.0f;
+	material.Sv = 0.2f;
+	material.Sp = 128.0f;
+	return material;
+}
+
+//N particles of unit volume at a packing fraction of about 0.3, overlaps are not removed. Returns the edge length of the box.
+static float buildPacking(Scene &scene, ePacking packing, uint nParticles, uint seed){
+	BenchRandom random(seed);
+	float boxSize = cbrt(nParticles / 0.3f);
+	int typeID = scene.addPolyhedronType(octahedronType());
+	if(packing == PACKING_LATTICE){
+		uint nSide = (uint)ceil(cbrt((double)nParticles));
+		float spacing = boxSize / nSide;
+		for(uint i = 0; i < nParticles; i++){
+			glm::vec3 site(i % nSide, (i / nSide) % nSide, i / (nSide * nSide));
+			Material material = packingMaterial(i);
+			scene.addPolyhedron(typeID, (site + 0.5f) * spacing - 0.5f * boxSize, material, random.rotation(), 1.0f);
+		}
+	}
+	else{
+		if(packing == PACKING_SPHERE_SYSTEM){
+			scene.sphereSystem().addMaterial(packingMaterial(0));
+			scene.sphereSystem().addMaterial(packingMaterial(1));
+		}
+		for(uint i = 0; i < nParticles; i++){
+			glm::vec3 position = random.point(0.5f * boxSize);
+			glm::vec4 rotation = random.rotation();
+			Material material = packingMaterial(i);
+			if(packing == PACKING_SPHERES) scene.addSphere(position, 0.6203505f, material);
+			else if(packing == PACKING_SPHERE_SYSTEM) scene.sphereSystem().add(position, 0.6203505f, i % 2);
+			else scene.addPolyhedron(typeID, position, material, rotation, 1.0f);
+		}
+	}
+	return boxSize;
+}
+
+//Alternating spherocylinders and superellipsoids, whose hits are found by the generic intersection path
+static float buildShapes(Scene &scene, uint nParticles, uint seed){
+	BenchRandom random(seed);
+	float boxSize = cbrt(nParticles / 0.3f);
+	for(uint i = 0; i < nParticles; i++){
+		glm::vec3 position = random.point(0.5f * boxSize);
+		glm::vec4 rotation = random.rotation();
+		Material material = packingMaterial(i);
+		if(i % 2 == 0) scene.addSpherocylinder(position, rotation, 0.4f, 1.5f, material);
+		else scene.addSuperellipsoid(position, rotation, glm::vec3(0.4f, 0.5f, 0.7f), 4.0f, material);
+	}
+	return boxSize;
+}
+
+static void addLight(Scene &scene){
+	glm::vec3 lightPosition = glm::vec3(-30.0f, 30.0f, 30.0f);
+	scene.addAreaLight(lightPosition, -glm::normalize(lightPosition), 15.0f, colorRGBF(255, 255, 255), 64);
+}
+
+//Rays from a sphere around the box towards points inside it
+static std::vector<Ray> randomRays(BenchRandom &random, float boxSize, uint nRays){
+	std::vector<Ray> rays(nRays);
+	for(uint i = 0; i < nRays; i++){
+		glm::vec3 origin = boxSize * random.direction();
+		rays[i] = Ray(origin, glm::normalize(random.point(0.5f * boxSize) - origin));
+	}
+	return rays;
+}
+
+static void benchRayTriangle(KernelResult &result, uint nReps, uint seed){
+	static const uint nTriangles = 1024;
+	static const uint nRays = 4096;
+	BenchRandom random(seed);
+	std::vector<glm::vec3> vertices(3 * nTriangles);
+	for(uint i = 0; i < nTriangles; i++){
+		glm::vec3 center = random.point(4.0f);
+		for(uint k = 0; k < 3; k++) vertices[3*i + k] = center + random.point(1.0f);
+	}
+	Material material = packingMaterial(0);
+	std::vector<Triangle> triangles;
+	triangles.reserve(nTriangles);
+	for(uint i = 0; i < nTriangles; i++) triangles.push_back(Triangle(&vertices[3*i], &vertices[3*i + 1], &vertices[3*i + 2], material));
+	std::vector<Ray> rays = randomRays(random, 8.0f, nRays);
+
+	uint nHits = 0;
+	for(uint rep = 0; rep < nReps; rep++){
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for(uint j = 0; j < nRays; j++){
+			for(uint i = 0; i < nTriangles; i++){
+				float t = 1000.0f;
+				if(triangles[i].intersect(rays[j], t, NULL)) nHits++;
+			}
+		}
+		result.seconds.push_back(seconds(start));
+	}
+	result.name = "ray_triangle";
+	result.nOps = (unsigned long long)nRays * nTriangles;
+	result.unit = "test";
+	result.extraName = "hit_fraction";
+	result.extra = double(nHits) / (double(result.nOps) * nReps);
+}
+
+static void benchGridTraversal(KernelResult &result, uint nReps, uint nParticles, uint seed){
+	static const uint nRays = 100000;
+	Scene scene;
+	float boxSize = buildPacking(scene, PACKING_POLYHEDRA, nParticles, seed);
+	Grid grid;
+	grid.construct(&scene);
+	BenchRandom random(seed + 1);
+	std::vector<Ray> rays = randomRays(random, boxSize, nRays);
+
+	unsigned long long nCells = statsTotal(COUNTER_CELLS_VISITED);
+	for(uint rep = 0; rep < nReps; rep++){
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for(uint i = 0; i < nRays; i++){
+			float t = 2000.0f;
+			uint objectID;
+			glm::vec3 normal;
+			grid.intersect(rays[i], t, objectID, normal);
+		}
+		result.seconds.push_back(seconds(start));
+	}
+	nCells = statsTotal(COUNTER_CELLS_VISITED) - nCells;
+	result.name = "grid_traversal";
+	result.nOps = nRays;
+	result.unit = "ray";
+	result.extraName = "cells_per_ray"; //0 when built with RT_NO_STATS
+	result.extra = double(nCells) / (double(nRays) * nReps);
+}
+
+static void benchPhotonGather(KernelResult &result, uint nReps, uint seed){
+	static const uint nPhotons = 1000000;
+	static const uint nGathers = 20000;
+	static const float boxSize = 100.0f;
+	BenchRandom random(seed);
+	PhotonMap photonMap;
+	for(uint i = 0; i < nPhotons; i++){
+		Photon photon;
+		photon.p = random.point(0.5f * boxSize);
+		photon.dir = random.direction();
+		photon.rgb = colorRGBF(1.0f);
+		photonMap.storePhoton(photon);
+	}
+	photonMap.construct();
+	std::vector<glm::vec3> positions(nGathers);
+	for(uint i = 0; i < nGathers; i++) positions[i] = random.point(0.5f * boxSize);
+	float radius = 2.0f; //About 30 photons per gather
+
+	unsigned long long nFound = 0;
+	for(uint rep = 0; rep < nReps; rep++){
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for(uint i = 0; i < nGathers; i++) nFound += photonMap.locate(positions[i], radius).size();
+		result.seconds.push_back(seconds(start));
+	}
+	result.name = "photon_gather";
+	result.nOps = nGathers;
+	result.unit = "gather";
+	result.extraName = "photons_per_gather";
+	result.extra = double(nFound) / (double(nGathers) * nReps);
+}
+
+static void benchSrgbEncode(KernelResult &result, uint nReps, uint seed){
+	static const uint size = 2048;
+	BenchRandom random(seed);
+	AccumBuffer accum(size, size);
+	for(uint j = 0; j < size; j++){
+		for(uint i = 0; i < size; i++){
+			float r = random.uniform(0.0f, 1.2f);
+			float g = random.uniform(0.0f, 1.2f);
+			float b = random.uniform(0.0f, 1.2f);
+			accum.add(i, j, colorRGBF(r, g, b), 1);
+		}
+	}
+	std::vector<uchar> buffer((size_t)3 * size * size);
+	for(uint rep = 0; rep < nReps; rep++){
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		accum.resolve(&buffer[0]);
+		result.seconds.push_back(seconds(start));
+	}
+	result.name = "srgb_encode";
+	result.nOps = (unsigned long long)size * size;
+	result.unit = "pixel";
+	result.extraName = "threads";
+	result.extra = omp_get_max_threads();
+}
+
+//Binary PPM, top row first. The raytracer's buffer has the bottom row first.
+static bool savePPM(char const* filename, uchar const* data, uint width, uint height){
+	FILE *file = fopen(filename, "wb");
+	if(!file){
+		std::cout << "Error writing file \"" << filename << "\" by function " << "'" << __FUNCTION__ << "'" << std::endl;
+		return false;
+	}
+	fprintf(file, "P6\n%u %u\n255\n", width, height);
+	bool isGood = true;
+	for(uint j = height; j-- > 0 && isGood;) isGood = (fwrite(data + (size_t)3 * width * j, 1, 3 * width, file) == 3 * width);
+	if(fclose(file) != 0) isGood = false;
+	if(!isGood) std::cout << "Error writing file \"" << filename << "\" by function " << "'" << __FUNCTION__ << "'" << std::endl;
+	return isGood;
+}
+
+static bool loadPPM(char const* filename, std::vector<uchar> &data, uint &width, uint &height){
+	FILE *file = fopen(filename, "rb");
+	if(!file) return false;
+	uint maxValue;
+	char magic[3] = {0};
+	bool isGood = (fscanf(file, "%2s %u %u %u", magic, &width, &height, &maxValue) == 4 && std::string(magic) == "P6" && maxValue == 255 && fgetc(file) == '\n');
+	if(isGood){
+		data.resize((size_t)3 * width * height);
+		for(uint j = height; j-- > 0 && isGood;) isGood = (fread(&data[(size_t)3 * width * j], 1, 3 * width, file) == 3 * width);
+	}
+	fclose(file);
+	if(!isGood) std::cout << "Golden image \"" << filename << "\" is not a binary PPM." << std::endl;
+	return isGood;
+}
+
+static void compareGolden(RenderResult &result, uchar const* image, uint width, uint height, std::string const& goldenFile, double tolerance, bool isUpdate){
+	result.meanError = result.maxError = 0.0;
+	if(isUpdate){
+		result.golden = savePPM(goldenFile.c_str(), image, width, height)? "updated": "missing";
+		return;
+	}
+	std::vector<uchar> golden;
+	uint goldenWidth, goldenHeight;
+	if(!loadPPM(goldenFile.c_str(), golden, goldenWidth, goldenHeight)){
+		result.golden = "missing";
+		return;
+	}
+	if(goldenWidth != width || goldenHeight != height){
+		result.golden = "mismatch";
+		result.meanError = result.maxError = 255.0;
+		return;
+	}
+	double sum = 0.0;
+	for(size_t i = 0; i < golden.size(); i++){
+		double error = fabs(double(image[i]) - double(golden[i]));
+		sum += error;
+		if(error > result.maxError) result.maxError = error;
+	}
+	result.meanError = sum / golden.size();
+	result.golden = (result.meanError <= tolerance)? "match": "mismatch";
+}
+
+static void benchRender(RenderResult &result, ePacking packing, uint nParticles, uint seed, uint width, uint height, std::string const& goldenDir, double tolerance, bool isUpdate){
+	Scene scene;
+	addLight(scene);
+	float boxSize = buildPacking(scene, packing, nParticles, seed);
+	PinholeCamera camera(glm::vec3(0.0f, boxSize, 2.0f * boxSize), glm::vec3(0.0f), 60.0f, (float)width / height, 1.0f, width, height, 2);
+
+	RayTracer raytracer(width, height);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	raytracer.Init(&scene);
+	result.initSeconds = seconds(start);
+	unsigned long long nRays = statsTotal(COUNTER_RAYS);
+	start = std::chrono::steady_clock::now();
+	raytracer.Trace(camera);
+	result.traceSeconds = seconds(start);
+	result.nRays = statsTotal(COUNTER_RAYS) - nRays;
+	result.packing = packingNames[packing];
+	result.nObjects = scene.nObjects();
+	result.golden = "none";
+	result.meanError = result.maxError = 0.0;
+	if(!goldenDir.empty()){
+		char name[128];
+		snprintf(name, sizeof(name), "/%s_%u_%u_%ux%u.ppm", packingNames[packing], nParticles, seed, width, height);
+		compareGolden(result, raytracer.readBuffer(), width, height, goldenDir + name, tolerance, isUpdate);
+	}
+}
+
+static void renderScene(RayTracer &raytracer, Scene &scene, float boxSize, uint width, uint height){
+	PinholeCamera camera(glm::vec3(0.0f, boxSize, 2.0f * boxSize), glm::vec3(0.0f), 60.0f, (float)width / height, 1.0f, width, height, 2);
+	raytracer.Init(&scene);
+	raytracer.clearAccumulation();
+	raytracer.Trace(camera);
+}
+
+static void compareImages(CheckResult &result, uchar const* image, uchar const* other, uint width, uint height){
+	result.nDiffering = 0;
+	for(size_t i = 0; i < (size_t)3 * width * height; i++) result.nDiffering += (image[i] != other[i]);
+	result.isPassed = (result.nDiffering == 0);
+}
+
+//Renders a scene of shapes twice with more threads than cores, so that threads interleave within the tiles.
+//Objects must keep no state of a hit, the images have to be the same.
+static void checkThreadSafeShapes(CheckResult &result, uint nParticles, uint seed, uint width, uint height){
+	Scene scene;
+	addLight(scene);
+	float boxSize = buildShapes(scene, nParticles, seed);
+	int nThreads = omp_get_max_threads();
+	omp_set_num_threads(std::max(4 * omp_get_num_procs(), 16));
+	RayTracer first(width, height), second(width, height);
+	renderScene(first, scene, boxSize, width, height);
+	renderScene(second, scene, boxSize, width, height);
+	omp_set_num_threads(nThreads);
+	result.name = "thread_safe_shapes";
+	compareImages(result, first.readBuffer(), second.readBuffer(), width, height);
+}
+
+//Renders two packings one after the other with the same raytracer, as a batch run does, and the second alone.
+//The raytracer starts the photons again for every scene, so the images have to be the same.
+static void checkBatchMatchesAlone(CheckResult &result, uint nParticles, uint seed, uint width, uint height){
+	Scene scene, nextScene;
+	addLight(scene);
+	addLight(nextScene);
+	float boxSize = buildPacking(scene, PACKING_SPHERES, nParticles, seed);
+	float nextBoxSize = buildPacking(nextScene, PACKING_POLYHEDRA, nParticles, seed);
+	RayTracer batch(width, height), alone(width, height);
+	renderScene(batch, scene, boxSize, width, height);
+	renderScene(batch, nextScene, nextBoxSize, width, height);
+	renderScene(alone, nextScene, nextBoxSize, width, height);
+	result.name = "batch_is_alone";
+	compareImages(result, batch.readBuffer(), alone.readBuffer(), width, height);
+}
+
+static double minimum(std::vector<double> values){
+	return *std::min_element(values.begin(), values.end());
+}
+
+static double median(std::vector<double> values){
+	std::sort(values.begin(), values.end());
+	return values[values.size() / 2];
+}
+
+static bool writeJSON(char const* filename, uint nParticles, uint seed, uint width, uint height, std::vector<KernelResult> const& kernels, std::vector<RenderResult> const& renders,
+	std::vector<CheckResult> const& checks){
+	FILE *file = fopen(filename, "w");
+	if(!file){
+		std::cout << "Error writing file \"" << filename << "\" by function " << "'" << __FUNCTION__ << "'" << std::endl;
+		return false;
+	}
+	fprintf(file, "{\n\t\"config\": {\"particles\": %u, \"seed\": %u, \"width\": %u, \"height\": %u, \"threads\": %d, \"isa\": \"%s\"},\n", nParticles, seed, width, height, omp_get_max_threads(), isaName(kernelISA()));
+	fprintf(file, "\t\"kernels\": [\n");
+	for(uint i = 0; i < kernels.size(); i++){
+		KernelResult const& kernel = kernels[i];
+		fprintf(file, "\t\t{\"name\": \"%s\", \"unit\": \"%s\", \"ops\": %llu, \"repetitions\": %u, \"ns_min\": %.3f, \"ns_median\": %.3f, \"%s\": %.4f}%s\n",
+			kernel.name.c_str(), kernel.unit.c_str(), kernel.nOps, (uint)kernel.seconds.size(), 1e9 * minimum(kernel.seconds) / kernel.nOps,
+			1e9 * median(kernel.seconds) / kernel.nOps, kernel.extraName.c_str(), kernel.extra, (i + 1 < kernels.size())? ",": "");
+	}
+	fprintf(file, "\t],\n\t\"renders\": [\n");
+	for(uint i = 0; i < renders.size(); i++){
+		RenderResult const& render = renders[i];
+		fprintf(file, "\t\t{\"packing\": \"%s\", \"objects\": %u, \"init_seconds\": %.6f, \"trace_seconds\": %.6f, \"rays\": %llu, \"golden\": \"%s\", \"mean_error\": %.4f, \"max_error\": %.0f}%s\n",
+			render.packing.c_str(), render.nObjects, render.initSeconds, render.traceSeconds, render.nRays, render.golden.c_str(), render.meanError, render.maxError, (i + 1 < renders.size())? ",": "");
+	}
+	fprintf(file, "\t],\n\t\"checks\": [\n");
+	for(uint i = 0; i < checks.size(); i++){
+		fprintf(file, "\t\t{\"name\": \"%s\", \"passed\": %s, \"differing_bytes\": %u}%s\n", checks[i].name.c_str(), checks[i].isPassed? "true": "false",
+			checks[i].nDiffering, (i + 1 < checks.size())? ",": "");
+	}
+	fprintf(file, "\t]\n}\n");
+	return fclose(file) == 0;
+}
+
+static void printUsage(char const* program){
+	std::cout << "Usage: " << program << " [options]" << std::endl;
+	std::cout << "  -n <particles>       Particles in the synthetic packings (default 2000)" << std::endl;
+	std::cout << "  -seed <seed>         Seed of the packings and kernel inputs (default 1)" << std::endl;
+	std::cout << "  -size <w> <h>        Size of the end to end renders (default 256 256)" << std::endl;
+	std::cout << "  -reps <n>            Repetitions of each kernel, the minimum and median are reported (default 5)" << std::endl;
+	std::cout << "  -only <group>        Run only the kernels, only the renders, only the checks or only the render of one packing:" << std::endl;
+	std::cout << "                       polyhedra, spheres, lattice or sphere_system. The renders are independent, so a packing" << std::endl;
+	std::cout << "                       rendered alone matches the same golden image as in a full run." << std::endl;
+	std::cout << "                       The checks fail if a scene rendered with many threads, or after another scene in" << std::endl;
+	std::cout << "                       the same raytracer, differs from the same scene rendered again alone." << std::endl;
+	std::cout << "  -json <file>         Write the results as JSON" << std::endl;
+	std::cout << "  -golden <dir>        Compare the renders against the golden images in dir" << std::endl;
+	std::cout << "  -update-golden       Write the renders as the new golden images instead, into an existing dir." << std::endl;
+	std::cout << "                       Golden images are not committed, \"make golden\" writes them to bench/golden." << std::endl;
+	std::cout << "  -tolerance <value>   Largest mean absolute difference per channel to a golden image (default 0.5)" << std::endl;
+}
+
+int main(int argc, char *argv[]){
+	uint nParticles = 2000;
+	uint seed = 1;
+	uint width = 256, height = 256;
+	uint nReps = 5;
+	std::string only;
+	char const* jsonFile = NULL;
+	std::string goldenDir;
+	bool isUpdate = false;
+	double tolerance = 0.5;
+	for(int i = 1; i < argc; i++){
+		std::string arg(argv[i]);
+		if(arg == "-n" && i + 1 < argc) nParticles = atoi(argv[++i]);
+		else if(arg == "-seed" && i + 1 < argc) seed = atoi(argv[++i]);
+		else if(arg == "-size" && i + 2 < argc){
+			width = atoi(argv[++i]);
+			height = atoi(argv[++i]);
+		}
+		else if(arg == "-reps" && i + 1 < argc) nReps = atoi(argv[++i]);
+		else if(arg == "-only" && i + 1 < argc) only = argv[++i];
+		else if(arg == "-json" && i + 1 < argc) jsonFile = argv[++i];
+		else if(arg == "-golden" && i + 1 < argc) goldenDir = argv[++i];
+		else if(arg == "-update-golden") isUpdate = true;
+		else if(arg == "-tolerance" && i + 1 < argc) tolerance = atof(argv[++i]);
+		else{
+			printUsage(argv[0]);
+			return 1;
+		}
+	}
+	int onlyPacking = -1;
+	for(uint i = 0; i < N_PACKINGS; i++){
+		if(only == packingNames[i]) onlyPacking = i;
+	}
+	if(nParticles == 0 || width == 0 || height == 0 || nReps == 0 || (!only.empty() && only != "kernels" && only != "renders" && only != "checks" && onlyPacking < 0) || (isUpdate && goldenDir.empty())){
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	std::vector<KernelResult> kernels;
+	if(only.empty() || only == "kernels"){
+		kernels.resize(4);
+		benchRayTriangle(kernels[0], nReps, seed);
+		benchGridTraversal(kernels[1], nReps, nParticles, seed);
+		benchPhotonGather(kernels[2], nReps, seed);
+		benchSrgbEncode(kernels[3], nReps, seed);
+		for(uint i = 0; i < kernels.size(); i++){
+			printf("%-16s %10.2f ns/%s (median %.2f)  %s %.3f\n", kernels[i].name.c_str(), 1e9 * minimum(kernels[i].seconds) / kernels[i].nOps, kernels[i].unit.c_str(),
+				1e9 * median(kernels[i].seconds) / kernels[i].nOps, kernels[i].extraName.c_str(), kernels[i].extra);
+		}
+	}
+
+	//Every render has its own raytracer and photon seed, so a packing renders the same alone or after the others
+	std::vector<RenderResult> renders;
+	bool isMismatch = false;
+	bool isMissing = false;
+	if(only.empty() || only == "renders" || onlyPacking >= 0){
+		for(uint i = 0; i < N_PACKINGS; i++){
+			if(onlyPacking >= 0 && (int)i != onlyPacking) continue;
+			renders.push_back(RenderResult());
+			RenderResult &render = renders.back();
+			benchRender(render, ePacking(i), nParticles, seed, width, height, goldenDir, tolerance, isUpdate);
+			printf("%-16s init %.3fs  trace %.3fs  %llu rays  golden %s (mean error %.3f, max %.0f)\n", render.packing.c_str(), render.initSeconds,
+				render.traceSeconds, render.nRays, render.golden.c_str(), render.meanError, render.maxError);
+			if(render.golden == "mismatch" || render.golden == "missing") isMismatch = true;
+			if(render.golden == "missing") isMissing = true;
+		}
+	}
+	if(isMissing && isUpdate) std::cout << "Could not write the golden images, does \"" << goldenDir << "\" exist?" << std::endl;
+	else if(isMissing) std::cout << "Golden images are missing, write them to \"" << goldenDir << "\" with -update-golden (make golden) before the change." << std::endl;
+
+	//Checks pass or fail on their own, they are not compared with golden images
+	std::vector<CheckResult> checks;
+	if(only.empty() || only == "checks"){
+		checks.resize(2);
+		checkThreadSafeShapes(checks[0], nParticles, seed, width, height);
+		checkBatchMatchesAlone(checks[1], nParticles, seed, width, height);
+		for(uint i = 0; i < checks.size(); i++){
+			printf("%-16s %s (%u bytes differ)\n", checks[i].name.c_str(), checks[i].isPassed? "pass": "FAIL", checks[i].nDiffering);
+			if(!checks[i].isPassed) isMismatch = true;
+		}
+	}
+
+	if(jsonFile && !writeJSON(jsonFile, nParticles, seed, width, height, kernels, renders, checks)) return 1;
+	return isMismatch? 2: 0;
+}
@@ -0,0 +1,49 @@
+#ifndef RT_ACCUMBUFFER_H
+#define RT_ACCUMBUFFER_H
+
+#include <cstddef>
+#include "common.h"
+
+//Linear radiance accumulated per pixel together with the number of samples that went into it.
+//Checkpoints are written as a little endian PFM of the per-pixel mean followed by a block of
+//32-bit sample counts and the pass range of the render, so they can be opened by any PFM viewer
+//and still be resumed or merged.
+class AccumBuffer{
+public:
+	AccumBuffer(uint width, uint height);
+	~AccumBuffer(void);
+	void clear(void);
+	void resize(uint width, uint height); //Also clears
+	void add(uint x, uint y, colorRGBF const& color, uint nSamples){
+		size_t index = x + (size_t)mWidth * y;
+		mColors[index] += color;
+		mSamples[index] += nSamples;
+	};
+	colorRGBF mean(uint x, uint y)const;
+	uint samples(uint x, uint y)const{
+		return mSamples[x + (size_t)mWidth * y];
+	};
+	uint minSamples(void)const;
+	void resolve(uchar *buffer)const; //Writes the sRGB encoded mean of each pixel to an 8-bit RGB buffer
+	bool save(char const* filename)const;
+	bool load(char const* filename); //Takes over the dimensions of the file
+	bool merge(AccumBuffer const& other); //Adds the samples of a render of the same frame
+	void setPassRange(uint firstPass, uint nPasses){
+		mFirstPass = firstPass;
+		mNPasses = nPasses;
+	};
+	uint firstPass(void)const{ return mFirstPass;};
+	uint nPasses(void)const{ return mNPasses;}; //0 for all passes from the first on
+	size_t memoryUsage(void)const{ return (size_t)mWidth * mHeight * (sizeof(colorRGBF) + sizeof(uint));};
+	uint width(void)const{ return mWidth;};
+	uint height(void)const{ return mHeight;};
+private:
+	AccumBuffer(AccumBuffer const&);
+	AccumBuffer &operator=(AccumBuffer const&);
+	uint mWidth, mHeight;
+	uint mFirstPass, mNPasses;
+	colorRGBF *mColors;
+	uint *mSamples;
+};
+
+#endif
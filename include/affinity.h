@@ -0,0 +1,23 @@
+#ifndef RT_AFFINITY_H
+#define RT_AFFINITY_H
+
+#include <cstddef>
+#include <functional>
+#include "common.h"
+
+//NUMA placement of threads and memory. Only Linux is supported, elsewhere the machine is a single node and
+//the functions do nothing. Nodes are numbered 0 to numaNodes() - 1 in the order the kernel lists them.
+
+uint numaNodes(void);
+//Pins each OpenMP thread to the CPUs of one node, the threads are spread over the nodes in proportion to their
+//CPUs in the process' affinity mask, in thread order. False if the threads could not be pinned.
+bool pinThreads(void);
+uint threadNode(void); //Node the calling thread was pinned to, 0 if it was not
+void runOnNode(uint node, std::function<void(void)> const& function); //On a thread pinned to the node, returns when it is done
+//Pages the OpenMP threads allocate from now on are spread round robin over the nodes, false for the default
+//of placing them on the node that touches them first
+void interleaveMemory(bool isInterleaved);
+void setHugePages(bool isEnabled); //Lets adviseHugePages back memory with transparent huge pages
+void adviseHugePages(void const* data, size_t bytes); //For large arrays that are read all over during the trace
+
+#endif
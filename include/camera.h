@@ -9,7 +9,15 @@
 class CameraBase{
 public:
 	virtual Ray shootRay(uint x, uint y, uint s)const = 0;
-	uint getSamples(void){
+	virtual float pixelSize(glm::vec3 const& point)const = 0; //World space size of a pixel at point
+	virtual bool isVisible(glm::vec3 const& point, float radius)const = 0; //False if the sphere is entirely outside the view
+	//Screen position of a point in pixels, where sample s of pixel (x, y) is at (x, y) + sampleOffset(s), and in z a
+	//depth key that is linear in screen space and grows towards the camera. False if the point is not in front of the camera.
+	virtual bool project(glm::vec3 const& point, glm::vec3 &screen)const = 0;
+	glm::vec2 sampleOffset(uint s)const{
+		return glm::vec2((float)(s % mNSamples) / mNSamples, (float)(s / mNSamples) / mNSamples);
+	};
+	uint getSamples(void)const{
 		return mNSamples;
 	};
 protected:
@@ -18,20 +26,26 @@ protected:
 	uint mNSamples;
 };
 
-class OrthographicCamera: public CameraBase{
+class OrthographicCamera final: public CameraBase{
 public:
 	OrthographicCamera(glm::vec3 position, glm::vec3 direction, float x, float y, uint width, uint height, uint nSamples);
 	Ray shootRay(uint x, uint y, uint s)const;
+	float pixelSize(glm::vec3 const& point)const;
+	bool isVisible(glm::vec3 const& point, float radius)const;
+	bool project(glm::vec3 const& point, glm::vec3 &screen)const;
 private:
 	float mSizeX, mSizeY; //Dimensions of pixel in world space
 	uint mHalfWidth, mHalfHeight; //Half width and height pixel resolution
 	glm::vec3 mUpVector, mRightVector;
 };
 
-class PinholeCamera: public CameraBase{
+class PinholeCamera final: public CameraBase{
 public:
 	PinholeCamera(glm::vec3 position, glm::vec3 lookAt, float fov, float aspect, float zNear, uint width, uint height, uint nSamples);
 	Ray shootRay(uint x, uint y, uint s)const;
+	float pixelSize(glm::vec3 const& point)const;
+	bool isVisible(glm::vec3 const& point, float radius)const;
+	bool project(glm::vec3 const& point, glm::vec3 &screen)const;
 private:
 	float mSizeX, mSizeY; //Dimensions of pixel in world space
 	uint mHalfWidth, mHalfHeight; //Half width and height pixel resolution
@@ -39,4 +53,17 @@ private:
 	glm::vec3 mUpVector, mRightVector;
 };
 
+//A window of another camera's image: pixel (x, y) is pixel (x0 + x, y0 + y) of the full image
+class CroppedCamera: public CameraBase{
+public:
+	CroppedCamera(CameraBase const& camera, uint x0, uint y0);
+	Ray shootRay(uint x, uint y, uint s)const;
+	float pixelSize(glm::vec3 const& point)const;
+	bool isVisible(glm::vec3 const& point, float radius)const;
+	bool project(glm::vec3 const& point, glm::vec3 &screen)const;
+private:
+	CameraBase const& mCamera;
+	uint mX0, mY0;
+};
+
 #endif
@@ -0,0 +1,70 @@
+#ifndef RT_COMPILEDSCENE_H
+#define RT_COMPILEDSCENE_H
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "common.h"
+#include "object.h"
+#include "scene.h"
+#include "grid.h"
+#include "mappedfile.h"
+
+//A scene with everything derived from the snapshot already computed: transformed vertices, triangle normals,
+//AABBs and the grid. All references in the file are indices, so it is loaded by mapping it and copying
+//the sections into place.
+#define COMPILEDSCENE_VERSION 1
+
+enum eCompiledSection{
+	SECTION_MATERIALS,
+	SECTION_TYPES,
+	SECTION_TYPE_VERTICES,
+	SECTION_TYPE_TRIANGLES,
+	SECTION_INSTANCES,
+	SECTION_VERTICES,
+	SECTION_NORMALS,
+	SECTION_TRIANGLE_AABBS,
+	SECTION_GRID,
+	SECTION_CELL_STARTS,
+	SECTION_CELL_ITEMS,
+	SECTION_BOX,
+	N_SECTIONS
+};
+
+struct CompiledInstance{
+	uint type;
+	uint material;
+	uint firstVertex;
+	uint firstTriangle;
+	glm::vec3 position;
+	glm::vec4 rotation; //Angle followed by the axis
+	float scale;
+	AABB aabb;
+};
+
+//Writes the polyhedra of the scene with their transforms, one per instance, and the grid built for them.
+//box is the simulation box, from which the camera is placed. The grid is sized as by Grid::setResolution.
+bool compileScene(char const* filename, Scene &scene, std::vector<CompiledInstance> const& transforms, float const box[9],
+	float gridDensity = GRID_DENSITY, uint gridMaxResolution = GRID_MAX_RESOLUTION);
+bool isCompiledScene(char const* filename);
+
+class CompiledScene{
+public:
+	CompiledScene(void);
+	bool open(char const* filename);
+	void instantiate(Scene &scene)const; //Adds the types, then the instances in the order they were compiled
+	void loadGrid(Grid &grid, Scene *scene)const;
+	float const* box(void)const{
+		return mBox;
+	};
+private:
+	template<typename T>
+	T const* section(eCompiledSection id)const{
+		return (T const*)(mFile.begin() + mOffsets[id]);
+	};
+	MappedFile mFile;
+	unsigned long long mOffsets[N_SECTIONS];
+	unsigned long long mCounts[N_SECTIONS];
+	float const* mBox;
+};
+
+#endif
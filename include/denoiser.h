@@ -0,0 +1,48 @@
+#ifndef RT_DENOISER_H
+#define RT_DENOISER_H
+
+#include <vector>
+#include <string>
+#include <glm/glm.hpp>
+#include "common.h"
+#include "accumbuffer.h"
+
+//Auxiliary buffers of the first hit seen through each pixel, for the denoiser and for compositing.
+//Pixels that see the background keep the object ID NO_OBJECT and zero in the other buffers.
+class AOVBuffer{
+public:
+	static const uint NO_OBJECT = 0xFFFFFFFF;
+	AOVBuffer(void): mWidth(0), mHeight(0){};
+	void resize(uint width, uint height); //Also clears
+	void clear(void);
+	void set(uint x, uint y, colorRGBF const& albedo, glm::vec3 const& normal, float depth, uint objectID){
+		size_t index = x + (size_t)mWidth * y;
+		mAlbedo[index] = albedo;
+		mNormal[index] = normal;
+		mDepth[index] = depth;
+		mObjectID[index] = objectID;
+	};
+	colorRGBF const& albedo(size_t index)const{ return mAlbedo[index];};
+	glm::vec3 const& normal(size_t index)const{ return mNormal[index];};
+	float depth(size_t index)const{ return mDepth[index];};
+	uint objectID(size_t index)const{ return mObjectID[index];};
+	//PFMs prefix_albedo.pfm, prefix_normal.pfm, prefix_depth.pfm and prefix_id.pfm, the background has ID -1
+	bool save(std::string const& prefix)const;
+	size_t memoryUsage(void)const{ return (size_t)mWidth * mHeight * (sizeof(colorRGBF) + sizeof(glm::vec3) + sizeof(float) + sizeof(uint));};
+	uint width(void)const{ return mWidth;};
+	uint height(void)const{ return mHeight;};
+private:
+	uint mWidth, mHeight;
+	std::vector<colorRGBF> mAlbedo; //Color of the material
+	std::vector<glm::vec3> mNormal;
+	std::vector<float> mDepth; //Distance along the camera ray
+	std::vector<uint> mObjectID;
+};
+
+//Edge aware a-trous wavelet filter in the spirit of SVGF. The mean radiance is divided by the albedo, filtered over
+//nIterations passes of a 5x5 B-spline kernel with doubling step, and multiplied back. The weights stop at changes of
+//object, normal and depth, and at luminance differences large against the local variance. The filtered mean of each
+//pixel that has samples is written to filtered as a single sample.
+void denoise(AccumBuffer const& accum, AOVBuffer const& aovs, uint nIterations, AccumBuffer &filtered);
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef RT_DISTRIBUTED_H
+#define RT_DISTRIBUTED_H
+
+#include <string>
+#include <vector>
+#include "common.h"
+
+//Helpers for splitting a render over several processes that communicate through files in a shared directory
+
+std::string partFileName(std::string const& prefix, uint part); //"<prefix>.<part>"
+//Polls until the file exists, timeout in seconds. Gives up early once abortFile exists.
+bool waitForFile(std::string const& filename, double timeout, std::string const& abortFile);
+std::string shellQuote(std::string const& arg);
+//Runs all commands concurrently through the shell and returns the number of them that exited successfully.
+//The first command that fails creates failureFile, so that the others can stop waiting for its output.
+uint runCommands(std::vector<std::string> const& commands, std::string const& failureFile);
+
+#endif
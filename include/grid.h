@@ -7,25 +7,63 @@
 #include "object.h"
 #include "ray.h"
 #include "common.h"
+#include "isa.h"
+
+#define GRID_DENSITY 5.0f //Primitives per cell the resolution aims at by default
+#define GRID_MAX_RESOLUTION 128 //Cells along each axis at most by default
+
+//A primitive in a cell as an object index and, for polyhedra, a triangle index
+struct GridItem{
+	uint object;
+	uint primitive;
+};
 
 class Grid{
 public:
-	Grid(void): mCells(NULL){};
+	Grid(void): mCells(NULL), mDensity(GRID_DENSITY), mMaxResolution(GRID_MAX_RESOLUTION){
+		mRes[0] = mRes[1] = mRes[2] = 0;
+	};
 	~Grid(void){
-		uint nCells = mRes[0] * mRes[1] * mRes[2];
-		for(uint i = 0; i < nCells; i++){
-			if(mCells[i] != NULL) delete mCells[i];
-		}
-		delete[] mCells;
+		clear();
+	};
+	void construct(Scene *scene, bool isRefittable = false); //Refittable grids remember the cells of each primitive
+	//Cells are sized for density primitives per cell, with at most maxResolution cells along each axis. A density of 0
+	//has the next construct pick both with a cost model of the scene, later constructs keep what it picked.
+	void setResolution(float density, uint maxResolution){
+		mDensity = density;
+		mMaxResolution = maxResolution;
 	};
-	void construct(Scene *scene);
+	float density(void)const{
+		return mDensity;
+	};
+	uint maxResolution(void)const{
+		return mMaxResolution;
+	};
+	bool update(Scene *scene, uint objectID); //Refits a moved object, returns false if it left the grid
 	bool intersect(Ray ray, float &t, uint &objectID, glm::vec3 &normal)const;
 	bool shadowIntersect(Ray ray, float &t)const; // Returns as soon as it finds an intersection
-	AABB getAABB(void){
+	AABB getAABB(void)const{
 		return mAABB;
 	}
+	uint cellIndex(glm::vec3 point)const; //Index of the cell containing the point, clamped to the grid
+	size_t memoryUsage(void)const;
+	glm::uvec3 resolution(void)const{
+		return glm::uvec3(mRes[0], mRes[1], mRes[2]);
+	};
+	//Flattened cell lists, the items of cell i are items[cellStarts[i]] up to items[cellStarts[i + 1]]
+	void exportCells(Scene *scene, std::vector<uint> &cellStarts, std::vector<GridItem> &items)const;
+	void load(Scene *scene, glm::uvec3 resolution, AABB const& aabb, uint const* cellStarts, GridItem const* items); //Counterpart of exportCells
 	
 private:
+	struct CellRange{
+		bool operator==(CellRange const& other)const{
+			return min == other.min && max == other.max;
+		};
+		bool contains(uint x, uint y, uint z)const{
+			return x >= min.x && x <= max.x && y >= min.y && y <= max.y && z >= min.z && z <= max.z;
+		};
+		glm::uvec3 min, max;
+	};
 	struct Cell{
 		struct Item{
 			Item(Object* objPtr, uint mID){
@@ -39,11 +77,23 @@ private:
 		void insert(Object* objPtr, uint mID){
 			list.push_back(Item(objPtr, mID));
 		}
-		bool intersect(Ray ray, float &t, uint &objectID, glm::vec3 &normal);
-		bool shadowIntersect(Ray ray, float &t);
+		void remove(Object* objPtr);
+		//Compiled per instruction set level, see kernels.inl
+		template<eISA isa> bool intersect(Ray const& ray, float &t, uint &objectID, glm::vec3 &normal)const;
+		template<eISA isa> bool shadowIntersect(Ray const& ray, float &t, uint &nTests)const;
 		std::vector<Item> list;
 	};
+	template<eISA isa> bool intersectISA(Ray const& ray, float &t, uint &objectID, glm::vec3 &normal)const;
+	template<eISA isa> bool shadowIntersectISA(Ray const& ray, float &t)const;
+	void clear(void);
+	void tune(Scene *scene, uint nPrimitives);
+	CellRange cellRange(AABB const& aabb)const;
+	void insert(CellRange const& range, Object *object, uint objectID, CellRange const* exclude = NULL);
+	void remove(CellRange const& range, Object *object, CellRange const& exclude);
 	Cell **mCells;
+	std::vector<std::vector<CellRange> > mRanges; //Cells of each primitive, per object. Only kept for refittable grids.
+	float mDensity;
+	uint mMaxResolution;
 	uint mRes[3];
 	glm::vec3 mCellDim;
 	AABB mAABB;
@@ -0,0 +1,44 @@
+#ifndef RT_HEATMAP_H
+#define RT_HEATMAP_H
+
+#include <vector>
+#include <string>
+#include "common.h"
+#include "stats.h"
+
+enum eCost{
+	COST_CYCLES,
+	COST_CELLS, //Grid cells visited
+	COST_TESTS, //Ray-primitive intersection tests
+	COST_PHOTONS, //Photons examined by the gathers
+	N_COSTS
+};
+
+//Cost of tracing each pixel, summed over its samples. The counts are taken from the stats counters, which are
+//zero when they are compiled out with -DRT_NO_STATS; the cycles are always measured.
+class CostBuffer{
+public:
+	CostBuffer(void): mWidth(0), mHeight(0){};
+	void resize(uint width, uint height); //Also clears
+	void clear(void);
+	//Marks the start of a sample traced by the calling thread, the costs since go to the pixel on add
+	struct Mark{
+		unsigned long long cycles;
+		unsigned long long counts[N_COUNTERS];
+	};
+	static void mark(Mark &start);
+	void add(uint x, uint y, Mark const& start);
+	//False colour RGB image of the mean cost per sample, 8 bits per channel. The scale saturates at a high percentile
+	//so that a few extreme pixels do not leave the rest of the image dark, it is returned as the value shown in white.
+	double colorize(eCost cost, std::vector<uchar> &image)const;
+	static char const* name(eCost cost); //For file names, e.g. "cycles"
+	size_t memoryUsage(void)const{ return (size_t)mWidth * mHeight * (N_COSTS * sizeof(unsigned long long) + sizeof(uint));};
+	uint width(void)const{ return mWidth;};
+	uint height(void)const{ return mHeight;};
+private:
+	uint mWidth, mHeight;
+	std::vector<unsigned long long> mCosts; //N_COSTS per pixel
+	std::vector<uint> mSamples;
+};
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef RT_ISA_H
+#define RT_ISA_H
+
+//The hot kernels (grid traversal with its ray-triangle and slab tests, photon gathers and shading) are member
+//templates on the instruction set level, compiled once per level into the same binary by src/isa*.cpp.
+//The best level the CPU supports is chosen on first use. The environment variable RT_ISA=generic|avx2|avx512
+//forces a level, e.g. for benchmarking. Variants that use FMA may differ from the generic one in the last bits.
+
+enum eISA{
+	ISA_GENERIC,
+	ISA_AVX2, //AVX2 and FMA
+	ISA_AVX512, //AVX-512 F, VL, BW and DQ
+	N_ISAS
+};
+
+//Only GCC compatible compilers targeting x86 get the extra variants, build with -DRT_NO_ISA_DISPATCH to leave them out
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(RT_NO_ISA_DISPATCH)
+#define RT_ISA_DISPATCH
+#endif
+
+eISA kernelISA(void); //The level in use
+eISA bestISA(void); //The highest level the CPU supports
+char const* isaName(eISA isa);
+
+//Returns function<level>(arguments) for the level in use, function being a member function template on eISA
+#ifdef RT_ISA_DISPATCH
+#define ISA_DISPATCH(function, arguments) \
+	switch(kernelISA()){ \
+	case ISA_AVX512: return function<ISA_AVX512> arguments; \
+	case ISA_AVX2: return function<ISA_AVX2> arguments; \
+	default: return function<ISA_GENERIC> arguments; \
+	}
+#else
+#define ISA_DISPATCH(function, arguments) return function<ISA_GENERIC> arguments;
+#endif
+
+#endif
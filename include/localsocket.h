@@ -0,0 +1,20 @@
+#ifndef RT_LOCALSOCKET_H
+#define RT_LOCALSOCKET_H
+
+#include <string>
+#include <cstddef>
+#include "common.h"
+
+//Unix domain stream sockets for the render daemon and its clients. Only POSIX systems have them, elsewhere
+//listening and connecting fail. Functions returning a descriptor return -1 on failure.
+
+int listenLocal(std::string const& path); //Replaces a stale socket file at the path
+int acceptLocal(int listener, uint timeoutSeconds); //Reads on the connection fail after the timeout, 0 for none
+int connectLocal(std::string const& path);
+//Up to a newline, which is dropped. False at the end of the stream, on a timeout or if the line is too long.
+bool readLine(int fd, std::string &line);
+bool writeAll(int fd, void const* data, size_t size);
+bool writeLine(int fd, std::string const& line); //Appends the newline
+void closeLocal(int fd);
+
+#endif
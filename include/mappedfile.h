@@ -0,0 +1,63 @@
+#ifndef RT_MAPPEDFILE_H
+#define RT_MAPPEDFILE_H
+
+#include <cstddef>
+#include <charconv>
+#include "common.h"
+
+//Read only view of a whole file. The pages are mapped instead of copied, so parsing
+//runs straight on the page cache.
+class MappedFile{
+public:
+	MappedFile(void);
+	~MappedFile(void);
+	bool open(char const* filename);
+	void close(void);
+	char const* begin(void)const{
+		return mData;
+	};
+	char const* end(void)const{
+		return mData + mSize;
+	};
+	size_t size(void)const{
+		return mSize;
+	};
+private:
+	MappedFile(MappedFile const&);
+	MappedFile& operator=(MappedFile const&);
+	char const* mData;
+	size_t mSize;
+#ifdef _WIN32
+	void *mFile;
+	void *mMapping;
+#endif
+};
+
+//Tokenizing helpers for text in memory, they advance pos past what they read
+inline void skipBlanks(char const* &pos, char const* end){
+	while(pos < end && (*pos == ' ' || *pos == '\t' || *pos == '\r')) pos++;
+}
+
+inline void skipLine(char const* &pos, char const* end){
+	while(pos < end && *pos != '\n') pos++;
+	if(pos < end) pos++;
+}
+
+inline bool parseFloat(char const* &pos, char const* end, float &value){
+	skipBlanks(pos, end);
+	if(pos < end && *pos == '+') pos++;
+	std::from_chars_result result = std::from_chars(pos, end, value);
+	if(result.ec != std::errc()) return false;
+	pos = result.ptr;
+	return true;
+}
+
+inline bool parseUint(char const* &pos, char const* end, uint &value){
+	skipBlanks(pos, end);
+	std::from_chars_result result = std::from_chars(pos, end, value);
+	if(result.ec != std::errc()) return false;
+	pos = result.ptr;
+	return true;
+}
+
+#endif
@@ -10,7 +10,9 @@ enum eObjectType{
 	SPHERE,
 	PLANE,
 	TRIANGLE,
-	POLYHEDRON
+	POLYHEDRON,
+	SPHEROCYLINDER,
+	SUPERELLIPSOID
 };
 
 struct PolyhedronType{
@@ -40,8 +42,10 @@ public:
 //Base Object class
 class Object{
 public:
-	virtual bool intersect(Ray ray, float &t) = 0;
-	virtual glm::vec3 normal(void)const = 0;
+	virtual ~Object(void){};
+	//Nearest hit closer than t, its normal is written unless normal is NULL. Objects keep no state of the hit,
+	//so threads can trace the same scene.
+	virtual bool intersect(Ray ray, float &t, glm::vec3 *normal)const = 0;
 	eObjectType mType;
 	Material mMaterial;
 	AABB mAABB;
@@ -51,24 +55,17 @@ public:
 class Sphere: public Object{
 public:
 	Sphere(glm::vec3 position, float radius, Material& material);
-	bool intersect(Ray ray, float &t);
-	glm::vec3 normal(void)const{
-		return glm::normalize(mIntersection - mPosition);
-	};
+	bool intersect(Ray ray, float &t, glm::vec3 *normal)const;
 private:
 	float mRadius;
 	glm::vec3 mPosition;
-	glm::vec3 mIntersection; //Holds the point of intersection on the sphere for returning the normal
 };
 
 //Plane derivative
 class Plane: public Object{
 public:
 	Plane(glm::vec3 normal, glm::vec3 point, Material& material);
-	bool intersect(Ray ray, float &t);
-	glm::vec3 normal(void)const{
-		return mNormal;
-	};
+	bool intersect(Ray ray, float &t, glm::vec3 *normal)const;
 private:
 	glm::vec3 mNormal;
 	glm::vec3 mPoint;
@@ -79,11 +76,16 @@ class Triangle: public Object{
 public:
 	Triangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, Material& material); // CCW
 	Triangle(glm::vec3 *v0, glm::vec3 *v1, glm::vec3 *v2, Material& material); // CCW
+	Triangle(glm::vec3 *v0, glm::vec3 *v1, glm::vec3 *v2, glm::vec3 normal, AABB const& aabb, Material& material); //Precomputed normal and AABB
 	~Triangle(void);
-	bool intersect(Ray ray, float &t);
+	bool intersect(Ray ray, float &t, glm::vec3 *normal)const;
+	void update(void); //Recomputes the normal and AABB after the vertices moved
 	glm::vec3 normal(void)const{
 		return mNormal;
 	};
+	glm::vec3 const& vertex(uint i)const{
+		return *mVertices[i];
+	};
 private:
 	bool isAllocated;
 	glm::vec3 mNormal;
@@ -92,26 +94,65 @@ private:
 	// float d, d1, d2;
 };
 
+//Spherocylinder derivative, a cylinder of the given length capped by two hemispheres. The rotation turns its z axis.
+class Spherocylinder: public Object{
+public:
+	Spherocylinder(glm::vec3 position, glm::vec4 rotation, float radius, float length, Material& material);
+	bool intersect(Ray ray, float &t, glm::vec3 *normal)const;
+	void setTransform(glm::vec3 position, glm::vec4 rotation);
+private:
+	glm::vec3 normal(glm::vec3 const& point)const;
+	float mRadius;
+	float mHalfLength;
+	glm::vec3 mPosition;
+	glm::vec3 mAxis;
+};
+
+//Superellipsoid derivative, |x / a|^p + |y / b|^p + |z / c|^p = 1 in its own frame. p = 2 gives ellipsoids
+//and large p approaches boxes. Exponents below 1 are raised to 1, the shape has to be convex for the intersection.
+class Superellipsoid: public Object{
+public:
+	Superellipsoid(glm::vec3 position, glm::vec4 rotation, glm::vec3 semiAxes, float exponent, Material& material);
+	bool intersect(Ray ray, float &t, glm::vec3 *normal)const;
+	void setTransform(glm::vec3 position, glm::vec4 rotation);
+private:
+	float implicit(glm::vec3 const& point, glm::vec3 const& dir, float &derivative)const;
+	glm::vec3 normal(glm::vec3 const& point)const; //Of a point in the frame where the shape is |x|^p + |y|^p + |z|^p = 1
+	float mExponent;
+	glm::vec3 mSemiAxes;
+	glm::vec3 mPosition;
+	glm::mat3 mRotation;
+};
+
 //Polyhedron derivative
 class Polyhedron: public Object{
 public:
 	Polyhedron(PolyhedronType const& polyType, glm::vec3 position, Material& material, glm::vec4 rotation, float scale = 1.0f);
-	~Polyhedron(void);
-	bool intersect(Ray ray, float &t);
-	glm::vec3 normal(void)const{
-		return mTriangles[mIntersTriangle].normal();
-	};
+	//Takes the transformed vertices, triangle normals and AABBs as they were computed by the constructor above
+	Polyhedron(PolyhedronType const& polyType, Material& material, glm::vec3 const* vertices, glm::vec3 const* normals, AABB const* triangleAABBs, AABB const& aabb);
+	~Polyhedron(void){};
+	bool intersect(Ray ray, float &t, glm::vec3 *normal)const;
+	void setTransform(glm::vec3 position, glm::vec4 rotation, float scale); //Moves the vertices in place, the triangles stay valid
 	Triangle *triangle(uint i){
 		return &mTriangles[i];
 	};
 	uint nTriangles(void){
 		return mNTriangles;
 	};
+	PolyhedronType const* polyType(void)const{
+		return mPolyType;
+	};
+	glm::vec3 const* vertices(void)const{
+		return &mVertices[0];
+	};
+	size_t memoryUsage(void)const{
+		return sizeof(Polyhedron) + mTriangles.capacity() * sizeof(Triangle) + mVertices.capacity() * sizeof(glm::vec3);
+	};
 private:
+	PolyhedronType const* mPolyType;
 	uint mNTriangles;
 	std::vector<Triangle> mTriangles;
 	std::vector<glm::vec3> mVertices;
-	uint mIntersTriangle; //Holds the intersected face id for returning the correct normal
 };
 
 #endif
@@ -5,6 +5,7 @@
 #include <glm/glm.hpp>
 #include "object.h"
 #include "common.h"
+#include "isa.h"
 
 struct Photon{
 	Photon(void): isShadow(false){};
@@ -22,6 +23,14 @@ public:
 		mPhotons.push_back(ph);
 	};
 	void construct(void);
+	void replicate(PhotonMap const& other); //Copies the photons and the tree of a constructed map into memory of the calling thread
+	void clear(void);
+	bool save(char const* filename)const;
+	bool load(char const* filename); //Appends the photons stored in the file, call construct afterwards
+	size_t memoryUsage(void)const;
+	uint nPhotons(void)const{
+		return mPhotons.size();
+	};
 	std::vector<Photon const*> locate(glm::vec3 position, float radius)const;
 private:
 	std::vector<Photon> mPhotons;
@@ -38,7 +47,10 @@ private:
 	AABB mAABB;
 	kdNode* balance(uint start, uint end);
 	void kdClear(kdNode *node);
-	void recLocate(kdNode* node, std::vector<Photon const*> &retPhotons, glm::vec3 position, float radius)const;
+	kdNode* kdCopy(kdNode const* node, Photon const* otherPhotons);
+	//Compiled per instruction set level, see kernels.inl
+	template<eISA isa> std::vector<Photon const*> locateISA(glm::vec3 const& position, float radius)const;
+	template<eISA isa> void recLocate(kdNode* node, std::vector<Photon const*> &retPhotons, glm::vec3 const& position, float radius, uint &nExamined)const;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,35 @@
+#ifndef RT_PNGSTREAM_H
+#define RT_PNGSTREAM_H
+
+#include <cstdio>
+#include <cstddef>
+#include <vector>
+#include <string>
+#include "common.h"
+
+//Writes an 8-bit RGB PNG a band of rows at a time, from the top row down, so that images far larger than
+//memory can be written while they are rendered. The rows of each band are filtered and deflated in
+//parallel chunks. Every chunk is flushed to a byte boundary, so the chunks concatenate into one zlib stream.
+class PngStream{
+public:
+	PngStream(void);
+	~PngStream(void);
+	bool open(char const* filename, uint width, uint height);
+	//Writes to a stream opened elsewhere, e.g. a socket, and closes it. The filename is only for messages.
+	bool open(FILE *file, char const* filename, uint width, uint height);
+	//rowStride is the distance in bytes from one row to the row below it in the image, it may be negative
+	bool writeRows(uchar const* rows, uint nRows, ptrdiff_t rowStride);
+	bool close(void); //Fails if fewer rows than the height were written
+private:
+	PngStream(PngStream const&);
+	PngStream& operator=(PngStream const&);
+	bool writeChunk(char const* type, uchar const* data, size_t size);
+	FILE *mFile;
+	std::string mFilename;
+	uint mWidth, mHeight;
+	uint mRowsWritten;
+	unsigned long mAdler; //Of all filtered rows so far, for the zlib trailer
+	std::vector<uchar> mPrevRow; //Last row of the previous band, referenced by the filters
+};
+
+#endif
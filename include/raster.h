@@ -0,0 +1,51 @@
+#ifndef RT_RASTER_H
+#define RT_RASTER_H
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "common.h"
+#include "object.h"
+#include "scene.h"
+#include "camera.h"
+
+//Software rasteriser for the first hits of the camera rays. The front facing triangles of the scene are projected,
+//binned to screen tiles and the tiles are filled in parallel, keeping the nearest triangle at each sample.
+//The visibility buffer holds one sample of each pixel, the one the camera shoots for the pass.
+class Rasterizer{
+public:
+	Rasterizer(void): mWidth(0), mHeight(0), mFirstRow(0), mNTilesX(0), mNTilesY(0), mNThreads(0){};
+	//Only polyhedra and single triangles can be rasterised, no other objects and no sphere system
+	static bool isRasterizable(Scene const& scene);
+	//Triangle triangleID of polyhedron objectID, or the object itself if it is a triangle
+	static Triangle *triangle(Scene const& scene, uint objectID, uint triangleID);
+	//Sorts the triangles into the screen tiles they may cover, for the camera's rows firstRow to firstRow + height - 1.
+	//The bins serve all samples of the camera. False if a triangle reaches behind the camera, nothing can be rendered then.
+	bool bin(Scene const& scene, CameraBase const& camera, uint width, uint firstRow, uint height);
+	//Fills the buffer with sample s of each pixel, with the scene and camera that were binned
+	void render(Scene const& scene, CameraBase const& camera, uint sample);
+	//Object and triangle seen at pixel (x, y) of the buffer, false for the background
+	bool lookup(uint x, uint y, uint &objectID, uint &triangleID)const{
+		Fragment const& fragment = mFragments[x + (size_t)y * mWidth];
+		objectID = fragment.objectID;
+		triangleID = fragment.triangleID;
+		return (objectID != NO_FRAGMENT);
+	};
+	size_t memoryUsage(void)const;
+private:
+	static const uint NO_FRAGMENT = 0xFFFFFFFF;
+	struct Fragment{
+		uint objectID, triangleID;
+		float depth; //Depth key of the camera's projection, larger is nearer
+	};
+	struct TriangleRef{
+		uint objectID, triangleID;
+	};
+	void rasterize(TriangleRef const& ref, glm::vec3 const* screen, glm::vec2 const& offset, uint const* bounds);
+	uint mWidth, mHeight, mFirstRow;
+	uint mNTilesX, mNTilesY;
+	uint mNThreads; //Threads that binned
+	std::vector<Fragment> mFragments;
+	std::vector<std::vector<TriangleRef> > mBins; //Per thread and tile, so that binning needs no locks
+};
+
+#endif
@@ -6,7 +6,32 @@
 #include "camera.h"
 #include "grid.h"
 #include "photonmap.h"
+#include "tile.h"
+#include "accumbuffer.h"
+#include "wavefront.h"
+#include "compiledscene.h"
+#include "isa.h"
+#include "raster.h"
+#include "denoiser.h"
+#include "heatmap.h"
 #include <boost/random/mersenne_twister.hpp>
+#include <string>
+#include <utility>
+
+#define TRACE_DEPTH 3 //Reflections followed from the first hit
+
+//Options of the recursive integrator, resolved once per sample pass into the template arguments of the tile loop,
+//so that it has no branches for the options that are off
+enum eTraceFeature{
+	TRACE_RASTERIZED = 1, //First hits from the rasteriser's visibility buffer
+	TRACE_AOVS = 2, //Records the first hits
+	TRACE_COSTS = 4, //Records the cost of each sample
+	TRACE_OCCLUSION = 8, //Ambient occlusion instead of photons and lights
+	N_TRACE_VARIANTS = 16
+};
+
+class RayTracer;
+typedef void (*PassCallback)(RayTracer const& raytracer, uint pass, void *userData);
 
 class RayTracer{
 public:
@@ -14,30 +39,117 @@ public:
 	~RayTracer(void);
 	void Trace(CameraBase &camera);
 	void Init(Scene *scene);
-	uchar const* readBuffer(void){return mBuffer;};
+	void Init(Scene *scene, CompiledScene const& compiled); //Takes the grid from the compiled scene the objects were instantiated from
+	bool InitShared(Scene *scene, std::string const& photonPrefix, uint part, uint nParts);
+	void Refit(std::vector<uint> const& movedObjects, bool isPhotonMapStale);
+	uchar const* readBuffer(void)const{return mBuffer;};
+	AccumBuffer const& readAccumBuffer(void)const{return mAccum;};
+	AOVBuffer const& readAOVs(void)const{return mAOVs;}; //First hits of the first sample Trace took of each pixel
+	void setAOVs(bool isRecorded){mIsAOVRecorded = isRecorded;};
+	//The resolved image of Trace is denoised with this many filter passes, the accumulation buffer keeps the samples.
+	//Records the AOVs, 0 turns it off.
+	void setDenoising(uint nIterations){mNDenoiseIterations = nIterations;};
+	//Costs of each pixel summed over the samples Trace took, recorded by the recursive integrator only
+	CostBuffer const& readCosts(void)const{return mCosts;};
+	void setCostRecording(bool isRecorded){mIsCostRecorded = isRecorded;};
+	//See Grid::setResolution, a density of 0 tunes the grid to the scene
+	void setGridResolution(float density, uint maxResolution){mGrid.setResolution(density, maxResolution);};
+	void setTileSize(uint tileSize){mTileSize = tileSize;};
+	void setIntegrator(eIntegrator integrator){mIntegrator = integrator;};
+	//Shades with short range ambient occlusion from nRays rays of the given length instead of photons and lights,
+	//and skips the photon map. Call before Init, 0 rays for the default shading.
+	void setAmbientOcclusion(uint nRays, float distance){mNAORays = nRays; mAODistance = distance;};
+	//Finds the first hits of the camera rays with the rasteriser, rays are still traced for everything after them.
+	//Scenes with other objects than polyhedra and triangles, or reaching behind the camera, are traced as usual.
+	void setRasterization(bool isRasterized){mIsRasterized = isRasterized;};
+	//Init builds copies of the grid and photon map on each NUMA node, threads pinned with pinThreads read their node's copy
+	void setReplication(bool isReplicated){mIsReplicated = isReplicated;};
+	void setRefittable(bool isRefittable){mIsRefittable = isRefittable;}; //Call before Init to allow Refit
+	void setTimeBudget(double seconds); //Wall clock limit for Trace in seconds, 0 for no limit
+	void setPassCallback(PassCallback callback, void *userData); //Called after each progressive sample pass
+	void setTilePartition(uint part, uint nParts); //Trace only the part-th of nParts contiguous ranges of tiles
+	void setPassRange(uint firstPass, uint nPasses); //Trace only this range of the camera's samples, nPasses = 0 for all
+	void setRowWindow(uint firstRow, uint nRows); //Trace the first nRows rows of the buffer as the camera's rows from firstRow on, for bands of larger images
+	bool loadCheckpoint(char const* filename); //Continues from the samples stored in the checkpoint
+	bool saveCheckpoint(char const* filename)const;
+	void clearAccumulation(void);
+	void resize(uint width, uint height); //Keeps the scene, the grid and the photon map, clears the image
 	
 private:
-	void traceRay(Ray &ray, colorRGBF &pixelColor, uint level, float Rcoef)const;
+	//The tile loop of the recursive integrator for a set of eTraceFeature flags and a camera type, so that the camera
+	//is called directly. Cameras of other types than the ones tileTracer knows go through CameraBase.
+	template<uint features, class Camera>
+	void traceTile(CameraBase const& camera, Tile const& tile, uint sample, uint pass, colorRGBF *tileBuffer);
+	typedef void (RayTracer::*TileTracer)(CameraBase const& camera, Tile const& tile, uint sample, uint pass, colorRGBF *tileBuffer);
+	static TileTracer tileTracer(CameraBase const& camera, uint features);
+	template<class Camera, uint... features>
+	static TileTracer tileTracer(uint variant, std::integer_sequence<uint, features...>);
+	//The recursion is unrolled up to TRACE_DEPTH
+	template<bool isOcclusion, uint level> void traceRay(Ray &ray, colorRGBF &pixelColor, float Rcoef)const;
+	template<bool isOcclusion, uint level>
+	void shade(Ray &ray, float t, uint objectID, glm::vec3 const& normal, colorRGBF &pixelColor, float Rcoef)const;
+	//First hit of the camera ray through pixel (x, y) of the buffer, from the visibility buffer of the rasteriser
+	bool primaryIntersect(Ray const& ray, uint x, uint y, float &t, uint &objectID, glm::vec3 &normal)const;
+	//Nearest hit in the grid and the sphere system, spheres have the object IDs from mNObjects on
+	bool intersect(Ray const& ray, float &t, uint &objectID, glm::vec3 &normal)const;
+	bool shadowIntersect(Ray const& ray, float &t)const;
+	Material const& material(uint objectID)const;
+	AABB sceneAABB(void)const;
+	void traceWavefront(CameraBase const& camera, std::vector<uint> const& pixels, uint sample, bool isRasterized, AOVBuffer *aovs, colorRGBF *colors)const;
+	void sortRays(RayQueue &queue)const;
 	float mtRandf(float x, bool isSymmetric)const;
 	int mtRandi(int x);
 	glm::vec3 mtRandSphere(void)const;
 	glm::vec3 mtRandCosine(glm::vec3 dir)const;
 	glm::vec3 mtRandCone(float mincos)const;
-	void genPhotonMap(void);
+	void genPhotonMap(uint nPhotons);
+	void recordMemory(void)const; //Reports the size of the data structures to the stats
+	void replicate(void);
+	void clearReplicas(void);
+	Grid const& grid(void)const; //The copy on the calling thread's node
+	PhotonMap const& photonMap(void)const;
 	void tracePhoton(Photon &photon, uint level);
 	void traceShadowPhoton(Ray ray, uint objectID);
 	colorRGBF calcDiffuse(glm::vec3 position, glm::vec3 I, glm::vec3 N, Material mat)const;
 	colorRGBF calcIndirect(glm::vec3 position, glm::vec3 N, float &nShadowPhotons)const;
+	float calcOcclusion(glm::vec3 const& position, glm::vec3 const& N)const; //Fraction of the ambient occlusion rays that escape
+	//Compiled per instruction set level, see kernels.inl
+	template<eISA isa> colorRGBF calcDiffuseISA(glm::vec3 const& position, glm::vec3 const& I, glm::vec3 const& N, Material const& mat)const;
+	template<eISA isa> colorRGBF calcIndirectISA(glm::vec3 const& position, glm::vec3 const& N, float &nShadowPhotons)const;
 	uint mWidth, mHeight;
-	uint mDepth;
 	uint mPhotonDepth;
 	uint mNPhotons;
+	uint mPhotonCount; //Stored by genPhotonMap so far
+	uint mNAORays;
+	float mAODistance;
+	uint mTileSize;
+	eIntegrator mIntegrator;
+	uint mWavefrontSize; //Number of pixels traced together by the wavefront integrator
+	bool mIsRefittable;
+	bool mIsRasterized;
+	bool mIsAOVRecorded;
+	uint mNDenoiseIterations;
+	bool mIsReplicated;
+	bool mIsCostRecorded;
+	uint mTilePart, mNTileParts;
+	double mSharedTimeout;
+	uint mFirstPass, mNPasses;
+	uint mFirstRow, mNRows;
+	double mTimeBudget;
+	PassCallback mPassCallback;
+	void *mPassCallbackData;
 	uint mNObjects, mNPointLights, mNPlanes;
 	Scene *mScene;
 	Grid mGrid;
+	Rasterizer mRaster;
 	uchar *mBuffer;
-	boost::random::mt19937 randGen_;
+	AccumBuffer mAccum;
+	AOVBuffer mAOVs;
+	CostBuffer mCosts;
+	mutable boost::random::mt19937 randGen_; //For the photons, advanced by the const samplers
 	PhotonMap mPhotonMap;
+	std::vector<Grid*> mNodeGrids; //Copies for the NUMA nodes from 1 on
+	std::vector<PhotonMap*> mNodePhotonMaps;
 };
 
 
@@ -6,6 +6,8 @@
 #include "common.h"
 #include <glm/glm.hpp>
 #include "object.h"
+#include "camera.h"
+#include "spheresystem.h"
 
 struct PointLight{
 	PointLight(void){};
@@ -69,21 +71,51 @@ struct AreaLight{
 	PointLight *mPointLights;
 };
 
+//Levels of detail of polyhedra, see Scene::setLOD
+enum eLOD{
+	LOD_FULL,
+	LOD_HULL, //The model decimated by vertex clustering
+	LOD_IMPOSTOR, //A sphere with the mean projected area of the model
+	N_LODS
+};
+
 class Scene{
 public:
-	Scene(void) : mNObjects(0), mNPlanes(0), mNPointLights(0), mNAreaLights(0), mNTypes(0), mModelMatrix(glm::mat4(1.0)){};
+	Scene(void) : mLODCamera(NULL), mCullCamera(NULL), mCullMargin(0.0f), mNObjects(0), mNPlanes(0), mNPointLights(0), mNAreaLights(0), mNTypes(0), mModelMatrix(glm::mat4(1.0)){
+		clearLODCounts();
+	};
 	~Scene(void);
 	void addSphere(glm::vec3 position, float radius, Material& material);
+	void addSpherocylinder(glm::vec3 position, glm::vec4 rotation, float radius, float length, Material& material);
+	void addSuperellipsoid(glm::vec3 position, glm::vec4 rotation, glm::vec3 semiAxes, float exponent, Material& material);
 	void addPlane(glm::vec3 normal, glm::vec3 point, Material& material);
 	void addTriangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, Material& material);
 	void addPolyhedron(int objectID, glm::vec3 position, Material &material, glm::vec4 rotation, float scale);
+	void moveObject(uint objectID, glm::vec3 position, glm::vec4 rotation, float scale); //objectID as in object(i), the scale only applies to polyhedra
+	void clearObjects(void); //Keeps types, planes and lights for the next configuration, empties the sphere system
+	//Polyhedra added from now on whose size on screen is below hullPixels get a decimated model, below impostorPixels
+	//a sphere. Only for scenes that are neither moved nor compiled, NULL turns it off.
+	void setLOD(CameraBase const* camera, float hullPixels, float impostorPixels);
+	uint lodCount(eLOD lod)const{ return mLODCounts[lod];}; //Polyhedra added at each level since the last clearObjects
+	//Culling at build time: whoever adds particles asks isCulled first. A particle is culled if its bounding
+	//sphere, widened by the margin, is outside the camera's view or entirely beyond one of the clipping planes.
+	void setCulling(CameraBase const* camera, float margin); //NULL only clips
+	void addClipPlane(glm::vec3 normal, float offset); //Keeps the half space dot(normal, p) <= offset
+	bool isCulled(glm::vec3 const& position, float radius)const;
 	int addPolyhedronType(std::string objFile);
+	int addPolyhedronType(PolyhedronType const& polyType);
+	void addPolyhedron(int objectID, Material &material, glm::vec3 const* vertices, glm::vec3 const* normals, AABB const* triangleAABBs, AABB const& aabb); //Already transformed
 	void addPointLight(glm::vec3 position, colorRGBF color); //Add support for more light types
 	void addAreaLight(glm::vec3 position, glm::vec3 normal, float radius, colorRGBF color, uint nPoints);
 	uint nObjects(void)const{ return mNObjects;};
 	uint nPointLights(void)const{ return mNPointLights;};
 	uint nPlanes(void)const{ return mNPlanes;};
+	uint nTypes(void)const{ return mNTypes;};
+	size_t memoryUsage(void)const; //Objects and types, without the sphere system
+	PolyhedronType const& polyhedronType(uint i)const{ return *mTypes[i];};
 	Object* object(uint i)const;
+	SphereSystem &sphereSystem(void){ return mSphereSystem;}; //Hard spheres, kept apart from the objects
+	SphereSystem const& sphereSystem(void)const{ return mSphereSystem;};
 	Plane* plane(uint i)const;
 	PointLight const& pointLight(uint i)const;
 	void translate(glm::vec3 trVector);
@@ -91,11 +123,22 @@ public:
 	
 private:
 	bool parsePolyObj(std::string, PolyhedronType &pType); //Helper function
-	std::vector<PolyhedronType> mTypes;
+	void buildLOD(uint typeID);
+	void clearLODCounts(void){ for(uint i = 0; i < N_LODS; i++) mLODCounts[i] = 0;};
+	std::vector<int> mHullTypes; //Per type, -1 if decimating saves little
+	std::vector<float> mImpostorRadii; //Per type at scale 1, 0 while the levels are not built
+	CameraBase const* mLODCamera;
+	float mLODPixels[2];
+	uint mLODCounts[N_LODS];
+	CameraBase const* mCullCamera;
+	float mCullMargin;
+	std::vector<glm::vec4> mClipPlanes; //Unit normal and offset
+	std::vector<PolyhedronType*> mTypes; //Pointers, so that polyhedra can keep referring to their type
 	std::vector<Object*> mObjects;
 	std::vector<Plane*> mPlanes; //Keep planes separate for grid
 	std::vector<PointLight*> mPointLights;
 	std::vector<AreaLight*> mAreaLights;
+	SphereSystem mSphereSystem;
 	uint mNObjects;
 	uint mNPlanes;
 	uint mNPointLights;
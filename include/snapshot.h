@@ -0,0 +1,42 @@
+#ifndef RT_SNAPSHOT_H
+#define RT_SNAPSHOT_H
+
+#include <vector>
+#include <string>
+#include <glm/glm.hpp>
+#include "common.h"
+#include "mappedfile.h"
+
+struct SnapshotParticle{
+	uint type;
+	glm::vec3 position;
+	glm::vec4 rotation; //Angle followed by the axis
+};
+
+//One configuration of a simulation: the particle count, the type count, the box matrix,
+//one line per particle and one line per type with its name, an optional scale and up to four shape
+//parameters for the analytic types
+struct Snapshot{
+	glm::vec3 center(void)const{
+		return 0.5f * glm::vec3(box[0] + box[1] + box[2], box[4] + box[5], box[8]);
+	};
+	float box[9];
+	std::vector<std::string> typeNames;
+	std::vector<float> typeScales;
+	std::vector<glm::vec4> typeShapes; //Zero where not given
+	std::vector<SnapshotParticle> particles;
+};
+
+//Reads the snapshots of a file. Trajectories are just snapshots one after the other.
+//The file is mapped and the particle block is parsed in parallel, straight into the snapshot.
+class SnapshotReader{
+public:
+	SnapshotReader(void): mPos(NULL){};
+	bool open(char const* filename);
+	bool next(Snapshot &snapshot); //False at the end of the file or on a malformed snapshot
+private:
+	MappedFile mFile;
+	char const* mPos;
+};
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef RT_SPHERESYSTEM_H
+#define RT_SPHERESYSTEM_H
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "common.h"
+#include "object.h"
+#include "ray.h"
+#include "isa.h"
+
+//Hard sphere systems: the centres and radii are kept as arrays and traced through a grid of their own,
+//whose cells hold 32-bit sphere indices. A sphere costs about 40 bytes including the grid, where a
+//Sphere object alone takes over a hundred, so systems of 10^7 spheres fit in a few hundred MB.
+class SphereSystem{
+public:
+	SphereSystem(void){
+		mRes[0] = mRes[1] = mRes[2] = 0;
+	};
+	uint addMaterial(Material const& material); //At most 256
+	void reserve(uint nSpheres);
+	void add(glm::vec3 position, float radius, uint material);
+	void clear(void);
+	void construct(void); //Builds the grid and reorders the spheres by cell, call after adding them
+	uint size(void)const{
+		return mX.size();
+	};
+	Material const& material(uint sphereID)const{
+		return mMaterials[mMaterialIDs[sphereID]];
+	};
+	AABB const& aabb(void)const{
+		return mAABB;
+	};
+	bool intersect(Ray const& ray, float &t, uint &sphereID, glm::vec3 &normal)const;
+	bool shadowIntersect(Ray const& ray, float &t)const;
+	size_t memoryUsage(void)const;
+private:
+	//Compiled per instruction set level, see kernels.inl
+	template<eISA isa> bool intersectISA(Ray const& ray, float &t, uint &sphereID, glm::vec3 &normal)const;
+	template<eISA isa> bool shadowIntersectISA(Ray const& ray, float &t)const;
+	std::vector<float> mX, mY, mZ, mRadius;
+	std::vector<uchar> mMaterialIDs;
+	std::vector<Material> mMaterials;
+	std::vector<uint> mCellStarts; //The spheres of cell i are mItems[mCellStarts[i]] up to mItems[mCellStarts[i + 1]]
+	std::vector<uint> mItems;
+	uint mRes[3];
+	glm::vec3 mCellDim;
+	AABB mAABB;
+};
+
+#endif
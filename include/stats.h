@@ -0,0 +1,63 @@
+#ifndef RT_STATS_H
+#define RT_STATS_H
+
+#include <chrono>
+#include <cstddef>
+#include "common.h"
+
+//Instrumentation: wall clock time per phase, hot path counters and the memory used by the large data structures.
+//Counters are kept per thread in their own cache line, so counting does not make threads share lines.
+//Build with -DRT_NO_STATS to compile the counters out.
+
+enum ePhase{
+	PHASE_PARSE,
+	PHASE_GRID,
+	PHASE_PHOTONS,
+	PHASE_KDTREE,
+	PHASE_TRACE,
+	PHASE_RASTER, //Part of the trace when the first hits are rasterised
+	PHASE_ENCODE,
+	N_PHASES
+};
+
+enum eCounter{
+	COUNTER_RAYS,
+	COUNTER_CELLS_VISITED,
+	COUNTER_PRIMITIVE_TESTS,
+	COUNTER_SHADOW_RAYS,
+	COUNTER_PHOTON_GATHERS,
+	COUNTER_PHOTONS_EXAMINED,
+	N_COUNTERS
+};
+
+struct alignas(64) ThreadCounters{
+	unsigned long long counts[N_COUNTERS];
+};
+
+ThreadCounters &threadCounters(void); //The calling thread's counters
+
+inline void statsCount(eCounter counter, unsigned long long n){
+#ifndef RT_NO_STATS
+	threadCounters().counts[counter] += n;
+#endif
+}
+
+unsigned long long statsTotal(eCounter counter); //Summed over all threads
+void statsAddPhase(ePhase phase, double seconds);
+void statsMemory(char const* structure, size_t bytes); //Keeps the peak of each structure
+bool statsWriteReport(char const* filename); //JSON
+void statsReportAtExit(char const* filename);
+
+//Adds the time from construction to destruction to a phase
+class PhaseTimer{
+public:
+	PhaseTimer(ePhase phase): mPhase(phase), mStart(std::chrono::steady_clock::now()){};
+	~PhaseTimer(void){
+		statsAddPhase(mPhase, std::chrono::duration<double>(std::chrono::steady_clock::now() - mStart).count());
+	};
+private:
+	ePhase mPhase;
+	std::chrono::steady_clock::time_point mStart;
+};
+
+#endif
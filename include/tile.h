@@ -0,0 +1,36 @@
+#ifndef RT_TILE_H
+#define RT_TILE_H
+
+#include <vector>
+#include <omp.h>
+#include "common.h"
+
+struct Tile{
+	Tile(void){};
+	Tile(uint x, uint y, uint width, uint height): x0(x), y0(y), x1(x + width), y1(y + height){};
+	uint x0, y0; //First pixel of the tile
+	uint x1, y1; //One past the last pixel of the tile
+};
+
+//Splits the image into square tiles and returns them sorted along a Morton (Z-order) curve
+std::vector<Tile> genTiles(uint width, uint height, uint tileSize);
+
+//Hands out tile indices to threads. Each thread owns a contiguous range of the Morton ordered tiles
+//and works through it from the front. When its range runs dry it steals the back half of the fullest range.
+class TileScheduler{
+public:
+	TileScheduler(uint nTiles, uint nThreads);
+	~TileScheduler(void);
+	bool next(uint threadID, uint &tileID);
+private:
+	struct Range{
+		uint begin, end;
+		omp_lock_t lock;
+		char pad[64]; //Keep ranges of different threads on separate cache lines
+	};
+	bool steal(uint threadID, uint &tileID);
+	Range *mRanges;
+	uint mNThreads;
+};
+
+#endif
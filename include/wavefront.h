@@ -0,0 +1,62 @@
+#ifndef RT_WAVEFRONT_H
+#define RT_WAVEFRONT_H
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "common.h"
+#include "ray.h"
+
+enum eIntegrator{
+	RECURSIVE, //Depth first per sample
+	WAVEFRONT //Breadth first over batches of samples, stage by stage
+};
+
+//Structure of arrays queue of rays waiting to be extended by the wavefront integrator
+struct RayQueue{
+	void resize(uint n);
+	uint size(void)const{
+		return pixel.size();
+	};
+	Ray ray(uint i)const{
+		return Ray(glm::vec3(ox[i], oy[i], oz[i]), glm::vec3(dx[i], dy[i], dz[i]));
+	};
+	void push(Ray const& ray, uint pixelID, colorRGBF const& weight, float coef, uint level);
+	void set(uint i, Ray const& ray, uint pixelID, colorRGBF const& weight, float coef, uint level);
+	void permute(std::vector<uint> const& order); //Reorders the queue so that entry i becomes entry order[i]
+	void clear(void){
+		resize(0);
+	};
+	std::vector<float> ox, oy, oz; //Origin
+	std::vector<float> dx, dy, dz; //Direction
+	std::vector<float> wr, wg, wb; //Weight of the path's contribution to the pixel
+	std::vector<float> coef; //Reflection coefficient, for terminating the path
+	std::vector<uint> pixel, level;
+};
+
+//Structure of arrays of the hits found in the extend stage, input to the gather, shadow and shade stages
+struct HitQueue{
+	void resize(uint n);
+	uint size(void)const{
+		return objectID.size();
+	};
+	std::vector<float> px, py, pz; //Position
+	std::vector<float> nx, ny, nz; //Normal
+	std::vector<float> ix, iy, iz; //Incoming direction
+	std::vector<float> wr, wg, wb;
+	std::vector<float> coef;
+	std::vector<uint> objectID, pixel, level;
+	std::vector<uint> firstShadow; //Shadow rays of hit i are firstShadow[i] to firstShadow[i + 1] - 1
+};
+
+//Shadow rays towards the point lights, one for each light in front of the hit
+struct ShadowQueue{
+	void resize(uint n);
+	uint size(void)const{
+		return hit.size();
+	};
+	std::vector<uint> hit, light;
+	std::vector<float> dx, dy, dz, distance;
+	std::vector<uchar> isVisible;
+};
+
+#endif
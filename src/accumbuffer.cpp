@@ -0,0 +1,176 @@
+#include "../include/accumbuffer.h"
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+static inline float minf(float a, float b){
+	if(a < b) return a;
+	else return b;
+}
+
+static inline uchar srgbEncode(float c){
+	static const float gamma = 1.0f / 2.2f;
+	if (c < 0.018) return uchar(1118.93f * c); 
+	else return uchar(275.141f * pow(c, gamma) - 20.141f); // Inverse gamma 2.2
+}
+
+AccumBuffer::AccumBuffer(uint width, uint height): mWidth(width), mHeight(height), mFirstPass(0), mNPasses(0){
+	mColors = new colorRGBF[(size_t)width * height];
+	mSamples = new uint[(size_t)width * height]();
+}
+
+AccumBuffer::~AccumBuffer(void){
+	delete[] mColors;
+	delete[] mSamples;
+}
+
+void AccumBuffer::clear(void){
+	for(size_t i = 0; i < (size_t)mWidth * mHeight; i++){
+		mColors[i] = colorRGBF();
+		mSamples[i] = 0;
+	}
+}
+
+void AccumBuffer::resize(uint width, uint height){
+	if(width != mWidth || height != mHeight){
+		delete[] mColors;
+		delete[] mSamples;
+		mWidth = width;
+		mHeight = height;
+		mColors = new colorRGBF[(size_t)width * height];
+		mSamples = new uint[(size_t)width * height];
+	}
+	clear();
+}
+
+uint AccumBuffer::minSamples(void)const{
+	uint retValue = 0xffffffff;
+	for(size_t i = 0; i < (size_t)mWidth * mHeight; i++){
+		if(mSamples[i] < retValue) retValue = mSamples[i];
+	}
+	return retValue;
+}
+
+colorRGBF AccumBuffer::mean(uint x, uint y)const{
+	size_t index = x + (size_t)mWidth * y;
+	if(mSamples[index] == 0) return colorRGBF();
+	colorRGBF color = mColors[index];
+	return color * (1.0f / mSamples[index]);
+}
+
+void AccumBuffer::resolve(uchar *buffer)const{
+	#pragma omp parallel for schedule(static)
+	for(uint j = 0; j < mHeight; j++){
+		for(uint i = 0; i < mWidth; i++){
+			size_t index = i + (size_t)mWidth * j;
+			uint nSamples = mSamples[index];
+			if(nSamples == 0) continue;
+			colorRGBF const& color = mColors[index];
+			buffer[3*index + 0] = srgbEncode(minf(color.r / nSamples, 1.0f));
+			buffer[3*index + 1] = srgbEncode(minf(color.g / nSamples, 1.0f));
+			buffer[3*index + 2] = srgbEncode(minf(color.b / nSamples, 1.0f));
+		}
+	}
+}
+
+bool AccumBuffer::save(char const* filename)const{
+	//Write to a temporary file first so that a job killed while writing does not destroy the last checkpoint
+	std::string tempFile = std::string(filename) + ".tmp";
+	FILE *file = fopen(tempFile.c_str(), "wb");
+	if(!file){
+		std::cout << "Error writing file \"" << tempFile << "\" by function " << "'" << __FUNCTION__ << "'" << std::endl;
+		return false;
+	}
+	fprintf(file, "PF\n%u %u\n-1.0\n", mWidth, mHeight);
+	size_t nPixels = (size_t)mWidth * mHeight;
+	float *row = new float[3 * mWidth];
+	bool isGood = true;
+	for(uint j = 0; j < mHeight && isGood; j++){
+		for(uint i = 0; i < mWidth; i++){
+			colorRGBF color = mean(i, j);
+			row[3*i + 0] = color.r;
+			row[3*i + 1] = color.g;
+			row[3*i + 2] = color.b;
+		}
+		isGood = (fwrite(row, sizeof(float), 3 * mWidth, file) == 3 * mWidth);
+	}
+	delete[] row;
+	if(isGood) isGood = (fwrite(mSamples, sizeof(uint), nPixels, file) == nPixels);
+	uint passRange[2] = {mFirstPass, mNPasses};
+	if(isGood) isGood = (fwrite(passRange, sizeof(uint), 2, file) == 2);
+	if(fclose(file) != 0) isGood = false;
+	if(!isGood || rename(tempFile.c_str(), filename) != 0){
+		std::cout << "Error writing file \"" << filename << "\" by function " << "'" << __FUNCTION__ << "'" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool AccumBuffer::load(char const* filename){
+	FILE *file = fopen(filename, "rb");
+	if(!file){
+		std::cout << "Error parsing file \"" << filename << "\" by function " << "'" << __FUNCTION__ << "'" << std::endl;
+		return false;
+	}
+	char magic[3] = {0};
+	uint width, height;
+	float scale;
+	if(fscanf(file, "%2s %u %u %f", magic, &width, &height, &scale) != 4 || std::string(magic) != "PF" || fgetc(file) != '\n'){
+		std::cout << "File \"" << filename << "\" is not a checkpoint." << std::endl;
+		fclose(file);
+		return false;
+	}
+	if(scale > 0.0f){
+		std::cout << "Big endian checkpoints are not supported." << std::endl;
+		fclose(file);
+		return false;
+	}
+	
+	if(width != mWidth || height != mHeight){
+		delete[] mColors;
+		delete[] mSamples;
+		mWidth = width;
+		mHeight = height;
+		mColors = new colorRGBF[(size_t)width * height];
+		mSamples = new uint[(size_t)width * height];
+	}
+	size_t nPixels = (size_t)width * height;
+	float *data = new float[3 * nPixels];
+	bool isGood = (fread(data, sizeof(float), 3 * nPixels, file) == 3 * nPixels);
+	if(isGood) isGood = (fread(mSamples, sizeof(uint), nPixels, file) == nPixels);
+	uint passRange[2];
+	if(isGood) isGood = (fread(passRange, sizeof(uint), 2, file) == 2);
+	fclose(file);
+	if(!isGood){
+		std::cout << "Checkpoint \"" << filename << "\" is truncated." << std::endl;
+		delete[] data;
+		clear();
+		return false;
+	}
+	for(size_t i = 0; i < nPixels; i++){
+		mColors[i] = float(mSamples[i]) * colorRGBF(data[3*i + 0], data[3*i + 1], data[3*i + 2]);
+	}
+	delete[] data;
+	mFirstPass = passRange[0];
+	mNPasses = passRange[1];
+	return true;
+}
+
+bool AccumBuffer::merge(AccumBuffer const& other){
+	if(other.mWidth != mWidth || other.mHeight != mHeight){
+		std::cout << "Cannot merge a " << other.mWidth << "x" << other.mHeight << " render into a " << mWidth << "x" << mHeight << " one." << std::endl;
+		return false;
+	}
+	for(size_t i = 0; i < (size_t)mWidth * mHeight; i++){
+		mColors[i] += other.mColors[i];
+		mSamples[i] += other.mSamples[i];
+	}
+	//Jobs that split the samples with -passes render adjacent ranges, the merge covers all of them
+	if(other.mFirstPass != mFirstPass || other.mNPasses != mNPasses){
+		uint firstPass = (other.mFirstPass < mFirstPass)? other.mFirstPass: mFirstPass;
+		mNPasses = (mNPasses == 0 || other.mNPasses == 0)? 0: mNPasses + other.mNPasses;
+		mFirstPass = firstPass;
+	}
+	return true;
+}
@@ -0,0 +1,156 @@
+#include "../include/affinity.h"
+#include <omp.h>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <thread>
+#include <algorithm>
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#endif
+
+#define HUGE_PAGE_SIZE (2 << 20)
+
+static thread_local uint currentNode = 0;
+static bool isHugePages = false;
+
+//Kernel lists like "0-3,8-11"
+static std::vector<uint> parseList(std::string const& filename){
+	std::vector<uint> values;
+	std::ifstream file(filename.c_str());
+	std::string list;
+	if(!std::getline(file, list)) return values;
+	std::stringstream stream(list);
+	std::string range;
+	while(std::getline(stream, range, ',')){
+		uint first, last;
+		if(sscanf(range.c_str(), "%u-%u", &first, &last) != 2){
+			if(sscanf(range.c_str(), "%u", &first) != 1) continue;
+			last = first;
+		}
+		for(uint i = first; i <= last; i++) values.push_back(i);
+	}
+	return values;
+}
+
+//Kernel IDs of the online nodes, a single node if there is no NUMA information.
+//Pinned threads ask for them concurrently, the static is initialised exactly once.
+static std::vector<uint> const& nodeIDs(void){
+	static std::vector<uint> const ids = [](void){
+		std::vector<uint> online;
+#ifdef __linux__
+		online = parseList("/sys/devices/system/node/online");
+#endif
+		if(online.empty()) online.push_back(0);
+		return online;
+	}();
+	return ids;
+}
+
+uint numaNodes(void){
+	return nodeIDs().size();
+}
+
+#ifdef __linux__
+static std::vector<uint> nodeCPUs(uint node){
+	std::stringstream filename;
+	filename << "/sys/devices/system/node/node" << nodeIDs()[node] << "/cpulist";
+	return parseList(filename.str());
+}
+
+static bool pinToNode(uint node){
+	std::vector<uint> cpus = nodeCPUs(node);
+	if(cpus.empty()) return false;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for(uint i = 0; i < cpus.size(); i++) CPU_SET(cpus[i], &set);
+	if(sched_setaffinity(0, sizeof(set), &set) != 0) return false;
+	currentNode = node;
+	return true;
+}
+#endif
+
+bool pinThreads(void){
+#ifdef __linux__
+	//Node of each CPU the process may run on, in node order
+	cpu_set_t allowed;
+	if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return false;
+	std::vector<uint> cpuNodes;
+	for(uint node = 0; node < numaNodes(); node++){
+		std::vector<uint> cpus = nodeCPUs(node);
+		for(uint i = 0; i < cpus.size(); i++){
+			if(CPU_ISSET(cpus[i], &allowed)) cpuNodes.push_back(node);
+		}
+	}
+	if(cpuNodes.empty()) return false;
+	bool isPinned = true;
+	#pragma omp parallel
+	{
+		uint nThreads = omp_get_num_threads();
+		uint threadID = omp_get_thread_num();
+		uint node = cpuNodes[(size_t)threadID * cpuNodes.size() / nThreads];
+		if(!pinToNode(node)){
+			#pragma omp atomic write
+			isPinned = false;
+		}
+	}
+	return isPinned;
+#else
+	return false;
+#endif
+}
+
+uint threadNode(void){
+	return currentNode;
+}
+
+void runOnNode(uint node, std::function<void(void)> const& function){
+	std::thread thread([node, &function](){
+#ifdef __linux__
+		pinToNode(node);
+#endif
+		function();
+	});
+	thread.join();
+}
+
+void interleaveMemory(bool isInterleaved){
+#ifdef __linux__
+	static const int MPOL_DEFAULT_POLICY = 0;
+	static const int MPOL_INTERLEAVE_POLICY = 3;
+	std::vector<uint> const& ids = nodeIDs();
+	if(ids.size() < 2) return;
+	unsigned long mask[16] = {0};
+	uint maxID = 0;
+	for(uint i = 0; i < ids.size(); i++){
+		if(ids[i] >= 16 * 8 * sizeof(unsigned long)) continue;
+		mask[ids[i] / (8 * sizeof(unsigned long))] |= 1ul << (ids[i] % (8 * sizeof(unsigned long)));
+		maxID = std::max(maxID, ids[i]);
+	}
+	//The policy belongs to the thread, so every OpenMP thread sets it
+	#pragma omp parallel
+	{
+		if(isInterleaved) syscall(SYS_set_mempolicy, MPOL_INTERLEAVE_POLICY, mask, (unsigned long)maxID + 2);
+		else syscall(SYS_set_mempolicy, MPOL_DEFAULT_POLICY, NULL, 0ul);
+	}
+#endif
+}
+
+void setHugePages(bool isEnabled){
+	isHugePages = isEnabled;
+}
+
+void adviseHugePages(void const* data, size_t bytes){
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+	if(!isHugePages) return;
+	//Only whole huge pages inside the range can be advised
+	size_t begin = ((size_t)data + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+	size_t end = ((size_t)data + bytes) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+	if(end > begin) madvise((void*)begin, end - begin, MADV_HUGEPAGE);
+#endif
+}
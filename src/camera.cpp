@@ -1,4 +1,5 @@
 #include "../include/camera.h"
+#include <cmath>
 
 OrthographicCamera::OrthographicCamera(glm::vec3 position, glm::vec3 direction, float x, float y, uint width, uint height, uint nSamples){
 	mNSamples = nSamples;
@@ -21,6 +22,27 @@ Ray OrthographicCamera::shootRay(uint x, uint y, uint s)const{
 	return tempRay;
 }
 
+float OrthographicCamera::pixelSize(glm::vec3 const& point)const{
+	return (mSizeX < mSizeY)? mSizeX: mSizeY;
+}
+
+bool OrthographicCamera::isVisible(glm::vec3 const& point, float radius)const{
+	glm::vec3 relative = point - mPosition;
+	if(glm::dot(relative, mDirection) < -radius) return false;
+	if(fabs(glm::dot(relative, mRightVector)) > mHalfWidth * mSizeX + radius) return false;
+	if(fabs(glm::dot(relative, mUpVector)) > mHalfHeight * mSizeY + radius) return false;
+	return true;
+}
+
+//The rays are parallel, the depth key is the negated distance from the camera plane
+bool OrthographicCamera::project(glm::vec3 const& point, glm::vec3 &screen)const{
+	glm::vec3 relative = point - mPosition;
+	float depth = glm::dot(relative, mDirection);
+	if(depth <= 0.0f) return false;
+	screen = glm::vec3(glm::dot(relative, mRightVector) / mSizeX + mHalfWidth, glm::dot(relative, mUpVector) / mSizeY + mHalfHeight, -depth);
+	return true;
+}
+
 PinholeCamera::PinholeCamera(glm::vec3 position, glm::vec3 lookAt, float fov, float aspect, float zNear, uint width, uint height, uint nSamples){
 	mNSamples = nSamples;
 	mDirection = glm::normalize(lookAt - position);
@@ -46,4 +68,58 @@ Ray PinholeCamera::shootRay(uint x, uint y, uint s)const{
 	glm::vec3 direction = mUpVector * (((float)y - (float)mHalfHeight + (float)sy / mNSamples) * mSizeY) + mRightVector * (((float)x - (float)mHalfWidth + (float)sx / mNSamples) * mSizeX) + mZNear * mDirection;
 	Ray tempRay = Ray(mPosition, glm::normalize(direction));
 	return tempRay;
-}
\ No newline at end of file
+}
+
+//Points behind the camera are only seen in reflections and shadows, they use their distance
+float PinholeCamera::pixelSize(glm::vec3 const& point)const{
+	float depth = glm::dot(point - mPosition, mDirection);
+	if(depth <= mZNear) depth = glm::length(point - mPosition);
+	float size = (mSizeX < mSizeY)? mSizeX: mSizeY;
+	return size * depth / mZNear;
+}
+
+//The side planes of the frustum go through the camera, a sphere is outside if it is farther than its radius from one
+bool PinholeCamera::isVisible(glm::vec3 const& point, float radius)const{
+	glm::vec3 relative = point - mPosition;
+	float depth = glm::dot(relative, mDirection);
+	if(depth < -radius) return false;
+	float slopes[2] = {mHalfWidth * mSizeX / mZNear, mHalfHeight * mSizeY / mZNear};
+	float offsets[2] = {glm::dot(relative, mRightVector), glm::dot(relative, mUpVector)};
+	for(uint i = 0; i < 2; i++){
+		if(fabs(offsets[i]) - slopes[i] * depth > radius * sqrt(1.0f + slopes[i] * slopes[i])) return false;
+	}
+	return true;
+}
+//Inverse of shootRay. The reciprocal depth is linear in screen space, the rasteriser interpolates it for the depth test.
+bool PinholeCamera::project(glm::vec3 const& point, glm::vec3 &screen)const{
+	glm::vec3 relative = point - mPosition;
+	float depth = glm::dot(relative, mDirection);
+	if(depth <= 0.0f) return false;
+	float scale = mZNear / depth;
+	screen = glm::vec3(glm::dot(relative, mRightVector) * scale / mSizeX + mHalfWidth, glm::dot(relative, mUpVector) * scale / mSizeY + mHalfHeight, 1.0f / depth);
+	return true;
+}
+
+CroppedCamera::CroppedCamera(CameraBase const& camera, uint x0, uint y0): mCamera(camera), mX0(x0), mY0(y0){
+	mNSamples = camera.getSamples();
+}
+
+Ray CroppedCamera::shootRay(uint x, uint y, uint s)const{
+	return mCamera.shootRay(mX0 + x, mY0 + y, s);
+}
+
+float CroppedCamera::pixelSize(glm::vec3 const& point)const{
+	return mCamera.pixelSize(point);
+}
+
+//The whole view, not just the window
+bool CroppedCamera::isVisible(glm::vec3 const& point, float radius)const{
+	return mCamera.isVisible(point, radius);
+}
+
+bool CroppedCamera::project(glm::vec3 const& point, glm::vec3 &screen)const{
+	if(!mCamera.project(point, screen)) return false;
+	screen.x -= mX0;
+	screen.y -= mY0;
+	return true;
+}
@@ -0,0 +1,238 @@
+#include "../include/compiledscene.h"
+#include "../include/stats.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <iostream>
+
+#define SECTION_ALIGNMENT 16
+
+//Layout checks, so that a file written on another platform is rejected instead of misread
+#define BYTE_ORDER_MARK 0x01020304u
+
+struct CompiledHeader{
+	char magic[8];
+	uint version;
+	uint byteOrder;
+	uint vec3Size;
+	uint instanceSize;
+	unsigned long long offsets[N_SECTIONS];
+	unsigned long long counts[N_SECTIONS];
+};
+
+struct CompiledType{
+	uint firstVertex;
+	uint nVertices;
+	uint firstTriangle;
+	uint nTriangles;
+};
+
+struct CompiledGrid{
+	glm::uvec3 resolution;
+	AABB aabb;
+};
+
+static char const compiledMagic[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+
+//Section data collected before writing
+struct SectionData{
+	SectionData(void): data(NULL), size(0), count(0){};
+	template<typename T>
+	void set(std::vector<T> const& vec){
+		data = vec.empty()? NULL: &vec[0];
+		size = vec.size() * sizeof(T);
+		count = vec.size();
+	};
+	void const* data;
+	size_t size;
+	size_t count;
+};
+
+bool compileScene(char const* filename, Scene &scene, std::vector<CompiledInstance> const& transforms, float const box[9],
+	float gridDensity, uint gridMaxResolution){
+	uint nObjects = scene.nObjects();
+	if(transforms.size() != nObjects){
+		std::cout << "Only scenes of polyhedra can be compiled." << std::endl;
+		return false;
+	}
+
+	std::vector<Material> materials;
+	std::vector<CompiledType> types(scene.nTypes());
+	std::vector<glm::vec3> typeVertices;
+	std::vector<glm::ivec3> typeTriangles;
+	for(uint i = 0; i < scene.nTypes(); i++){
+		PolyhedronType const& polyType = scene.polyhedronType(i);
+		types[i].firstVertex = typeVertices.size();
+		types[i].nVertices = polyType.mVertices.size();
+		types[i].firstTriangle = typeTriangles.size();
+		types[i].nTriangles = polyType.mTrVertIndices.size();
+		typeVertices.insert(typeVertices.end(), polyType.mVertices.begin(), polyType.mVertices.end());
+		typeTriangles.insert(typeTriangles.end(), polyType.mTrVertIndices.begin(), polyType.mTrVertIndices.end());
+	}
+
+	std::vector<CompiledInstance> instances(transforms);
+	std::vector<glm::vec3> vertices, normals;
+	std::vector<AABB> triangleAABBs;
+	for(uint i = 0; i < nObjects; i++){
+		if(scene.object(i)->mType != POLYHEDRON){
+			std::cout << "Only scenes of polyhedra can be compiled." << std::endl;
+			return false;
+		}
+		Polyhedron *polyhedron = (Polyhedron*)scene.object(i);
+		CompiledInstance &instance = instances[i];
+		for(instance.type = 0; &scene.polyhedronType(instance.type) != polyhedron->polyType(); instance.type++);
+		for(instance.material = 0; instance.material < materials.size(); instance.material++){
+			if(memcmp(&materials[instance.material], &polyhedron->mMaterial, sizeof(Material)) == 0) break;
+		}
+		if(instance.material == materials.size()) materials.push_back(polyhedron->mMaterial);
+		instance.firstVertex = vertices.size();
+		instance.firstTriangle = normals.size();
+		instance.aabb = polyhedron->mAABB;
+		vertices.insert(vertices.end(), polyhedron->vertices(), polyhedron->vertices() + types[instance.type].nVertices);
+		for(uint j = 0; j < polyhedron->nTriangles(); j++){
+			normals.push_back(polyhedron->triangle(j)->normal());
+			triangleAABBs.push_back(polyhedron->triangle(j)->mAABB);
+		}
+	}
+
+	Grid grid;
+	grid.setResolution(gridDensity, gridMaxResolution);
+	grid.construct(&scene);
+	std::vector<CompiledGrid> gridInfo(1);
+	gridInfo[0].resolution = grid.resolution();
+	gridInfo[0].aabb = grid.getAABB();
+	std::vector<uint> cellStarts;
+	std::vector<GridItem> cellItems;
+	grid.exportCells(&scene, cellStarts, cellItems);
+	std::vector<float> boxData(box, box + 9);
+
+	SectionData sections[N_SECTIONS];
+	sections[SECTION_MATERIALS].set(materials);
+	sections[SECTION_TYPES].set(types);
+	sections[SECTION_TYPE_VERTICES].set(typeVertices);
+	sections[SECTION_TYPE_TRIANGLES].set(typeTriangles);
+	sections[SECTION_INSTANCES].set(instances);
+	sections[SECTION_VERTICES].set(vertices);
+	sections[SECTION_NORMALS].set(normals);
+	sections[SECTION_TRIANGLE_AABBS].set(triangleAABBs);
+	sections[SECTION_GRID].set(gridInfo);
+	sections[SECTION_CELL_STARTS].set(cellStarts);
+	sections[SECTION_CELL_ITEMS].set(cellItems);
+	sections[SECTION_BOX].set(boxData);
+
+	CompiledHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, compiledMagic, sizeof(compiledMagic));
+	header.version = COMPILEDSCENE_VERSION;
+	header.byteOrder = BYTE_ORDER_MARK;
+	header.vec3Size = sizeof(glm::vec3);
+	header.instanceSize = sizeof(CompiledInstance);
+	unsigned long long offset = sizeof(header);
+	for(uint i = 0; i < N_SECTIONS; i++){
+		offset = (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+		header.offsets[i] = offset;
+		header.counts[i] = sections[i].count;
+		offset += sections[i].size;
+	}
+
+	std::string tempFile = std::string(filename) + ".tmp";
+	FILE *file = fopen(tempFile.c_str(), "wb");
+	if(!file){
+		std::cout << "Error writing file \"" << tempFile << "\" by function " << "'" << __FUNCTION__ << "'" << std::endl;
+		return false;
+	}
+	bool isGood = (fwrite(&header, sizeof(header), 1, file) == 1);
+	char const padding[SECTION_ALIGNMENT] = {0};
+	unsigned long long position = sizeof(header);
+	for(uint i = 0; i < N_SECTIONS && isGood; i++){
+		isGood = (fwrite(padding, 1, header.offsets[i] - position, file) == header.offsets[i] - position);
+		if(isGood && sections[i].size > 0) isGood = (fwrite(sections[i].data, 1, sections[i].size, file) == sections[i].size);
+		position = header.offsets[i] + sections[i].size;
+	}
+	if(fclose(file) != 0) isGood = false;
+	if(!isGood || rename(tempFile.c_str(), filename) != 0){
+		std::cout << "Error writing file \"" << filename << "\" by function " << "'" << __FUNCTION__ << "'" << std::endl;
+		return false;
+	}
+	std::cout << "Compiled " << nObjects << " instances of " << types.size() << " types and " << cellItems.size() << " grid entries into " << filename << "." << std::endl;
+	return true;
+}
+
+bool isCompiledScene(char const* filename){
+	char magic[8] = {0};
+	FILE *file = fopen(filename, "rb");
+	if(!file) return false;
+	size_t nRead = fread(magic, 1, sizeof(magic), file);
+	fclose(file);
+	return nRead == sizeof(magic) && memcmp(magic, compiledMagic, sizeof(magic)) == 0;
+}
+
+CompiledScene::CompiledScene(void): mBox(NULL){
+	memset(mOffsets, 0, sizeof(mOffsets));
+	memset(mCounts, 0, sizeof(mCounts));
+}
+
+bool CompiledScene::open(char const* filename){
+	if(!mFile.open(filename)) return false;
+	CompiledHeader header;
+	bool isValid = mFile.size() >= sizeof(header);
+	if(isValid){
+		memcpy(&header, mFile.begin(), sizeof(header));
+		isValid = memcmp(header.magic, compiledMagic, sizeof(compiledMagic)) == 0;
+	}
+	if(!isValid){
+		std::cout << "Error parsing file \"" << filename << "\" by function " << "'" << __FUNCTION__ << "'" << std::endl;
+		return false;
+	}
+	if(header.version != COMPILEDSCENE_VERSION || header.byteOrder != BYTE_ORDER_MARK || header.vec3Size != sizeof(glm::vec3) || header.instanceSize != sizeof(CompiledInstance)){
+		std::cout << filename << " was compiled by a different version or platform, compile it again." << std::endl;
+		return false;
+	}
+
+	//Element sizes, to check that every section lies inside the file
+	size_t const elementSizes[N_SECTIONS] = {
+		sizeof(Material), sizeof(CompiledType), sizeof(glm::vec3), sizeof(glm::ivec3), sizeof(CompiledInstance), sizeof(glm::vec3),
+		sizeof(glm::vec3), sizeof(AABB), sizeof(CompiledGrid), sizeof(uint), sizeof(GridItem), sizeof(float)
+	};
+	for(uint i = 0; i < N_SECTIONS; i++){
+		mOffsets[i] = header.offsets[i];
+		mCounts[i] = header.counts[i];
+		if(mOffsets[i] % SECTION_ALIGNMENT != 0 || mOffsets[i] + mCounts[i] * elementSizes[i] > mFile.size()) isValid = false;
+	}
+	if(!isValid || mCounts[SECTION_GRID] != 1 || mCounts[SECTION_BOX] != 9){
+		std::cout << "Error parsing file \"" << filename << "\" by function " << "'" << __FUNCTION__ << "'" << std::endl;
+		return false;
+	}
+	mBox = section<float>(SECTION_BOX);
+	return true;
+}
+
+void CompiledScene::instantiate(Scene &scene)const{
+	PhaseTimer timer(PHASE_PARSE);
+	CompiledType const* types = section<CompiledType>(SECTION_TYPES);
+	glm::vec3 const* typeVertices = section<glm::vec3>(SECTION_TYPE_VERTICES);
+	glm::ivec3 const* typeTriangles = section<glm::ivec3>(SECTION_TYPE_TRIANGLES);
+	std::vector<int> typeIDs(mCounts[SECTION_TYPES]);
+	for(uint i = 0; i < mCounts[SECTION_TYPES]; i++){
+		PolyhedronType polyType;
+		polyType.mVertices.assign(typeVertices + types[i].firstVertex, typeVertices + types[i].firstVertex + types[i].nVertices);
+		polyType.mTrVertIndices.assign(typeTriangles + types[i].firstTriangle, typeTriangles + types[i].firstTriangle + types[i].nTriangles);
+		typeIDs[i] = scene.addPolyhedronType(polyType);
+	}
+
+	std::vector<Material> materials(section<Material>(SECTION_MATERIALS), section<Material>(SECTION_MATERIALS) + mCounts[SECTION_MATERIALS]);
+	CompiledInstance const* instances = section<CompiledInstance>(SECTION_INSTANCES);
+	glm::vec3 const* vertices = section<glm::vec3>(SECTION_VERTICES);
+	glm::vec3 const* normals = section<glm::vec3>(SECTION_NORMALS);
+	AABB const* triangleAABBs = section<AABB>(SECTION_TRIANGLE_AABBS);
+	for(uint i = 0; i < mCounts[SECTION_INSTANCES]; i++){
+		CompiledInstance const& instance = instances[i];
+		scene.addPolyhedron(typeIDs[instance.type], materials[instance.material], vertices + instance.firstVertex,
+			normals + instance.firstTriangle, triangleAABBs + instance.firstTriangle, instance.aabb);
+	}
+}
+
+void CompiledScene::loadGrid(Grid &grid, Scene *scene)const{
+	CompiledGrid const& info = *section<CompiledGrid>(SECTION_GRID);
+	grid.load(scene, info.resolution, info.aabb, section<uint>(SECTION_CELL_STARTS), section<GridItem>(SECTION_CELL_ITEMS));
+}
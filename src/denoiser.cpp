@@ -0,0 +1,198 @@
+#include "../include/denoiser.h"
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+
+#define DENOISE_SIGMA_NORMAL 16.0f //Exponent of the cosine between normals, low enough to smooth over the facets of the models
+#define DENOISE_SIGMA_DEPTH 1.0f //Against the depth change expected from the local gradient
+#define DENOISE_SIGMA_LUMINANCE 4.0f //Against the standard deviation of the luminance
+#define DENOISE_MIN_ALBEDO 0.01f
+
+const uint AOVBuffer::NO_OBJECT;
+
+void AOVBuffer::resize(uint width, uint height){
+	mWidth = width;
+	mHeight = height;
+	clear();
+}
+
+void AOVBuffer::clear(void){
+	size_t nPixels = (size_t)mWidth * mHeight;
+	mAlbedo.assign(nPixels, colorRGBF());
+	mNormal.assign(nPixels, glm::vec3(0.0f));
+	mDepth.assign(nPixels, 0.0f);
+	mObjectID.assign(nPixels, NO_OBJECT);
+}
+
+static bool writePFM(std::string const& filename, uint width, uint height, uint nChannels, float const* data){
+	FILE *file = fopen(filename.c_str(), "wb");
+	if(!file){
+		std::cout << "Error writing file \"" << filename << "\" by function " << "'" << __FUNCTION__ << "'" << std::endl;
+		return false;
+	}
+	fprintf(file, "%s\n%u %u\n-1.0\n", (nChannels == 3)? "PF": "Pf", width, height);
+	size_t nValues = (size_t)width * height * nChannels;
+	bool isGood = (fwrite(data, sizeof(float), nValues, file) == nValues);
+	if(fclose(file) != 0) isGood = false;
+	if(!isGood){
+		std::cout << "Error writing file \"" << filename << "\" by function " << "'" << __FUNCTION__ << "'" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool AOVBuffer::save(std::string const& prefix)const{
+	size_t nPixels = (size_t)mWidth * mHeight;
+	std::vector<float> data(3 * nPixels);
+	for(size_t i = 0; i < nPixels; i++){
+		data[3*i + 0] = mAlbedo[i].r;
+		data[3*i + 1] = mAlbedo[i].g;
+		data[3*i + 2] = mAlbedo[i].b;
+	}
+	if(!writePFM(prefix + "_albedo.pfm", mWidth, mHeight, 3, &data[0])) return false;
+	for(size_t i = 0; i < nPixels; i++){
+		data[3*i + 0] = mNormal[i].x;
+		data[3*i + 1] = mNormal[i].y;
+		data[3*i + 2] = mNormal[i].z;
+	}
+	if(!writePFM(prefix + "_normal.pfm", mWidth, mHeight, 3, &data[0])) return false;
+	if(!writePFM(prefix + "_depth.pfm", mWidth, mHeight, 1, &mDepth[0])) return false;
+	for(size_t i = 0; i < nPixels; i++) data[i] = (mObjectID[i] == NO_OBJECT)? -1.0f: (float)mObjectID[i];
+	return writePFM(prefix + "_id.pfm", mWidth, mHeight, 1, &data[0]);
+}
+
+static inline float luminance(colorRGBF const& color){
+	return 0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b;
+}
+
+static inline float demodulate(float c, float albedo){
+	return c / ((albedo > DENOISE_MIN_ALBEDO)? albedo: DENOISE_MIN_ALBEDO);
+}
+
+static inline float remodulate(float c, float albedo){
+	return c * ((albedo > DENOISE_MIN_ALBEDO)? albedo: DENOISE_MIN_ALBEDO);
+}
+
+void denoise(AccumBuffer const& accum, AOVBuffer const& aovs, uint nIterations, AccumBuffer &filtered){
+	static const float kernel[5] = {1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+	int width = accum.width();
+	int height = accum.height();
+	size_t nPixels = (size_t)width * height;
+	std::vector<colorRGBF> color(nPixels), nextColor(nPixels);
+	std::vector<float> variance(nPixels), nextVariance(nPixels);
+	std::vector<float> gradient(nPixels); //Largest depth change to a neighbour of the same object
+	filtered.clear();
+
+	//Irradiance of the hits, the background and pixels without samples are left as they are
+	#pragma omp parallel for schedule(static)
+	for(int y = 0; y < height; y++){
+		for(int x = 0; x < width; x++){
+			size_t p = x + (size_t)width * y;
+			colorRGBF mean = accum.mean(x, y);
+			if(aovs.objectID(p) == AOVBuffer::NO_OBJECT) color[p] = mean;
+			else{
+				colorRGBF const& albedo = aovs.albedo(p);
+				color[p] = colorRGBF(demodulate(mean.r, albedo.r), demodulate(mean.g, albedo.g), demodulate(mean.b, albedo.b));
+			}
+		}
+	}
+	//Luminance variance and depth gradient over the 3x3 neighbourhood within the same object
+	#pragma omp parallel for schedule(static)
+	for(int y = 0; y < height; y++){
+		for(int x = 0; x < width; x++){
+			size_t p = x + (size_t)width * y;
+			uint objectID = aovs.objectID(p);
+			float sum = 0.0f, sumSquares = 0.0f, maxChange = 0.0f;
+			uint n = 0;
+			for(int dy = -1; dy <= 1; dy++){
+				for(int dx = -1; dx <= 1; dx++){
+					int qx = x + dx, qy = y + dy;
+					if(qx < 0 || qy < 0 || qx >= width || qy >= height) continue;
+					size_t q = qx + (size_t)width * qy;
+					if(aovs.objectID(q) != objectID || accum.samples(qx, qy) == 0) continue;
+					float l = luminance(color[q]);
+					sum += l;
+					sumSquares += l * l;
+					n++;
+					float change = fabs(aovs.depth(q) - aovs.depth(p));
+					if(change > maxChange) maxChange = change;
+				}
+			}
+			variance[p] = (n > 1)? (sumSquares - sum * sum / n) / (n - 1): 0.0f;
+			if(variance[p] < 0.0f) variance[p] = 0.0f; //Rounding
+			gradient[p] = maxChange;
+		}
+	}
+
+	for(uint iteration = 0; iteration < nIterations; iteration++){
+		int step = 1 << iteration;
+		#pragma omp parallel for schedule(dynamic, 8)
+		for(int y = 0; y < height; y++){
+			for(int x = 0; x < width; x++){
+				size_t p = x + (size_t)width * y;
+				uint objectID = aovs.objectID(p);
+				if(objectID == AOVBuffer::NO_OBJECT || accum.samples(x, y) == 0){
+					nextColor[p] = color[p];
+					nextVariance[p] = variance[p];
+					continue;
+				}
+				glm::vec3 const& normal = aovs.normal(p);
+				float depth = aovs.depth(p);
+				float lum = luminance(color[p]);
+				//The variance is blurred over the 3x3 neighbourhood first, a single pixel's estimate is too noisy
+				float blurred = 0.0f, blurredWeights = 0.0f;
+				for(int dy = -1; dy <= 1; dy++){
+					for(int dx = -1; dx <= 1; dx++){
+						int qx = x + dx, qy = y + dy;
+						if(qx < 0 || qy < 0 || qx >= width || qy >= height) continue;
+						size_t q = qx + (size_t)width * qy;
+						if(aovs.objectID(q) != objectID) continue;
+						float weight = kernel[dx + 2] * kernel[dy + 2];
+						blurred += weight * variance[q];
+						blurredWeights += weight;
+					}
+				}
+				float lumScale = DENOISE_SIGMA_LUMINANCE * sqrt(blurred / blurredWeights) + 1e-6f;
+				colorRGBF sum;
+				float sumVariance = 0.0f, sumWeights = 0.0f;
+				for(int j = 0; j < 5; j++){
+					int qy = y + (j - 2) * step;
+					if(qy < 0 || qy >= height) continue;
+					for(int i = 0; i < 5; i++){
+						int qx = x + (i - 2) * step;
+						if(qx < 0 || qx >= width) continue;
+						size_t q = qx + (size_t)width * qy;
+						if(aovs.objectID(q) != objectID || accum.samples(qx, qy) == 0) continue;
+						float cosine = glm::dot(normal, aovs.normal(q));
+						if(cosine <= 0.0f) continue;
+						float distance = step * sqrt((float)((i - 2) * (i - 2) + (j - 2) * (j - 2)));
+						float depthScale = DENOISE_SIGMA_DEPTH * gradient[p] * distance + 1e-3f * depth;
+						float weight = kernel[i] * kernel[j];
+						weight *= pow(cosine, DENOISE_SIGMA_NORMAL);
+						weight *= exp(-fabs(aovs.depth(q) - depth) / depthScale - fabs(luminance(color[q]) - lum) / lumScale);
+						sum += weight * color[q];
+						sumVariance += weight * weight * variance[q];
+						sumWeights += weight;
+					}
+				}
+				//The pixel itself always has weight, sumWeights is not 0
+				nextColor[p] = sum * (1.0f / sumWeights);
+				nextVariance[p] = sumVariance / (sumWeights * sumWeights);
+			}
+		}
+		color.swap(nextColor);
+		variance.swap(nextVariance);
+	}
+
+	for(int y = 0; y < height; y++){
+		for(int x = 0; x < width; x++){
+			if(accum.samples(x, y) == 0) continue;
+			size_t p = x + (size_t)width * y;
+			if(aovs.objectID(p) == AOVBuffer::NO_OBJECT) filtered.add(x, y, color[p], 1);
+			else{
+				colorRGBF const& albedo = aovs.albedo(p);
+				filtered.add(x, y, colorRGBF(remodulate(color[p].r, albedo.r), remodulate(color[p].g, albedo.g), remodulate(color[p].b, albedo.b)), 1);
+			}
+		}
+	}
+}
@@ -0,0 +1,67 @@
+#include "../include/distributed.h"
+#include <cstdio>
+#include <iostream>
+#include <cstdlib>
+#include <sstream>
+#include <thread>
+#include <chrono>
+
+std::string partFileName(std::string const& prefix, uint part){
+	std::ostringstream s;
+	s << prefix << "." << part;
+	return s.str();
+}
+
+static bool fileExists(std::string const& filename){
+	FILE *file = fopen(filename.c_str(), "rb");
+	if(!file) return false;
+	fclose(file);
+	return true;
+}
+
+bool waitForFile(std::string const& filename, double timeout, std::string const& abortFile){
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	while(1){
+		if(fileExists(filename)) return true;
+		if(fileExists(abortFile)){
+			std::cout << "Stopped waiting for \"" << filename << "\", another process failed." << std::endl;
+			return false;
+		}
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		if(elapsed.count() > timeout){
+			std::cout << "Timed out waiting for \"" << filename << "\"." << std::endl;
+			return false;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	}
+}
+
+std::string shellQuote(std::string const& arg){
+	std::string retString = "'";
+	for(uint i = 0; i < arg.size(); i++){
+		if(arg[i] == '\'') retString += "'\\''";
+		else retString += arg[i];
+	}
+	return retString + "'";
+}
+
+static void runCommand(std::string const& command, std::string const& failureFile, int *status){
+	*status = system(command.c_str());
+	if(*status != 0){
+		FILE *file = fopen(failureFile.c_str(), "wb");
+		if(file) fclose(file);
+	}
+}
+
+uint runCommands(std::vector<std::string> const& commands, std::string const& failureFile){
+	uint nCommands = commands.size();
+	std::vector<int> status(nCommands, -1);
+	std::vector<std::thread> threads;
+	for(uint i = 0; i < nCommands; i++) threads.push_back(std::thread(runCommand, commands[i], failureFile, &status[i]));
+	uint nSucceeded = 0;
+	for(uint i = 0; i < nCommands; i++){
+		threads[i].join();
+		if(status[i] == 0) nSucceeded++;
+	}
+	return nSucceeded;
+}
@@ -1,4 +1,20 @@
 #include "../include/grid.h"
+#include "../include/stats.h"
+#include "../include/affinity.h"
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_01.hpp>
+
+#define GRID_TUNE_SAMPLES (1 << 20) //Primitives the cost model looks at, larger scenes are subsampled
+#define GRID_TUNE_MAX_CELLS (1 << 24) //Largest grid the tuning considers
+#define GRID_TUNE_RAYS 4096
+#define GRID_TUNE_TOLERANCE 0.02f //Fraction over the lowest expected cost for which a smaller grid is preferred
+//Relative costs of the steps of a traversal, a cell costs a few primitive tests as its list is a cache miss away
+#define GRID_COST_STEP 3.0f //Stepping into a cell
+#define GRID_COST_CELL 3.0f //Fetching the list of a cell that is not empty
+#define GRID_COST_TEST 1.0f //Testing a primitive
 
 static inline float maxf(float a, float b){
 	float retVal = a;
@@ -24,7 +40,232 @@ static inline int mini(int a, int b){
 	return retVal;
 }
 
-void Grid::construct(Scene *scene){
+void Grid::clear(void){
+	uint nCells = mRes[0] * mRes[1] * mRes[2];
+	for(uint i = 0; i < nCells; i++){
+		if(mCells[i] != NULL) delete mCells[i];
+	}
+	delete[] mCells;
+	mCells = NULL;
+	mRes[0] = mRes[1] = mRes[2] = 0;
+	mRanges.clear();
+}
+
+Grid::CellRange Grid::cellRange(AABB const& aabb)const{
+	//convert AABB to cell coordinates
+	glm::vec3 minCell = (aabb.bounds[0] - mAABB.bounds[0]) / mCellDim;
+	glm::vec3 maxCell = (aabb.bounds[1] - mAABB.bounds[0]) / mCellDim;
+	CellRange range;
+	for(uint i = 0; i < 3; i++){
+		range.min[i] = uint(minCell[i]);
+		range.max[i] = uint(maxCell[i]);
+	}
+	return range;
+}
+
+//Inserts the object in all cells of the range, except for those also in the exclude range
+void Grid::insert(CellRange const& range, Object *object, uint objectID, CellRange const* exclude){
+	for(uint z = range.min.z; z <= range.max.z; z++){
+		for(uint y = range.min.y; y <= range.max.y; y++){
+			for(uint x = range.min.x; x <= range.max.x; x++){
+				if(exclude && exclude->contains(x, y, z)) continue;
+				uint index = x + y * mRes[0] + z * mRes[0] * mRes[1];
+				if(mCells[index] == NULL) mCells[index] = new Cell;
+				mCells[index]->insert(object, objectID);
+			}
+		}
+	}
+}
+
+void Grid::remove(CellRange const& range, Object *object, CellRange const& exclude){
+	for(uint z = range.min.z; z <= range.max.z; z++){
+		for(uint y = range.min.y; y <= range.max.y; y++){
+			for(uint x = range.min.x; x <= range.max.x; x++){
+				if(exclude.contains(x, y, z)) continue;
+				uint index = x + y * mRes[0] + z * mRes[0] * mRes[1];
+				if(mCells[index] != NULL) mCells[index]->remove(object);
+			}
+		}
+	}
+}
+
+void Grid::Cell::remove(Object* objPtr){
+	for(uint i = 0; i < list.size(); i++){
+		if(list[i].object == objPtr){
+			list[i] = list.back();
+			list.pop_back();
+			return;
+		}
+	}
+}
+
+//Cells along each axis for the density, at least 1 and at most maxResolution
+static void resolutionFor(glm::vec3 const& gridSize, uint nPrimitives, float density, uint maxResolution, uint *res){
+	float cubeRoot = pow((density * nPrimitives) / (gridSize[0] * gridSize[1] * gridSize[2]), 0.333);
+	for(uint i = 0; i < 3; i++){
+		float temp = gridSize[i] * cubeRoot;
+		temp = maxf(1.0f, minf(temp, (float)maxResolution));
+		res[i] = (uint)temp;
+	}
+}
+
+static inline float surfaceArea(glm::vec3 const& size){
+	return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+//Expected cost of a ray walking through the cells of a candidate grid, from the number of primitives and their share of
+//bounding box area in each cell. By Cauchy's formula a line through a cell meets a convex primitive inside it with
+//probability area(primitive) / area(cell), so the ray gets through a cell with probability exp(-areas / area(cell)).
+//The first cell of a ray that starts on a primitive does not stop it.
+static float walkCost(Ray const& ray, bool isOnPrimitive, AABB const& aabb, uint const* res, glm::vec3 const& cellDim,
+	float const* counts, float const* areas){
+	float tEnter = 0.0f;
+	if(!isOnPrimitive && !aabb.intersect(ray, tEnter)) return 0.0f;
+	glm::vec3 start = ray.r0 + tEnter * ray.dir;
+	int cell[3], step[3], out[3];
+	float tMax[3], tDelta[3];
+	for(uint i = 0; i < 3; i++){
+		float local = (start[i] - aabb.bounds[0][i]) / cellDim[i];
+		cell[i] = mini(maxi((int)local, 0), (int)res[i] - 1);
+		if(ray.dir[i] > 0.0f){
+			step[i] = 1;
+			out[i] = res[i];
+			tMax[i] = ((cell[i] + 1) - local) * cellDim[i] / ray.dir[i];
+			tDelta[i] = cellDim[i] / ray.dir[i];
+		}
+		else if(ray.dir[i] < 0.0f){
+			step[i] = -1;
+			out[i] = -1;
+			tMax[i] = (cell[i] - local) * cellDim[i] / ray.dir[i];
+			tDelta[i] = -cellDim[i] / ray.dir[i];
+		}
+		else{
+			step[i] = 0;
+			out[i] = -2;
+			tMax[i] = tDelta[i] = 1e30f;
+		}
+	}
+	float cellArea = surfaceArea(cellDim);
+	float survival = 1.0f, cost = 0.0f;
+	bool isFirst = true;
+	while(survival > 1e-3f){
+		size_t index = cell[0] + (size_t)res[0] * (cell[1] + (size_t)res[1] * cell[2]);
+		cost += survival * GRID_COST_STEP;
+		if(counts[index] > 0.0f){
+			cost += survival * (GRID_COST_CELL + GRID_COST_TEST * counts[index]);
+			if(!(isFirst && isOnPrimitive)) survival *= exp(-areas[index] / cellArea);
+		}
+		isFirst = false;
+		uint axis = (tMax[0] < tMax[1])? ((tMax[0] < tMax[2])? 0: 2): ((tMax[1] < tMax[2])? 1: 2);
+		cell[axis] += step[axis];
+		if(cell[axis] == out[axis]) break;
+		tMax[axis] += tDelta[axis];
+	}
+	return cost;
+}
+
+//Picks the density and resolution cap by the expected cost of a fixed set of sampled rays, walked through the
+//occupancy each candidate grid would have. Half the rays are random lines through the scene like camera rays, half start
+//on random primitives in random directions like shadow and reflected rays. No candidate grid is built.
+void Grid::tune(Scene *scene, uint nPrimitives){
+	static const float densities[] = {0.5f, 1.0f, 2.0f, 3.0f, 5.0f, 8.0f, 12.0f, 20.0f, 32.0f};
+	static const uint maxResolutions[] = {128, 256, 512};
+	mDensity = GRID_DENSITY;
+	mMaxResolution = GRID_MAX_RESOLUTION;
+	std::vector<AABB> boxes;
+	uint stride = std::max(1u, nPrimitives / GRID_TUNE_SAMPLES);
+	uint primitiveID = 0;
+	for(uint i = 0; i < scene->nObjects(); i++){
+		Object *object = scene->object(i);
+		if(object->mType == POLYHEDRON){
+			Polyhedron *polyhedron = (Polyhedron*)object;
+			for(uint j = 0; j < polyhedron->nTriangles(); j++, primitiveID++){
+				if(primitiveID % stride == 0) boxes.push_back(polyhedron->triangle(j)->mAABB);
+			}
+		}
+		else if(primitiveID++ % stride == 0) boxes.push_back(object->mAABB);
+	}
+	if(boxes.empty()) return;
+	
+	//The same rays for every candidate, from a fixed seed so that the choice is reproducible
+	glm::vec3 gridSize = mAABB.bounds[1] - mAABB.bounds[0];
+	boost::random::mt19937 generator(12345);
+	boost::random::uniform_01<boost::mt19937, float> uniform(generator);
+	std::vector<Ray> rays(GRID_TUNE_RAYS);
+	for(uint i = 0; i < GRID_TUNE_RAYS; i++){
+		float z = 2.0f * uniform() - 1.0f;
+		float phi = 2.0f * M_PI * uniform();
+		float r = sqrt(maxf(0.0f, 1.0f - z * z));
+		rays[i].dir = glm::vec3(r * cos(phi), r * sin(phi), z);
+		if(i % 2 == 0){
+			//From outside the bounds through a random point inside
+			glm::vec3 target = mAABB.bounds[0] + gridSize * glm::vec3(uniform(), uniform(), uniform());
+			rays[i].r0 = target - 2.0f * glm::length(gridSize) * rays[i].dir;
+		}
+		else{
+			AABB const& box = boxes[(uint)(uniform() * boxes.size()) % boxes.size()];
+			rays[i].r0 = 0.5f * (box.bounds[0] + box.bounds[1]);
+		}
+	}
+	
+	//Expected cost of each candidate, by its number of cells
+	std::vector<std::pair<size_t, float> > costs;
+	std::vector<std::pair<float, uint> > parameters;
+	std::vector<float> counts, areas;
+	for(uint r = 0; r < sizeof(maxResolutions) / sizeof(maxResolutions[0]); r++){
+		for(uint d = 0; d < sizeof(densities) / sizeof(densities[0]); d++){
+			resolutionFor(gridSize, nPrimitives, densities[d], maxResolutions[r], mRes);
+			size_t nCells = (size_t)mRes[0] * mRes[1] * mRes[2];
+			if(nCells > GRID_TUNE_MAX_CELLS) continue;
+			//A larger cap only changes grids that hit the smaller one, and densities under a cap that binds repeat the grid
+			if(r > 0 && std::max(mRes[0], std::max(mRes[1], mRes[2])) <= maxResolutions[r - 1]) continue;
+			if(!costs.empty() && costs.back().first == nCells) continue;
+			mCellDim = gridSize / glm::vec3(mRes[0], mRes[1], mRes[2]);
+			counts.assign(nCells, 0.0f);
+			areas.assign(nCells, 0.0f);
+			for(uint i = 0; i < boxes.size(); i++){
+				CellRange range = cellRange(boxes[i]);
+				uint nSpanned = (range.max.x - range.min.x + 1) * (range.max.y - range.min.y + 1) * (range.max.z - range.min.z + 1);
+				float area = surfaceArea(boxes[i].bounds[1] - boxes[i].bounds[0]) / nSpanned;
+				for(uint z = range.min.z; z <= range.max.z; z++){
+					for(uint y = range.min.y; y <= range.max.y; y++){
+						for(uint x = range.min.x; x <= range.max.x; x++){
+							size_t index = x + y * mRes[0] + (size_t)z * mRes[0] * mRes[1];
+							counts[index] += stride;
+							areas[index] += stride * area;
+						}
+					}
+				}
+			}
+			float cost = 0.0f;
+			for(uint i = 0; i < GRID_TUNE_RAYS; i++) cost += walkCost(rays[i], i % 2 == 1, mAABB, mRes, mCellDim, &counts[0], &areas[0]);
+			costs.push_back(std::make_pair(nCells, cost / GRID_TUNE_RAYS));
+			parameters.push_back(std::make_pair(densities[d], maxResolutions[r]));
+		}
+	}
+	mRes[0] = mRes[1] = mRes[2] = 0;
+	if(costs.empty()) return;
+	
+	//Larger grids take more memory and time to build, the smallest one close to the cheapest is taken
+	float minCost = costs[0].second;
+	for(uint i = 1; i < costs.size(); i++) minCost = minf(minCost, costs[i].second);
+	uint best = 0;
+	for(uint i = 0; i < costs.size(); i++){
+		if(costs[i].second > (1.0f + GRID_TUNE_TOLERANCE) * minCost) continue;
+		if(costs[best].second > (1.0f + GRID_TUNE_TOLERANCE) * minCost || costs[i].first < costs[best].first) best = i;
+	}
+	mDensity = parameters[best].first;
+	mMaxResolution = parameters[best].second;
+	uint res[3];
+	resolutionFor(gridSize, nPrimitives, mDensity, mMaxResolution, res);
+	std::cout << "Grid tuned to " << mDensity << " primitives per cell, at most " << mMaxResolution << " cells per axis (";
+	std::cout << res[0] << " x " << res[1] << " x " << res[2] << ", expected cost " << costs[best].second << " against ";
+	std::cout << minCost << "). Pin it with -grid " << mDensity << " " << mMaxResolution << "." << std::endl;
+}
+
+void Grid::construct(Scene *scene, bool isRefittable){
+	PhaseTimer timer(PHASE_GRID);
+	clear();
 	uint nObjects = scene->nObjects();
 	uint nPrimitives = 0;
 	glm::vec3 min(10000.0f);
@@ -41,10 +282,10 @@ void Grid::construct(Scene *scene){
 			nPrimitives += nTriangles;
 		}
 		else{
-			Sphere* sphere = (Sphere*)scene->object(i);
+			Object* object = scene->object(i);
 			for(uint j = 0; j < 3; j++){
-				if(sphere->mAABB.bounds[0][j] < min[j]) min[j] = sphere->mAABB.bounds[0][j];
-				if(sphere->mAABB.bounds[1][j] > max[j]) max[j] = sphere->mAABB.bounds[1][j];
+				if(object->mAABB.bounds[0][j] < min[j]) min[j] = object->mAABB.bounds[0][j];
+				if(object->mAABB.bounds[1][j] > max[j]) max[j] = object->mAABB.bounds[1][j];
 			}
 			nPrimitives++;
 		}
@@ -55,187 +296,136 @@ void Grid::construct(Scene *scene){
 	mAABB.setExtends(min, max);
 	
 	//Calculate grid properties
+	if(mDensity <= 0.0f) tune(scene, nPrimitives);
 	glm::vec3 gridSize = max - min;
-	float cubeRoot = pow((5.0f * nPrimitives) / (gridSize[0] * gridSize[1] * gridSize[2]), 0.333);
-	for(uint i = 0; i < 3; i++){
-		float temp = gridSize[i] * cubeRoot;
-		temp = maxf(1.0f, minf(temp, 128.0f)); //Minimum of 1 cell and maximum of 128 cells in each dimension
-		mRes[i] = (uint)temp;
-	}
+	resolutionFor(gridSize, nPrimitives, mDensity, mMaxResolution, mRes);
 	mCellDim = gridSize / glm::vec3(mRes[0], mRes[1], mRes[2]);
 	
 	//Alocate memory
 	mCells = new Cell* [mRes[0] * mRes[1] * mRes[2]] (); //Notice the parentheses. This initializes the pointers to NULL
+	adviseHugePages(mCells, (size_t)mRes[0] * mRes[1] * mRes[2] * sizeof(Cell*));
+	if(isRefittable) mRanges.resize(nObjects);
 	//Insert Objects in grid
 	for(uint  i = 0; i < nObjects; i++){
 		if(scene->object(i)->mType == POLYHEDRON){
 			Polyhedron* polyhedron = (Polyhedron*)scene->object(i);
 			uint nTriangles = polyhedron->nTriangles();
+			if(isRefittable) mRanges[i].resize(nTriangles);
 			for(uint j = 0; j < nTriangles; j++){
 				Triangle *triangle = polyhedron->triangle(j);
-				glm::vec3 minTri = triangle->mAABB.bounds[0];
-				glm::vec3 maxTri = triangle->mAABB.bounds[1];
-				//convert AABB to cell coordinates
-				minTri = (minTri - mAABB.bounds[0]) / mCellDim;
-				maxTri = (maxTri - mAABB.bounds[0]) / mCellDim;
-				for(uint z = uint(minTri.z); z <= uint(maxTri.z); z++){
-					for(uint y = uint(minTri.y); y <= uint(maxTri.y); y++){
-						for(uint x = uint(minTri.x); x <= uint(maxTri.x); x++){
-							uint index = x + y * mRes[0] + z * mRes[0] * mRes[1];
-							if(mCells[index] == NULL) mCells[index] = new Cell;
-							mCells[index]->insert(triangle, i);
-						}
-					}
-				}
+				CellRange range = cellRange(triangle->mAABB);
+				insert(range, triangle, i);
+				if(isRefittable) mRanges[i][j] = range;
 			}
 		}
 		else{
-			Sphere* sphere = (Sphere*)scene->object(i);
-			glm::vec3 minSph = sphere->mAABB.bounds[0];
-			glm::vec3 maxSph = sphere->mAABB.bounds[1];
-			//convert AABB to cell coordinates
-			minSph = (minSph - mAABB.bounds[0]) / mCellDim;
-			maxSph = (maxSph - mAABB.bounds[0]) / mCellDim;
-			for(uint z = uint(minSph.z); z <= uint(maxSph.z); z++){
-				for(uint y = uint(minSph.y); y <= uint(maxSph.y); y++){
-					for(uint x = uint(minSph.x); x <= uint(maxSph.x); x++){
-						uint index = x + y * mRes[0] + z * mRes[0] * mRes[1];
-						if(mCells[index] == NULL) mCells[index] = new Cell;
-						mCells[index]->insert(sphere, i);
-					}
-				}
-			}
+			Object* object = scene->object(i);
+			CellRange range = cellRange(object->mAABB);
+			insert(range, object, i);
+			if(isRefittable) mRanges[i].push_back(range);
 		}
 	}
 	
 }
 
-static inline int clampi(int input, int min, int max){
-	return maxi(min, mini(input, max));
+size_t Grid::memoryUsage(void)const{
+	uint nCells = mRes[0] * mRes[1] * mRes[2];
+	size_t bytes = nCells * sizeof(Cell*);
+	for(uint i = 0; i < nCells; i++){
+		if(mCells[i] != NULL) bytes += sizeof(Cell) + mCells[i]->list.capacity() * sizeof(Cell::Item);
+	}
+	for(uint i = 0; i < mRanges.size(); i++) bytes += mRanges[i].capacity() * sizeof(CellRange);
+	return bytes;
 }
 
-bool Grid::intersect(Ray ray, float &t, uint &objectID, glm::vec3 &normal)const{
-	glm::vec3 invDir = 1.0f / ray.dir;
-	glm::vec3 deltaT, nextCrossingT;
-	glm::ivec3 exitCell, step;
-	
-	float tmin = 10000.0f;
-	Ray r(ray);
-	if(!mAABB.intersect(r, tmin)) return false;
-	if(tmin > 0.0f) r.r0 = r.r0 + r.dir * tmin; //If origin outside box, set origin to hit point
-	else tmin = 0.0f;
-	//Convert ray origin to cell coordinates
-	glm::vec3 rayOrigCell = r.r0 - mAABB.bounds[0];
-	glm::ivec3 cell = glm::ivec3(rayOrigCell / mCellDim);
-	for(uint i = 0; i < 3; i++){
-		cell[i] = clampi(cell[i], 0, mRes[i] - 1);
-		if(r.dir[i] < 0.0f){
-			deltaT[i] = -mCellDim[i] * invDir[i];
-			nextCrossingT[i] = tmin + (cell[i] * mCellDim[i] - rayOrigCell[i]) * invDir[i];
-			exitCell[i] = -1;
-			step[i] = -1;
-		}
-		else{
-			deltaT[i] = mCellDim[i] * invDir[i];
-			nextCrossingT[i] = tmin + ((cell[i] + 1) * mCellDim[i] - rayOrigCell[i]) * invDir[i];
-			exitCell[i] = mRes[i];
-			step[i] = 1;
+void Grid::exportCells(Scene *scene, std::vector<uint> &cellStarts, std::vector<GridItem> &items)const{
+	uint nCells = mRes[0] * mRes[1] * mRes[2];
+	cellStarts.resize(nCells + 1);
+	items.clear();
+	for(uint i = 0; i < nCells; i++){
+		cellStarts[i] = items.size();
+		if(mCells[i] == NULL) continue;
+		std::vector<Cell::Item> const& list = mCells[i]->list;
+		for(uint j = 0; j < list.size(); j++){
+			GridItem item;
+			item.object = list[j].meshID;
+			item.primitive = (uint)-1;
+			Object *object = scene->object(item.object);
+			if(object->mType == POLYHEDRON) item.primitive = (Triangle*)list[j].object - ((Polyhedron*)object)->triangle(0);
+			items.push_back(item);
 		}
 	}
-	
-	//Traverse the cells using 3d-DDA
-	float retValue = false;
-	while(1){
-		uint index = cell[0] + cell[1] * mRes[0] + cell[2] * mRes[0] * mRes[1];
-		if(mCells[index] != NULL){
-			if(mCells[index]->intersect(ray, t, objectID, normal)) retValue = true;
-		}
-		uchar k = 
-			((nextCrossingT[0] < nextCrossingT[1]) << 2) +
-			((nextCrossingT[0] < nextCrossingT[2]) << 1) +
-			((nextCrossingT[1] < nextCrossingT[2]));
-		static const uchar map[8] = {2, 1, 2, 1, 2, 2, 0, 0};
-		uchar axis = map[k];
-		if(t < nextCrossingT[axis]) break;
-		cell[axis] += step[axis];
-		if(cell[axis] == exitCell[axis]) break;
-		nextCrossingT[axis] += deltaT[axis];
-	}
-	return retValue;
+	cellStarts[nCells] = items.size();
 }
 
-bool Grid::Cell::intersect(Ray ray, float &t, uint &objectID, glm::vec3 &normal){
-	std::vector<Item>::iterator itr;
-	bool retValue = false;
-	// Loop over all primitives in the cell
-	for(itr = list.begin(); itr < list.end(); itr++){
-		// if(itr->rayID == ray.ID) continue;
-		if(itr->object->intersect(ray, t)){
-			retValue = true;
-			objectID = itr->meshID;
-			normal = itr->object->normal();
-			
-			// itr->rayID = ray.ID;
+void Grid::load(Scene *scene, glm::uvec3 resolution, AABB const& aabb, uint const* cellStarts, GridItem const* items){
+	PhaseTimer timer(PHASE_GRID);
+	clear();
+	mAABB = aabb;
+	for(uint i = 0; i < 3; i++) mRes[i] = resolution[i];
+	mCellDim = (aabb.bounds[1] - aabb.bounds[0]) / glm::vec3(mRes[0], mRes[1], mRes[2]);
+	uint nCells = mRes[0] * mRes[1] * mRes[2];
+	mCells = new Cell* [nCells] ();
+	adviseHugePages(mCells, (size_t)nCells * sizeof(Cell*));
+	for(uint i = 0; i < nCells; i++){
+		if(cellStarts[i] == cellStarts[i + 1]) continue;
+		mCells[i] = new Cell;
+		mCells[i]->list.reserve(cellStarts[i + 1] - cellStarts[i]);
+		for(uint j = cellStarts[i]; j < cellStarts[i + 1]; j++){
+			Object *object = scene->object(items[j].object);
+			if(items[j].primitive != (uint)-1) object = ((Polyhedron*)object)->triangle(items[j].primitive);
+			mCells[i]->insert(object, items[j].object);
 		}
 	}
-	return retValue;
 }
 
-
-bool Grid::shadowIntersect(Ray ray, float &t)const{
-	glm::vec3 invDir = 1.0f / ray.dir;
-	glm::vec3 deltaT, nextCrossingT;
-	glm::ivec3 exitCell, step;
-	
-	float tmin = 10000.0f;
-	Ray r(ray);
-	if(!mAABB.intersect(r, tmin)) return false;
-	if(tmin > 0.0f) r.r0 = r.r0 + r.dir * tmin; //If origin outside box, set origin to hit point
-	else tmin = 0.0f;
-	//Convert ray origin to cell coordinates
-	glm::vec3 rayOrigCell = r.r0 - mAABB.bounds[0];
-	glm::ivec3 cell = glm::ivec3(rayOrigCell / mCellDim);
+//Moves the primitives of a transformed object to the cells they now overlap. Primitives that still overlap
+//the same cells are left alone, and of the others only the cells that changed are touched. If the object left
+//the grid's bounds nothing is done and false is returned; the grid then has to be constructed again.
+bool Grid::update(Scene *scene, uint objectID){
+	if(mRanges.empty()) return false;
+	Object *object = scene->object(objectID);
 	for(uint i = 0; i < 3; i++){
-		cell[i] = clampi(cell[i], 0, mRes[i] - 1);
-		if(r.dir[i] < 0.0f){
-			deltaT[i] = -mCellDim[i] * invDir[i];
-			nextCrossingT[i] = tmin + (cell[i] * mCellDim[i] - rayOrigCell[i]) * invDir[i];
-			exitCell[i] = -1;
-			step[i] = -1;
-		}
-		else{
-			deltaT[i] = mCellDim[i] * invDir[i];
-			nextCrossingT[i] = tmin + ((cell[i] + 1) * mCellDim[i] - rayOrigCell[i]) * invDir[i];
-			exitCell[i] = mRes[i];
-			step[i] = 1;
+		if(object->mAABB.bounds[0][i] <= mAABB.bounds[0][i] || object->mAABB.bounds[1][i] >= mAABB.bounds[1][i]) return false;
+	}
+	std::vector<CellRange> &ranges = mRanges[objectID];
+	if(object->mType == POLYHEDRON){
+		Polyhedron* polyhedron = (Polyhedron*)object;
+		uint nTriangles = polyhedron->nTriangles();
+		for(uint j = 0; j < nTriangles; j++){
+			Triangle *triangle = polyhedron->triangle(j);
+			CellRange range = cellRange(triangle->mAABB);
+			if(range == ranges[j]) continue;
+			remove(ranges[j], triangle, range);
+			insert(range, triangle, objectID, &ranges[j]);
+			ranges[j] = range;
 		}
 	}
-	
-	//Traverse the cells using 3d-DDA
-	while(1){
-		uint index = cell[0] + cell[1] * mRes[0] + cell[2] * mRes[0] * mRes[1];
-		if(mCells[index] != NULL){
-			if(mCells[index]->shadowIntersect(ray, t)) return true;
-		}
-		uchar k = 
-			((nextCrossingT[0] < nextCrossingT[1]) << 2) +
-			((nextCrossingT[0] < nextCrossingT[2]) << 1) +
-			((nextCrossingT[1] < nextCrossingT[2]));
-		static const uchar map[8] = {2, 1, 2, 1, 2, 2, 0, 0};
-		uchar axis = map[k];
-		cell[axis] += step[axis];
-		if(cell[axis] == exitCell[axis]) return false;;
-		nextCrossingT[axis] += deltaT[axis];
+	else{
+		CellRange range = cellRange(object->mAABB);
+		if(!(range == ranges[0])){
+			remove(ranges[0], object, range);
+			insert(range, object, objectID, &ranges[0]);
+			ranges[0] = range;
+		}
 	}
+	return true;
 }
 
-bool Grid::Cell::shadowIntersect(Ray ray, float &t){
-	std::vector<Item>::iterator itr;
-	// Loop over all primitives in the cell
-	for(itr = list.begin(); itr < list.end(); itr++){
-		if(itr->object->intersect(ray, t)){
-			return true;
-		}
-	}
-	return false;
-}
\ No newline at end of file
+static inline int clampi(int input, int min, int max){
+	return maxi(min, mini(input, max));
+}
+
+uint Grid::cellIndex(glm::vec3 point)const{
+	glm::ivec3 cell = glm::ivec3((point - mAABB.bounds[0]) / mCellDim);
+	for(uint i = 0; i < 3; i++) cell[i] = clampi(cell[i], 0, mRes[i] - 1);
+	return cell[0] + cell[1] * mRes[0] + cell[2] * mRes[0] * mRes[1];
+}
+
+bool Grid::intersect(Ray ray, float &t, uint &objectID, glm::vec3 &normal)const{
+	ISA_DISPATCH(intersectISA, (ray, t, objectID, normal))
+}
+
+bool Grid::shadowIntersect(Ray ray, float &t)const{
+	ISA_DISPATCH(shadowIntersectISA, (ray, t))
+}
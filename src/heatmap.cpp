@@ -0,0 +1,84 @@
+#include "../include/heatmap.h"
+#include <algorithm>
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define HEATMAP_PERCENTILE 0.99 //Mean cost shown in white
+
+static inline unsigned long long readCycles(void){
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	//Nanoseconds where there is no time stamp counter
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+//Counters that make up each cost after the cycles
+static const eCounter costCounters[N_COSTS - 1] = {COUNTER_CELLS_VISITED, COUNTER_PRIMITIVE_TESTS, COUNTER_PHOTONS_EXAMINED};
+
+void CostBuffer::resize(uint width, uint height){
+	mWidth = width;
+	mHeight = height;
+	clear();
+}
+
+void CostBuffer::clear(void){
+	size_t nPixels = (size_t)mWidth * mHeight;
+	mCosts.assign(N_COSTS * nPixels, 0);
+	mSamples.assign(nPixels, 0);
+}
+
+void CostBuffer::mark(Mark &start){
+	ThreadCounters const& counters = threadCounters();
+	for(uint i = 0; i < N_COUNTERS; i++) start.counts[i] = counters.counts[i];
+	start.cycles = readCycles();
+}
+
+void CostBuffer::add(uint x, uint y, Mark const& start){
+	unsigned long long cycles = readCycles() - start.cycles;
+	ThreadCounters const& counters = threadCounters();
+	size_t index = x + (size_t)mWidth * y;
+	unsigned long long *costs = &mCosts[N_COSTS * index];
+	costs[COST_CYCLES] += cycles;
+	for(uint i = 1; i < N_COSTS; i++) costs[i] += counters.counts[costCounters[i - 1]] - start.counts[costCounters[i - 1]];
+	mSamples[index]++;
+}
+
+char const* CostBuffer::name(eCost cost){
+	static char const* names[N_COSTS] = {"cycles", "cells", "tests", "photons"};
+	return names[cost];
+}
+
+//Black through purple, red and orange to pale yellow, darker is cheaper
+static void ramp(float v, uchar *rgb){
+	static const float stops[5][3] = {{0.0f, 0.0f, 0.02f}, {0.34f, 0.06f, 0.43f}, {0.73f, 0.21f, 0.33f}, {0.98f, 0.55f, 0.04f}, {0.99f, 1.0f, 0.64f}};
+	v = std::min(std::max(v, 0.0f), 1.0f) * 4.0f;
+	uint i = std::min((uint)v, 3u);
+	float f = v - i;
+	for(uint c = 0; c < 3; c++) rgb[c] = (uchar)(255.0f * ((1.0f - f) * stops[i][c] + f * stops[i + 1][c]) + 0.5f);
+}
+
+double CostBuffer::colorize(eCost cost, std::vector<uchar> &image)const{
+	size_t nPixels = (size_t)mWidth * mHeight;
+	std::vector<double> means(nPixels, 0.0);
+	std::vector<double> sorted;
+	sorted.reserve(nPixels);
+	for(size_t i = 0; i < nPixels; i++){
+		if(mSamples[i] == 0) continue;
+		means[i] = (double)mCosts[N_COSTS * i + cost] / mSamples[i];
+		sorted.push_back(means[i]);
+	}
+	double scale = 0.0;
+	if(!sorted.empty()){
+		std::vector<double>::iterator nth = sorted.begin() + (size_t)(HEATMAP_PERCENTILE * (sorted.size() - 1));
+		std::nth_element(sorted.begin(), nth, sorted.end());
+		scale = *nth;
+		if(scale <= 0.0) scale = *std::max_element(sorted.begin(), sorted.end());
+	}
+	image.resize(3 * nPixels);
+	for(size_t i = 0; i < nPixels; i++) ramp((scale > 0.0)? (float)(means[i] / scale): 0.0f, &image[3 * i]);
+	return scale;
+}
@@ -0,0 +1,51 @@
+#include "../include/isa.h"
+#include "../include/grid.h"
+#include "../include/photonmap.h"
+#include "../include/raytracer.h"
+#include "../include/spheresystem.h"
+#include "../include/stats.h"
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <iostream>
+
+static const char *isaNames[N_ISAS] = {"generic", "avx2", "avx512"};
+
+char const* isaName(eISA isa){
+	return isaNames[isa];
+}
+
+eISA bestISA(void){
+#ifdef RT_ISA_DISPATCH
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512dq")) return ISA_AVX512;
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return ISA_AVX2;
+#endif
+	return ISA_GENERIC;
+}
+
+//The best level, or the one RT_ISA asks for if the CPU supports it
+static eISA selectISA(void){
+	eISA best = bestISA();
+	char const* requested = getenv("RT_ISA");
+	if(requested == NULL || *requested == '\0') return best;
+	for(uint i = 0; i < N_ISAS; i++){
+		if(std::string(requested) != isaNames[i]) continue;
+		if(i > (uint)best){
+			std::cout << "RT_ISA=" << requested << " is not supported by this CPU, using " << isaNames[best] << "." << std::endl;
+			return best;
+		}
+		return eISA(i);
+	}
+	std::cout << "Unknown RT_ISA=" << requested << ", using " << isaNames[best] << ". Valid levels are generic, avx2 and avx512." << std::endl;
+	return best;
+}
+
+eISA kernelISA(void){
+	static const eISA isa = selectISA();
+	return isa;
+}
+
+//The generic variants, built with the flags of the makefile
+#define KERNEL_ISA ISA_GENERIC
+#include "kernels.inl"
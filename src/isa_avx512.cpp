@@ -0,0 +1,13 @@
+#include "../include/isa.h"
+#include "../include/grid.h"
+#include "../include/photonmap.h"
+#include "../include/raytracer.h"
+#include "../include/spheresystem.h"
+#include "../include/stats.h"
+#include <cmath>
+
+#ifdef RT_ISA_DISPATCH
+#pragma GCC target("avx512f,avx512vl,avx512bw,avx512dq,avx2,fma")
+#define KERNEL_ISA ISA_AVX512
+#include "kernels.inl"
+#endif
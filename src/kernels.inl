@@ -0,0 +1,396 @@
+//Hot kernels, included once per instruction set level by isa.cpp, isa_avx2.cpp and isa_avx512.cpp.
+//The including file defines KERNEL_ISA and sets the target before the include, all headers must be included
+//before that, so that only the functions below are compiled for the level. The helpers are static,
+//every level gets its own copy.
+
+static inline float kernelMaxf(float a, float b){
+	if(a > b) return a;
+	else return b;
+}
+
+static inline float kernelMinf(float a, float b){
+	float retVal = a;
+	if(retVal > b) retVal = b;
+	return retVal;
+}
+
+static inline int kernelClampi(int input, int min, int max){
+	if(input > max) input = max;
+	if(input < min) input = min;
+	return input;
+}
+
+//Same as AABB::intersect
+static inline bool kernelSlab(AABB const& aabb, Ray const& ray, float &t){
+	glm::vec3 invDir = 1.0f / ray.dir;
+	float t1 = (aabb.bounds[0].x - ray.r0.x) * invDir.x;
+	float t2 = (aabb.bounds[1].x - ray.r0.x) * invDir.x;
+	float t3 = (aabb.bounds[0].y - ray.r0.y) * invDir.y;
+	float t4 = (aabb.bounds[1].y - ray.r0.y) * invDir.y;
+	float t5 = (aabb.bounds[0].z - ray.r0.z) * invDir.z;
+	float t6 = (aabb.bounds[1].z - ray.r0.z) * invDir.z;
+
+	float tmin = kernelMaxf(kernelMaxf(kernelMinf(t1, t2), kernelMinf(t3, t4)), kernelMinf(t5, t6));
+	float tmax = kernelMinf(kernelMinf(kernelMaxf(t1, t2), kernelMaxf(t3, t4)), kernelMaxf(t5, t6));
+
+	if(tmax < 0.0f || tmin > tmax){
+		t = tmax;
+		return false;
+	}
+	t = tmin;
+	return true;
+}
+
+//Same as Triangle::intersect, inlined into the cell loops instead of a virtual call
+static inline bool kernelTriangle(Triangle const& triangle, Ray const& ray, float &t){
+	glm::vec3 const& v0 = triangle.vertex(0);
+	glm::vec3 AC = triangle.vertex(2) - v0;
+	glm::vec3 AB = triangle.vertex(1) - v0;
+	glm::vec3 P = glm::cross(ray.dir, AC);
+	float det = glm::dot(AB, P);
+	if(det < 0.0f) return false;
+	float invDet = 1.0f / det;
+	glm::vec3 T = ray.r0 - v0;
+	glm::vec3 Q = glm::cross(T, AB);
+	float t1 = glm::dot(AC, Q) * invDet;
+	if(t1 > t || t1 < 0.0f) return false;
+	float u = glm::dot(T, P) * invDet;
+	if(u < 0.0f || u > 1.0f) return false;
+	float v = glm::dot(ray.dir, Q) * invDet;
+	if(v < 0.0f || u + v > 1.0f) return false;
+	t = t1;
+	return true;
+}
+
+namespace{
+//3d-DDA walk of a ray through the cells of a uniform grid
+struct KernelDDA{
+	//False if the ray misses the grid
+	bool setup(AABB const& aabb, glm::vec3 const& cellDim, uint const* res, Ray const& ray){
+		glm::vec3 invDir = 1.0f / ray.dir;
+		float tmin = 10000.0f;
+		Ray r(ray);
+		if(!kernelSlab(aabb, r, tmin)) return false;
+		if(tmin > 0.0f) r.r0 = r.r0 + r.dir * tmin; //If origin outside box, set origin to hit point
+		else tmin = 0.0f;
+		//Convert ray origin to cell coordinates
+		glm::vec3 rayOrigCell = r.r0 - aabb.bounds[0];
+		cell = glm::ivec3(rayOrigCell / cellDim);
+		for(uint i = 0; i < 3; i++){
+			cell[i] = kernelClampi(cell[i], 0, res[i] - 1);
+			if(r.dir[i] < 0.0f){
+				deltaT[i] = -cellDim[i] * invDir[i];
+				nextCrossingT[i] = tmin + (cell[i] * cellDim[i] - rayOrigCell[i]) * invDir[i];
+				exitCell[i] = -1;
+				stepDir[i] = -1;
+			}
+			else{
+				deltaT[i] = cellDim[i] * invDir[i];
+				nextCrossingT[i] = tmin + ((cell[i] + 1) * cellDim[i] - rayOrigCell[i]) * invDir[i];
+				exitCell[i] = res[i];
+				stepDir[i] = 1;
+			}
+		}
+		return true;
+	};
+	//The axis whose cell boundary the ray crosses next
+	uint axis(void)const{
+		uchar k =
+			((nextCrossingT[0] < nextCrossingT[1]) << 2) +
+			((nextCrossingT[0] < nextCrossingT[2]) << 1) +
+			((nextCrossingT[1] < nextCrossingT[2]));
+		static const uchar map[8] = {2, 1, 2, 1, 2, 2, 0, 0};
+		return map[k];
+	};
+	//Moves to the next cell along axis, false if the ray leaves the grid
+	bool step(uint axis){
+		cell[axis] += stepDir[axis];
+		if(cell[axis] == exitCell[axis]) return false;
+		nextCrossingT[axis] += deltaT[axis];
+		return true;
+	};
+	glm::vec3 deltaT, nextCrossingT;
+	glm::ivec3 cell, exitCell, stepDir;
+};
+}
+
+//Same as Polyhedron::intersect, with the triangle test inlined
+static inline bool kernelPolyhedron(Polyhedron &polyhedron, Ray const& ray, float &t, glm::vec3 *normal){
+	uint nTriangles = polyhedron.nTriangles();
+	for(uint i = 0; i < nTriangles; i++){
+		Triangle const& triangle = *polyhedron.triangle(i);
+		if(glm::dot(ray.dir, triangle.normal()) < 0.0f && kernelTriangle(triangle, ray, t)){
+			if(normal) *normal = triangle.normal();
+			return true;
+		}
+	}
+	return false;
+}
+
+//Direct calls for the types that are not inlined
+template<class T>
+static inline bool kernelDirect(Object *object, Ray const& ray, float &t, glm::vec3 *normal){
+	return static_cast<T*>(object)->T::intersect(ray, t, normal);
+}
+
+//Switches on the primitive type instead of calling through the vtable, the normal of a hit is written if it is wanted
+static inline bool kernelObject(Object *object, Ray const& ray, float &t, glm::vec3 *normal){
+	switch(object->mType){
+	case TRIANGLE:
+		if(!kernelTriangle(*static_cast<Triangle*>(object), ray, t)) return false;
+		if(normal) *normal = static_cast<Triangle*>(object)->normal();
+		return true;
+	case POLYHEDRON: return kernelPolyhedron(*static_cast<Polyhedron*>(object), ray, t, normal);
+	case SPHERE: return kernelDirect<Sphere>(object, ray, t, normal);
+	case PLANE: return kernelDirect<Plane>(object, ray, t, normal);
+	case SPHEROCYLINDER: return kernelDirect<Spherocylinder>(object, ray, t, normal);
+	case SUPERELLIPSOID: return kernelDirect<Superellipsoid>(object, ray, t, normal);
+	}
+	return false;
+}
+
+template<>
+bool Grid::Cell::intersect<KERNEL_ISA>(Ray const& ray, float &t, uint &objectID, glm::vec3 &normal)const{
+	bool retValue = false;
+	// Loop over all primitives in the cell
+	for(std::vector<Item>::const_iterator itr = list.begin(); itr < list.end(); itr++){
+		if(kernelObject(itr->object, ray, t, &normal)){
+			retValue = true;
+			objectID = itr->meshID;
+		}
+	}
+	return retValue;
+}
+
+template<>
+bool Grid::Cell::shadowIntersect<KERNEL_ISA>(Ray const& ray, float &t, uint &nTests)const{
+	// Loop over all primitives in the cell
+	for(std::vector<Item>::const_iterator itr = list.begin(); itr < list.end(); itr++){
+		nTests++;
+		if(kernelObject(itr->object, ray, t, NULL)) return true;
+	}
+	return false;
+}
+
+template<>
+bool Grid::intersectISA<KERNEL_ISA>(Ray const& ray, float &t, uint &objectID, glm::vec3 &normal)const{
+	KernelDDA dda;
+	if(!dda.setup(mAABB, mCellDim, mRes, ray)) return false;
+
+	//Traverse the cells using 3d-DDA
+	bool retValue = false;
+	uint nCellsVisited = 0, nTests = 0;
+	while(1){
+		uint index = dda.cell[0] + dda.cell[1] * mRes[0] + dda.cell[2] * mRes[0] * mRes[1];
+		nCellsVisited++;
+		if(mCells[index] != NULL){
+			nTests += mCells[index]->list.size();
+			if(mCells[index]->intersect<KERNEL_ISA>(ray, t, objectID, normal)) retValue = true;
+		}
+		uint axis = dda.axis();
+		if(t < dda.nextCrossingT[axis] || !dda.step(axis)) break;
+	}
+	statsCount(COUNTER_CELLS_VISITED, nCellsVisited);
+	statsCount(COUNTER_PRIMITIVE_TESTS, nTests);
+	return retValue;
+}
+
+template<>
+bool Grid::shadowIntersectISA<KERNEL_ISA>(Ray const& ray, float &t)const{
+	KernelDDA dda;
+	if(!dda.setup(mAABB, mCellDim, mRes, ray)) return false;
+
+	//Traverse the cells using 3d-DDA
+	bool isHit = false;
+	uint nCellsVisited = 0, nTests = 0;
+	while(1){
+		uint index = dda.cell[0] + dda.cell[1] * mRes[0] + dda.cell[2] * mRes[0] * mRes[1];
+		nCellsVisited++;
+		if(mCells[index] != NULL){
+			if(mCells[index]->shadowIntersect<KERNEL_ISA>(ray, t, nTests)){
+				isHit = true;
+				break;
+			}
+		}
+		//Cells beyond t can not block, which ends short rays early
+		uint axis = dda.axis();
+		if(t < dda.nextCrossingT[axis] || !dda.step(axis)) break;
+	}
+	statsCount(COUNTER_CELLS_VISITED, nCellsVisited);
+	statsCount(COUNTER_PRIMITIVE_TESTS, nTests);
+	return isHit;
+}
+
+//Tests the spheres of a cell in fixed groups of 8, so that the tests vectorize, and keeps the nearest hit
+//beyond 0.0001 that is closer than t, as Sphere::intersect does. Lanes past the end repeat the last sphere.
+static inline bool kernelSpheres(uint const* items, uint nItems, float const* x, float const* y, float const* z, float const* radius, Ray const& ray, float &t, uint &sphereID){
+	static const uint groupSize = 8;
+	bool isHit = false;
+	for(uint begin = 0; begin < nItems; begin += groupSize){
+		uint last = nItems - begin - 1;
+		float tHit[groupSize];
+		for(uint k = 0; k < groupSize; k++){
+			uint s = items[begin + ((k < last)? k: last)];
+			float dx = x[s] - ray.r0.x;
+			float dy = y[s] - ray.r0.y;
+			float dz = z[s] - ray.r0.z;
+			float B = ray.dir.x * dx + ray.dir.y * dy + ray.dir.z * dz;
+			float det = B * B - (dx * dx + dy * dy + dz * dz) + radius[s] * radius[s];
+			float root = sqrtf(kernelMaxf(det, 0.0f));
+			float tNear = B - root;
+			float tFar = B + root;
+			float tSphere = (tNear > 0.0001f)? tNear: tFar;
+			tHit[k] = (det >= 0.0f && tSphere > 0.0001f)? tSphere: 1e30f;
+		}
+		for(uint k = 0; k < groupSize && k <= last; k++){
+			if(tHit[k] < t){
+				t = tHit[k];
+				sphereID = items[begin + k];
+				isHit = true;
+			}
+		}
+	}
+	return isHit;
+}
+
+template<>
+bool SphereSystem::intersectISA<KERNEL_ISA>(Ray const& ray, float &t, uint &sphereID, glm::vec3 &normal)const{
+	KernelDDA dda;
+	if(mItems.empty() || !dda.setup(mAABB, mCellDim, mRes, ray)) return false;
+
+	bool isHit = false;
+	uint nCellsVisited = 0, nTests = 0;
+	while(1){
+		uint index = dda.cell[0] + mRes[0] * (dda.cell[1] + mRes[1] * dda.cell[2]);
+		uint begin = mCellStarts[index];
+		uint nItems = mCellStarts[index + 1] - begin;
+		nCellsVisited++;
+		nTests += nItems;
+		if(nItems > 0 && kernelSpheres(&mItems[begin], nItems, &mX[0], &mY[0], &mZ[0], &mRadius[0], ray, t, sphereID)) isHit = true;
+		uint axis = dda.axis();
+		if(t < dda.nextCrossingT[axis] || !dda.step(axis)) break;
+	}
+	if(isHit){
+		glm::vec3 center(mX[sphereID], mY[sphereID], mZ[sphereID]);
+		normal = glm::normalize(ray.r0 + t * ray.dir - center);
+	}
+	statsCount(COUNTER_CELLS_VISITED, nCellsVisited);
+	statsCount(COUNTER_PRIMITIVE_TESTS, nTests);
+	return isHit;
+}
+
+template<>
+bool SphereSystem::shadowIntersectISA<KERNEL_ISA>(Ray const& ray, float &t)const{
+	KernelDDA dda;
+	if(mItems.empty() || !dda.setup(mAABB, mCellDim, mRes, ray)) return false;
+
+	bool isHit = false;
+	uint nCellsVisited = 0, nTests = 0;
+	while(1){
+		uint index = dda.cell[0] + mRes[0] * (dda.cell[1] + mRes[1] * dda.cell[2]);
+		uint begin = mCellStarts[index];
+		uint nItems = mCellStarts[index + 1] - begin;
+		nCellsVisited++;
+		nTests += nItems;
+		uint sphereID;
+		if(nItems > 0 && kernelSpheres(&mItems[begin], nItems, &mX[0], &mY[0], &mZ[0], &mRadius[0], ray, t, sphereID)){
+			isHit = true;
+			break;
+		}
+		uint axis = dda.axis();
+		if(t < dda.nextCrossingT[axis] || !dda.step(axis)) break;
+	}
+	statsCount(COUNTER_CELLS_VISITED, nCellsVisited);
+	statsCount(COUNTER_PRIMITIVE_TESTS, nTests);
+	return isHit;
+}
+
+template<>
+void PhotonMap::recLocate<KERNEL_ISA>(kdNode* node, std::vector<Photon const*> &retPhotons, glm::vec3 const& position, float radius, uint &nExamined)const{
+	if(node->isLeaf){
+		nExamined++;
+		Photon const* photon = node->photon;
+		glm::vec3 distance = photon->p - position;
+		if(glm::length(distance) < radius) retPhotons.push_back(photon);
+		return;
+	}
+	float dl, dr;
+	uchar axis = node->splitAxis;
+	dl = position[axis] - radius;
+	dr = position[axis] + radius;
+
+	float splitPos = node->splitPosition;
+
+	if(dl < splitPos){
+		recLocate<KERNEL_ISA>(node->left, retPhotons, position, radius, nExamined);
+	}
+	if(dr > splitPos){
+		recLocate<KERNEL_ISA>(node->right, retPhotons, position, radius, nExamined);
+	}
+}
+
+template<>
+std::vector<Photon const*> PhotonMap::locateISA<KERNEL_ISA>(glm::vec3 const& position, float radius)const{
+	std::vector<Photon const*> retPhotons;
+	uint nExamined = 0;
+	recLocate<KERNEL_ISA>(mRoot, retPhotons, position, radius, nExamined);
+	statsCount(COUNTER_PHOTON_GATHERS, 1);
+	statsCount(COUNTER_PHOTONS_EXAMINED, nExamined);
+	return retPhotons;
+}
+
+template<>
+colorRGBF RayTracer::calcIndirectISA<KERNEL_ISA>(glm::vec3 const& position, glm::vec3 const& N, float &nShadowPhotons)const{
+	colorRGBF pixelColor;
+	nShadowPhotons = 0.0f;
+	std::vector<Photon const*> photons = photonMap().locate(position, 0.2f);
+	uint nPhotons = photons.size();
+	float normalization = mNPointLights * (200.0f / M_PI) / (mNPhotons * 0.2f * 0.2f);
+	if(nPhotons > 8){
+		colorRGBF indColor;
+		for(uint i = 0; i < nPhotons; i++){
+			// if(photons[i]->isShadow) nShadowPhotons++;
+			// else{
+				float diffuse = glm::dot(-photons[i]->dir, N);
+				if(diffuse < 0) continue;
+				colorRGBF photonColor = photons[i]->rgb;
+				indColor += diffuse * photonColor;
+			// }
+		}
+		pixelColor += indColor * normalization;
+		// nShadowPhotons = nShadowPhotons / nPhotons;
+	}
+	return pixelColor;
+}
+
+template<>
+colorRGBF RayTracer::calcDiffuseISA<KERNEL_ISA>(glm::vec3 const& position, glm::vec3 const& I, glm::vec3 const& N, Material const& mat)const{
+	colorRGBF pixelColor;
+	Ray lightRay;
+	lightRay.r0 = position;
+	for(uint lightID = 0; lightID < mNPointLights; lightID++){
+		colorRGBF lightColor = mScene->pointLight(lightID).mColor;
+		lightRay.dir = mScene->pointLight(lightID).mPosition - lightRay.r0;
+		float d = glm::length(lightRay.dir);
+		if(glm::dot(lightRay.dir, N) <= 0.0f) continue;
+		lightRay.dir = lightRay.dir / d;
+		// lightRay.r0 += lightRay.dir * 1.0001f; //Bump Ray
+		bool isInShadow = false;
+		isInShadow = shadowIntersect(lightRay, d);
+		if(!isInShadow){
+			// lambert
+			float diffuse = glm::dot(lightRay.dir, N);
+			pixelColor += diffuse * lightColor * mat.color;
+			// blinn
+			glm::vec3 halfVector = lightRay.dir - I;
+			float temp = glm::length(halfVector);
+			if(temp > 0.0f){
+				halfVector = halfVector / temp;
+				float spec = kernelMaxf(glm::dot(halfVector, N), 0.0f);
+				spec = mat.Sv * pow(spec, mat.Sp);
+				pixelColor += spec * lightColor;
+			}
+		}
+	}
+	return pixelColor;
+}
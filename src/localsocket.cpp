@@ -0,0 +1,148 @@
+#include "../include/localsocket.h"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#define RT_LOCAL_SOCKETS
+#endif
+
+#define MAX_LINE_LENGTH 4096 //Longer commands are cut off and fail
+
+#ifdef RT_LOCAL_SOCKETS
+//Writes to a closed connection fail with EPIPE instead of raising SIGPIPE. Where send has no flag for that
+//(macOS), the socket is told instead.
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+static void setNoSignal(int fd){}
+#else
+#define SEND_FLAGS 0
+static void setNoSignal(int fd){
+#ifdef SO_NOSIGPIPE
+	int isSet = 1;
+	setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &isSet, sizeof(isSet));
+#endif
+}
+#endif
+#endif
+
+#ifdef RT_LOCAL_SOCKETS
+static bool socketAddress(std::string const& path, sockaddr_un &address){
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if(path.size() >= sizeof(address.sun_path)){
+		std::cout << "Socket path \"" << path << "\" is too long." << std::endl;
+		return false;
+	}
+	strcpy(address.sun_path, path.c_str());
+	return true;
+}
+#endif
+
+int listenLocal(std::string const& path){
+#ifdef RT_LOCAL_SOCKETS
+	sockaddr_un address;
+	if(!socketAddress(path, address)) return -1;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0){
+		std::cout << "Error creating socket \"" << path << "\" by function " << "'" << __FUNCTION__ << "': " << strerror(errno) << std::endl;
+		return -1;
+	}
+	unlink(path.c_str());
+	if(bind(fd, (sockaddr*)&address, sizeof(address)) != 0 || listen(fd, 16) != 0){
+		std::cout << "Error creating socket \"" << path << "\" by function " << "'" << __FUNCTION__ << "': " << strerror(errno) << std::endl;
+		close(fd);
+		return -1;
+	}
+	return fd;
+#else
+	std::cout << "Unix sockets are not supported on this system." << std::endl;
+	return -1;
+#endif
+}
+
+int acceptLocal(int listener, uint timeoutSeconds){
+#ifdef RT_LOCAL_SOCKETS
+	int fd;
+	do fd = accept(listener, NULL, NULL);
+	while(fd < 0 && errno == EINTR);
+	if(fd < 0) return fd;
+	setNoSignal(fd);
+	if(timeoutSeconds > 0){
+		timeval timeout;
+		timeout.tv_sec = timeoutSeconds;
+		timeout.tv_usec = 0;
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	}
+	return fd;
+#else
+	return -1;
+#endif
+}
+
+int connectLocal(std::string const& path){
+#ifdef RT_LOCAL_SOCKETS
+	sockaddr_un address;
+	if(!socketAddress(path, address)) return -1;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) != 0){
+		std::cout << "Error connecting to socket \"" << path << "\" by function " << "'" << __FUNCTION__ << "': " << strerror(errno) << std::endl;
+		if(fd >= 0) close(fd);
+		return -1;
+	}
+	setNoSignal(fd);
+	return fd;
+#else
+	std::cout << "Unix sockets are not supported on this system." << std::endl;
+	return -1;
+#endif
+}
+
+//A byte at a time, the commands are short and the rest of the stream must stay unread
+bool readLine(int fd, std::string &line){
+	line.clear();
+#ifdef RT_LOCAL_SOCKETS
+	char c;
+	for(;;){
+		ssize_t n = read(fd, &c, 1);
+		if(n < 0 && errno == EINTR) continue;
+		if(n < 0) return false;
+		if(n == 0) return !line.empty();
+		if(c == '\n') return true;
+		if(line.size() >= MAX_LINE_LENGTH) return false;
+		if(c != '\r') line += c;
+	}
+#else
+	return false;
+#endif
+}
+
+bool writeAll(int fd, void const* data, size_t size){
+#ifdef RT_LOCAL_SOCKETS
+	char const* bytes = (char const*)data;
+	while(size > 0){
+		ssize_t n = send(fd, bytes, size, SEND_FLAGS);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) return false;
+		bytes += n;
+		size -= n;
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool writeLine(int fd, std::string const& line){
+	std::string terminated = line + "\n";
+	return writeAll(fd, terminated.data(), terminated.size());
+}
+
+void closeLocal(int fd){
+#ifdef RT_LOCAL_SOCKETS
+	if(fd >= 0) close(fd);
+#endif
+}
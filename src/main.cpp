@@ -1,46 +1,205 @@
 #include "../include/raytracer.h"
-#include <windows.h>
+#include "../include/distributed.h"
+#include "../include/snapshot.h"
+#include "../include/compiledscene.h"
+#include "../include/pngstream.h"
+#include "../include/stats.h"
+#include "../include/affinity.h"
+#include "../include/localsocket.h"
 #include <FreeImage.h>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <cstdlib>
+#include <cstdio>
+#include <map>
+#include <algorithm>
+#include <thread>
+#include <functional>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <csignal>
+#include <unistd.h>
 
-double PCFreq = 0.0;
-__int64 CounterStart = 0;
+static std::chrono::steady_clock::time_point CounterStart;
 
 void StartCounter(){
-	LARGE_INTEGER li;
-	if(!QueryPerformanceFrequency(&li))
-		std::cout << "QueryPerformanceFrequency failed!" << std::endl;
-		
-	PCFreq = double(li.QuadPart) / 1000.0;
-	
-	QueryPerformanceCounter(&li);
-	CounterStart = li.QuadPart;
+	CounterStart = std::chrono::steady_clock::now();
 }
 
+//Milliseconds since StartCounter
 double GetCounter(){
-	LARGE_INTEGER li;
-	QueryPerformanceCounter(&li);
-	return double(li.QuadPart - CounterStart) / PCFreq;
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - CounterStart).count();
 }
 
 
-int main(int argc, char *argv[]){
-
-	uint width, height;
-	width = 1300;
-	height = 1300;
+static void saveImage(uchar const* data, uint width, uint height, char const* filename){
+	PhaseTimer timer(PHASE_ENCODE);
+	FIBITMAP *bitmap = FreeImage_Allocate(width, height, 24);
+	for(uint j = 0; j < height; j++){
+		BYTE *scanLine = FreeImage_GetScanLine(bitmap, j);
+		uchar const* row = data + (size_t)3 * width * j;
+		for(uint i = 0; i < width; i++){
+			scanLine[3*i + FI_RGBA_RED] = row[3*i + 0];
+			scanLine[3*i + FI_RGBA_GREEN] = row[3*i + 1];
+			scanLine[3*i + FI_RGBA_BLUE] = row[3*i + 2];
+		}
+	}
 	
-	Scene myScene;
+	FreeImage_Save(FIF_PNG, bitmap, filename, 0);
+	FreeImage_Unload(bitmap);
+}
+
+//One image per cost named after the output image, e.g. test_cycles.png for test.png
+static void saveHeatmaps(CostBuffer const& costs, char const* outputFile){
+	std::string name(outputFile);
+	size_t slash = name.find_last_of("/\\");
+	size_t dot = name.rfind('.');
+	if(dot == std::string::npos || (slash != std::string::npos && dot < slash)) dot = name.size();
+	std::vector<uchar> image;
+	for(uint cost = 0; cost < N_COSTS; cost++){
+		double scale = costs.colorize((eCost)cost, image);
+		std::string filename = name.substr(0, dot) + "_" + CostBuffer::name((eCost)cost) + ".png";
+		saveImage(&image[0], costs.width(), costs.height(), filename.c_str());
+		std::cout << "Heatmap " << filename << ", white is " << scale << " " << CostBuffer::name((eCost)cost) << " per sample." << std::endl;
+	}
+}
+
+//Fills a printf pattern like frame%05d.png, a plain name gets the frame number before its extension
+static std::string frameFileName(char const* pattern, uint frame){
+	std::string name(pattern);
+	if(name.find('%') != std::string::npos){
+		char buffer[1024];
+		snprintf(buffer, sizeof(buffer), pattern, frame);
+		return buffer;
+	}
+	char number[16];
+	snprintf(number, sizeof(number), "%05u", frame);
+	size_t dot = name.rfind('.');
+	if(dot == std::string::npos) return name + number;
+	return name.substr(0, dot) + number + name.substr(dot);
+}
+
+//Encodes and writes images on its own thread, so that tracing the next image does not wait for the disk
+class ImageWriter{
+public:
+	ImageWriter(void){};
+	~ImageWriter(void){
+		wait();
+	};
+	void write(uchar const* data, uint width, uint height, std::string const& filename){
+		wait();
+		mData.assign(data, data + (size_t)3 * width * height);
+		mFilename = filename;
+		mThread = std::thread(saveImage, &mData[0], width, height, mFilename.c_str());
+	};
+	void wait(void){
+		if(mThread.joinable()) mThread.join();
+	};
+private:
+	ImageWriter(ImageWriter const&);
+	ImageWriter& operator=(ImageWriter const&);
+	std::vector<uchar> mData;
+	std::string mFilename;
+	std::thread mThread;
+};
+
+static bool readSnapshotFile(std::string const& filename, Snapshot &snapshot){
+	SnapshotReader reader;
+	if(!reader.open(filename.c_str()) || !reader.next(snapshot)){
+		std::cout << "Error parsing file \"" << filename << "\" by function " << "'" << __FUNCTION__ << "'" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+static void prefetchSnapshot(std::string filename, Snapshot *snapshot, bool *isParsed){
+	*isParsed = readSnapshotFile(filename, *snapshot);
+}
+
+//Adds the particles centered on the origin. Types are looked up by name, so a model is parsed only
+//the first time any snapshot refers to it. Particles of the type "sphere" go to the scene's sphere system,
+//the scale of that type is their diameter. The analytic types take their shape from the type line:
+//  spherocylinder <diameter> <length>, the length of the cylinder in diameters, 1 by default
+//  superellipsoid <scale> <a> <b> <c> <p>, the semi axes, 0.5 by default, and the exponent, 2 by default
+//Particles the scene culls are left out, their number is returned.
+#define TYPE_SPHEROCYLINDER -2
+#define TYPE_SUPERELLIPSOID -3
+static uint addSnapshot(Scene &scene, Snapshot const& snapshot, std::map<std::string, int> &typeIDs, std::vector<Material> &mats){
+	std::vector<int> snapshotTypes;
+	std::vector<int> sphereMaterials(snapshot.typeNames.size(), -1);
+	std::vector<glm::vec4> shapes(snapshot.typeShapes);
+	std::vector<float> radii(snapshot.typeNames.size(), 0.0f); //Bounding spheres
+	for(uint i = 0; i < snapshot.typeNames.size(); i++){
+		float scale = snapshot.typeScales[i];
+		if(snapshot.typeNames[i] == "sphere"){
+			sphereMaterials[i] = scene.sphereSystem().addMaterial(mats[i]);
+			snapshotTypes.push_back(-1);
+			radii[i] = 0.5f * scale;
+			continue;
+		}
+		if(snapshot.typeNames[i] == "spherocylinder"){
+			if(shapes[i][0] == 0.0f) shapes[i][0] = 1.0f;
+			snapshotTypes.push_back(TYPE_SPHEROCYLINDER);
+			radii[i] = 0.5f * scale * (1.0f + shapes[i][0]);
+			continue;
+		}
+		if(snapshot.typeNames[i] == "superellipsoid"){
+			for(uint j = 0; j < 3; j++){
+				if(shapes[i][j] == 0.0f) shapes[i][j] = 0.5f;
+			}
+			if(shapes[i][3] == 0.0f) shapes[i][3] = 2.0f;
+			snapshotTypes.push_back(TYPE_SUPERELLIPSOID);
+			radii[i] = scale * glm::length(glm::vec3(shapes[i]));
+			continue;
+		}
+		std::map<std::string, int>::iterator type = typeIDs.find(snapshot.typeNames[i]);
+		if(type == typeIDs.end()){
+			type = typeIDs.insert(std::make_pair(snapshot.typeNames[i], scene.addPolyhedronType("obj/" + snapshot.typeNames[i] + ".obj"))).first;
+		}
+		snapshotTypes.push_back(type->second);
+		if(type->second < 0) continue;
+		std::vector<glm::vec3> const& vertices = scene.polyhedronType(type->second).mVertices;
+		for(uint j = 0; j < vertices.size(); j++) radii[i] = std::max(radii[i], scale * glm::length(vertices[j]));
+	}
 	
-	Material material0;
-	material0.color = colorRGBF(1.0f);
-	material0.reflectivity = 0.0f;
-	material0.diffusivity = 0.5f;
-	material0.Sv = 0.0f;
-	material0.Sp = 0.0f;
+	glm::vec3 translation = -snapshot.center();
+	uint nSpheres = 0;
+	for(uint i = 0; i < snapshot.particles.size(); i++){
+		SnapshotParticle const& particle = snapshot.particles[i];
+		if(sphereMaterials[particle.type] >= 0 && !scene.isCulled(particle.position + translation, radii[particle.type])) nSpheres++;
+	}
+	scene.sphereSystem().reserve(nSpheres);
 	
+	uint nCulled = 0;
+	for(uint i = 0; i < snapshot.particles.size(); i++){
+		SnapshotParticle const& particle = snapshot.particles[i];
+		uint typeID = particle.type;
+		if(scene.isCulled(particle.position + translation, radii[typeID])){
+			nCulled++;
+			continue;
+		}
+		if(sphereMaterials[typeID] >= 0){
+			scene.sphereSystem().add(particle.position + translation, 0.5f * snapshot.typeScales[typeID], sphereMaterials[typeID]);
+			continue;
+		}
+		float scale = snapshot.typeScales[typeID];
+		if(snapshotTypes[typeID] == TYPE_SPHEROCYLINDER){
+			scene.addSpherocylinder(particle.position + translation, particle.rotation, 0.5f * scale, shapes[typeID][0] * scale, mats[typeID]);
+		}
+		else if(snapshotTypes[typeID] == TYPE_SUPERELLIPSOID){
+			scene.addSuperellipsoid(particle.position + translation, particle.rotation, scale * glm::vec3(shapes[typeID]), shapes[typeID][3], mats[typeID]);
+		}
+		else scene.addPolyhedron(snapshotTypes[typeID], particle.position + translation, mats[typeID], particle.rotation, scale);
+	}
+	return nCulled;
+}
+
+//Materials of the particle types in the order of the snapshot's type lines
+static std::vector<Material> typeMaterials(void){
 	Material material1;
 	material1.color = colorRGBF(0.04f, 0.3f, 0.6f);
 	// material1.color = colorRGBF(30, 144, 255);
@@ -60,114 +219,844 @@ int main(int argc, char *argv[]){
 	std::vector<Material> mats;
 	mats.push_back(material1);
 	mats.push_back(material2);
-	
+	return mats;
+}
+
+static void addLights(Scene &scene){
 	glm::vec3 lightPosition = glm::vec3(-30.0f, 30.0f, 30.0f);
-	myScene.addAreaLight(lightPosition, -glm::normalize(lightPosition), 15.0f, colorRGBF(255, 255, 255), 64);
+	scene.addAreaLight(lightPosition, -glm::normalize(lightPosition), 15.0f, colorRGBF(255, 255, 255), 64);
+}
+
+//Looks at the box from above its top face, nSamples per axis
+static PinholeCamera boxCamera(float const* box, uint width, uint height, uint nSamples){
+	return PinholeCamera(glm::vec3(0.0f, (box[4] + box[5]), 2.0f * box[8]), glm::vec3(0.0f, 4.0f, 0.0f), 60.0f, (float)width / height, 1.0f, width, height, nSamples);
+}
+
+static PinholeCamera snapshotCamera(Snapshot const& snapshot, uint width, uint height){
+	return boxCamera(snapshot.box, width, height, 2);
+}
+
+//Batch images are named after their snapshot unless a pattern was given
+static std::string batchFileName(std::string const& inputFile, char const* outputPattern, uint index){
+	if(outputPattern) return frameFileName(outputPattern, index);
+	size_t slash = inputFile.find_last_of("/\\");
+	size_t dot = inputFile.rfind('.');
+	if(dot == std::string::npos || (slash != std::string::npos && dot < slash)) return inputFile + ".png";
+	return inputFile.substr(0, dot) + ".png";
+}
+
+//Renders the image in bands of rows from the top down and streams each band to the PNG encoder as soon as
+//it is done, so memory holds one band instead of the whole image. The raytracer's buffer is one band high.
+//The stream is opened by the caller and closed here.
+static bool traceStreaming(RayTracer &raytracer, CameraBase &camera, uint width, uint height, uint bandHeight, PngStream &png){
+	uint nBands = (height + bandHeight - 1) / bandHeight;
+	for(uint band = 0, top = height; top > 0; band++){
+		uint nRows = (top < bandHeight)? top: bandHeight;
+		top -= nRows;
+		std::cout << "Band " << band + 1 << " of " << nBands << std::endl;
+		raytracer.setRowWindow(top, nRows);
+		raytracer.clearAccumulation();
+		raytracer.Trace(camera);
+		//Row 0 of the buffer is the bottom of the band, PNG rows go top to bottom
+		uchar const* topRow = raytracer.readBuffer() + (size_t)3 * width * (nRows - 1);
+		if(!png.writeRows(topRow, nRows, -(ptrdiff_t)(3 * (size_t)width))) return false;
+	}
+	return png.close();
+}
+
+struct PassOutput{
+	uint width, height;
+	char const* previewFile;
+	char const* checkpointFile;
+};
+
+static void savePass(RayTracer const& raytracer, uint pass, void *userData){
+	PassOutput const* output = (PassOutput const*)userData;
+	if(output->previewFile) saveImage(raytracer.readBuffer(), output->width, output->height, output->previewFile);
+	if(output->checkpointFile) raytracer.saveCheckpoint(output->checkpointFile);
+}
+
+//Sums the samples of several checkpoints of the same frame into one checkpoint and image
+static bool mergeCheckpoints(std::vector<std::string> const& inputs, char const* outputCheckpoint, char const* outputImage){
+	uint nInputs = inputs.size();
+	AccumBuffer merged(0, 0);
+	if(!merged.load(inputs[0].c_str())) return false;
+	for(uint i = 1; i < nInputs; i++){
+		AccumBuffer partial(0, 0);
+		if(!partial.load(inputs[i].c_str()) || !merged.merge(partial)) return false;
+	}
+	if(outputCheckpoint && !merged.save(outputCheckpoint)) return false;
+	std::cout << "Merged " << nInputs << " checkpoints, minimum samples per pixel: " << merged.minSamples() << std::endl;
 	
+	uint width = merged.width();
+	uint height = merged.height();
+	uchar *data = new uchar[(size_t)3 * width * height]();
+	merged.resolve(data);
+	FreeImage_Initialise();
+	saveImage(data, width, height, outputImage);
+	FreeImage_DeInitialise();
+	delete[] data;
+	return true;
+}
+
+//Splits the frame into one contiguous range of tiles per worker, runs the workers through the launcher
+//and assembles their checkpoints. Workers exchange photon map shares through the work directory,
+//so it has to be visible to all of them.
+static bool runCoordinator(char const* program, uint nWorkers, std::string const& launcher, std::string const& workDir,
+	std::vector<std::string> const& forwardedArgs, char const* inputFile, char const* outputFile)
+{
+	std::string photonPrefix = workDir + "/photons";
+	std::string partPrefix = workDir + "/part";
+	std::string failureFile = photonPrefix + ".failed";
+	remove(failureFile.c_str());
+	std::vector<std::string> commands;
+	std::vector<std::string> parts;
+	for(uint i = 0; i < nWorkers; i++){
+		//Stale shares of an earlier run would be picked up by the waiting workers
+		remove(partFileName(photonPrefix, i).c_str());
+		remove(partFileName(partPrefix, i).c_str());
+		parts.push_back(partFileName(partPrefix, i));
+		
+		std::ostringstream command;
+		std::string prefix = launcher;
+		size_t pos = prefix.find("%i");
+		if(pos != std::string::npos) prefix.replace(pos, 2, std::to_string(i));
+		if(!prefix.empty()) command << prefix << " ";
+		command << shellQuote(program) << " -worker " << i << " " << nWorkers << " -workdir " << shellQuote(workDir);
+		for(uint j = 0; j < forwardedArgs.size(); j++) command << " " << shellQuote(forwardedArgs[j]);
+		command << " " << shellQuote(inputFile);
+		commands.push_back(command.str());
+	}
+	std::cout << "Launching " << nWorkers << " workers." << std::endl;
+	uint nSucceeded = runCommands(commands, failureFile);
+	for(uint i = 0; i < nWorkers; i++) remove(partFileName(photonPrefix, i).c_str());
+	remove(failureFile.c_str());
+	if(nSucceeded != nWorkers){
+		std::cout << nWorkers - nSucceeded << " of " << nWorkers << " workers failed." << std::endl;
+		return false;
+	}
+	return mergeCheckpoints(parts, NULL, outputFile);
+}
+
+#define DAEMON_COMMAND_TIMEOUT 10 //Seconds a connection has to send its command
+
+//Settings every scene of the daemon is loaded and rendered with, from its command line
+struct DaemonOptions{
+	uint nAORays;
+	float aoDistance;
+	bool isRasterized;
+	bool isReplicated;
+	float gridDensity;
+	uint gridMaxResolution;
+	eIntegrator integrator;
+	double timeBudget; //Per job
+	uint bandHeight;
+};
+
+//A scene kept loaded by the daemon with its grid and photon map. The raytracer holds a single image, so jobs on the
+//same scene take turns while jobs on different scenes run concurrently.
+struct ResidentScene{
+	ResidentScene(void): raytracer(1, 1){};
+	Scene scene;
+	CompiledScene compiled; //Stays mapped for the instances
+	float box[9];
+	RayTracer raytracer;
+	std::mutex mutex;
+};
+
+typedef std::map<std::string, std::shared_ptr<ResidentScene> > ResidentScenes;
+
+static bool loadResident(ResidentScene &resident, std::string const& filename, DaemonOptions const& options){
+	std::vector<Material> mats = typeMaterials();
+	addLights(resident.scene);
+	RayTracer &raytracer = resident.raytracer;
+	raytracer.setAmbientOcclusion(options.nAORays, options.aoDistance);
+	raytracer.setRasterization(options.isRasterized);
+	raytracer.setReplication(options.isReplicated);
+	raytracer.setGridResolution(options.gridDensity, options.gridMaxResolution);
+	raytracer.setIntegrator(options.integrator);
+	raytracer.setTimeBudget(options.timeBudget);
+	if(isCompiledScene(filename.c_str())){
+		if(!resident.compiled.open(filename.c_str())) return false;
+		resident.compiled.instantiate(resident.scene);
+		std::copy(resident.compiled.box(), resident.compiled.box() + 9, resident.box);
+		raytracer.Init(&resident.scene, resident.compiled);
+		return true;
+	}
+	Snapshot snapshot;
+	if(!readSnapshotFile(filename, snapshot)) return false;
+	std::map<std::string, int> typeIDs;
+	addSnapshot(resident.scene, snapshot, typeIDs, mats);
+	std::copy(snapshot.box, snapshot.box + 9, resident.box);
+	raytracer.Init(&resident.scene);
+	return true;
+}
+
+//render <name> <width> <height> [samples <n>] [crop <x> <y> <w> <h>] [camera <px> <py> <pz> <lx> <ly> <lz> <fov>]
+//The crop is counted from the top left corner of the image, the reply is "ok png <w> <h>" and the PNG of the crop,
+//streamed band by band as they are traced.
+static bool renderJob(int fd, std::istringstream &arguments, ResidentScenes &scenes, std::mutex &scenesMutex, DaemonOptions const& options){
+	std::string name;
+	uint width = 0, height = 0;
+	arguments >> name >> width >> height;
+	if(!arguments || width == 0 || height == 0) return writeLine(fd, "error expected render <name> <width> <height>");
+	uint nSamples = 2;
+	uint crop[4] = {0, 0, width, height};
+	bool hasCamera = false;
+	glm::vec3 position, lookAt;
+	float fov = 60.0f;
+	std::string option;
+	while(arguments >> option){
+		if(option == "samples") arguments >> nSamples;
+		else if(option == "crop") arguments >> crop[0] >> crop[1] >> crop[2] >> crop[3];
+		else if(option == "camera"){
+			arguments >> position.x >> position.y >> position.z >> lookAt.x >> lookAt.y >> lookAt.z >> fov;
+			hasCamera = true;
+		}
+		else return writeLine(fd, "error unknown option " + option);
+		if(!arguments) return writeLine(fd, "error bad arguments of " + option);
+	}
+	if(nSamples == 0 || crop[2] == 0 || crop[3] == 0 || crop[0] + crop[2] > width || crop[1] + crop[3] > height){
+		return writeLine(fd, "error samples or crop out of range");
+	}
+	std::shared_ptr<ResidentScene> resident;
+	{
+		std::lock_guard<std::mutex> lock(scenesMutex);
+		ResidentScenes::iterator scene = scenes.find(name);
+		if(scene != scenes.end()) resident = scene->second;
+	}
+	if(!resident) return writeLine(fd, "error no scene " + name);
 	
-	std::ifstream file;
-	file.open(argv[1]);
+	std::lock_guard<std::mutex> lock(resident->mutex);
+	PinholeCamera camera = hasCamera? PinholeCamera(position, lookAt, fov, (float)width / height, 1.0f, width, height, nSamples):
+		boxCamera(resident->box, width, height, nSamples);
+	//Camera rows count from the bottom
+	CroppedCamera window(camera, crop[0], height - crop[1] - crop[3]);
+	resident->raytracer.resize(crop[2], std::min(options.bandHeight, crop[3]));
+	std::ostringstream reply;
+	reply << "ok png " << crop[2] << " " << crop[3];
+	if(!writeLine(fd, reply.str())) return false;
+	int streamFD = dup(fd);
+	FILE *stream = (streamFD >= 0)? fdopen(streamFD, "wb"): NULL;
+	if(!stream){
+		if(streamFD >= 0) close(streamFD);
+		return false;
+	}
+	PngStream png;
+	//Writes fail once the client has gone, which ends the job after the band being traced
+	if(!png.open(stream, "socket", crop[2], crop[3]) || !traceStreaming(resident->raytracer, window, crop[2], crop[3], options.bandHeight, png)){
+		std::cout << "Render of " << name << " stopped, the client does not take the image." << std::endl;
+		return false;
+	}
+	return true;
+}
+
+//One command per connection, see printUsage
+static void serveConnection(int fd, std::string line, ResidentScenes *scenes, std::mutex *scenesMutex, DaemonOptions const* options){
+	std::istringstream arguments(line);
+	std::string command, name;
+	arguments >> command;
+	if(command == "load"){
+		std::string filename;
+		arguments >> name >> filename;
+		if(!arguments) writeLine(fd, "error expected load <name> <file>");
+		else{
+			std::shared_ptr<ResidentScene> resident(new ResidentScene);
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			std::cout << "Loading " << filename << " as " << name << "." << std::endl;
+			if(!loadResident(*resident, filename, *options)) writeLine(fd, "error loading " + filename);
+			else{
+				std::lock_guard<std::mutex> lock(*scenesMutex);
+				if(!scenes->insert(std::make_pair(name, resident)).second) writeLine(fd, "error " + name + " is already loaded");
+				else writeLine(fd, "ok " + std::to_string(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()));
+			}
+		}
+	}
+	else if(command == "unload"){
+		arguments >> name;
+		std::lock_guard<std::mutex> lock(*scenesMutex);
+		//Jobs still rendering the scene keep it until they are done
+		if(scenes->erase(name) == 0) writeLine(fd, "error no scene " + name);
+		else writeLine(fd, "ok");
+	}
+	else if(command == "list"){
+		std::string reply = "ok";
+		std::lock_guard<std::mutex> lock(*scenesMutex);
+		for(ResidentScenes::const_iterator scene = scenes->begin(); scene != scenes->end(); ++scene) reply += " " + scene->first;
+		writeLine(fd, reply);
+	}
+	else if(command == "render") renderJob(fd, arguments, *scenes, *scenesMutex, *options);
+	else writeLine(fd, "error unknown command " + command);
+	closeLocal(fd);
+}
+
+//Keeps scenes loaded and renders jobs from the socket until a quit command. Each connection is served by its own
+//thread, the files given on the command line are loaded first and named after their file names.
+static bool runDaemon(std::string const& socketPath, std::vector<std::string> const& inputFiles, DaemonOptions const& options){
+#ifdef SIGPIPE
+	//Images are written to the sockets through stdio, a client that disconnects must fail the write, not end the daemon
+	signal(SIGPIPE, SIG_IGN);
+#endif
+	ResidentScenes scenes;
+	std::mutex scenesMutex;
+	for(uint i = 0; i < inputFiles.size(); i++){
+		std::string name = inputFiles[i].substr(inputFiles[i].find_last_of("/\\") + 1);
+		name = name.substr(0, name.rfind('.'));
+		std::shared_ptr<ResidentScene> resident(new ResidentScene);
+		std::cout << "Loading " << inputFiles[i] << " as " << name << "." << std::endl;
+		if(!loadResident(*resident, inputFiles[i], options)) return false;
+		scenes[name] = resident;
+	}
+	int listener = listenLocal(socketPath);
+	if(listener < 0) return false;
+	std::cout << "Listening on " << socketPath << "." << std::endl;
+	
+	std::mutex jobsMutex;
+	std::condition_variable jobsDone;
+	uint nJobs = 0;
+	std::atomic<bool> isQuitting(false);
+	while(!isQuitting){
+		int fd = acceptLocal(listener, DAEMON_COMMAND_TIMEOUT);
+		if(fd < 0) continue;
+		if(isQuitting){
+			closeLocal(fd);
+			break;
+		}
+		{
+			std::lock_guard<std::mutex> lock(jobsMutex);
+			nJobs++;
+		}
+		//The command is read on the connection's thread, so that a client which sends nothing holds up no one else
+		std::thread([&, fd](){
+			std::string line;
+			if(!readLine(fd, line)) closeLocal(fd);
+			else if(line == "quit"){
+				//Wakes the accept loop, which then stops
+				isQuitting = true;
+				closeLocal(connectLocal(socketPath));
+				writeLine(fd, "ok");
+				closeLocal(fd);
+			}
+			else serveConnection(fd, line, &scenes, &scenesMutex, &options);
+			std::lock_guard<std::mutex> lock(jobsMutex);
+			if(--nJobs == 0) jobsDone.notify_all();
+		}).detach();
+	}
+	closeLocal(listener);
+	remove(socketPath.c_str());
+	std::unique_lock<std::mutex> lock(jobsMutex);
+	jobsDone.wait(lock, [&](){ return nJobs == 0; });
+	return true;
+}
+
+//Sends one command to a daemon, a rendered image is written to outputFile and anything else is printed
+static bool runRequest(std::string const& socketPath, std::string const& command, char const* outputFile){
+	int fd = connectLocal(socketPath);
+	if(fd < 0) return false;
+	std::string reply;
+	if(!writeLine(fd, command) || !readLine(fd, reply)){
+		std::cout << "No reply from " << socketPath << "." << std::endl;
+		closeLocal(fd);
+		return false;
+	}
+	if(reply.compare(0, 7, "ok png ") != 0){
+		std::cout << reply << std::endl;
+		closeLocal(fd);
+		return reply.compare(0, 2, "ok") == 0;
+	}
+	FILE *file = fopen(outputFile, "wb");
 	if(!file){
-		std::cout << "Error parsing file \"" << argv[1] << "\" by function " << "'" << __FUNCTION__ << "'" << std::endl;
+		std::cout << "Error writing file \"" << outputFile << "\" by function " << "'" << __FUNCTION__ << "'" << std::endl;
+		closeLocal(fd);
 		return false;
 	}
-	std::cout << "Parsing " << argv[1] << "." << std::endl;
-	std::string line;
-	
-	std::getline(file, line);
-	std::istringstream s(line);
-	uint nPart;
-	uint nTypes;
-	s >> nPart;
-	
-	std::getline(file, line);
-	s.seekg(0);
-	s.clear();
-	s.str(line);
-	s >> nTypes;
-	
-	std::vector<uint> typeIDs;
-	std::vector<float> typeScales;
-	
-	for(uint i = 0; i < nPart + 1; i++) std::getline(file, line);
-	for(uint i = 0; i < nTypes; i++){
-		std::getline(file, line);
-		std::istringstream ss(line);
-		std::string typeName;
-		ss >> typeName;
-		float scale;
-		if(ss >> scale) typeScales.push_back(scale);
-		else typeScales.push_back(1.0f);
-		uint typeID;
-		typeID = myScene.addPolyhedronType("obj/" + typeName + ".obj");
-		typeIDs.push_back(typeID);
-	}
-	
-	file.seekg(0);
-	std::getline(file, line);
-	std::getline(file, line);
-	std::getline(file, line);
+	//The daemon closes the connection after the last chunk
+	char buffer[65536];
+	ssize_t n;
+	bool isGood = true;
+	while((n = read(fd, buffer, sizeof(buffer))) > 0) isGood = isGood && fwrite(buffer, 1, n, file) == (size_t)n;
+	if(fclose(file) != 0) isGood = false;
+	closeLocal(fd);
+	if(!isGood) std::cout << "Error writing file \"" << outputFile << "\" by function " << "'" << __FUNCTION__ << "'" << std::endl;
+	return isGood;
+}
+
+static void printUsage(char const* program){
+	std::cout << "Usage: " << program << " [options] <configuration file>" << std::endl;
+	std::cout << "  -t <seconds>       Wall clock budget for ray tracing, the image is resolved with the samples done so far." << std::endl;
+	std::cout << "  -preview <file>    Write a preview image after each sample pass." << std::endl;
+	std::cout << "  -report <file>     Write phase times, ray and photon counters and memory use as JSON at exit." << std::endl;
+	std::cout << "  -size <w> <h>      Image size in pixels, 1300 by 1300 by default." << std::endl;
+	std::cout << "  -stream            Render in bands of rows and write the PNG while rendering, for images larger than memory." << std::endl;
+	std::cout << "  -band <rows>       Rows per band of -stream, 128 by default." << std::endl;
+	std::cout << "  -o <file>          Output image, test.png by default." << std::endl;
+	std::cout << "  -checkpoint <file> Write the linear accumulation buffer after each sample pass." << std::endl;
+	std::cout << "  -resume <file>     Continue the render stored in a checkpoint." << std::endl;
+	std::cout << "  -passes <first> <n> Trace only n sample passes starting at first, to split samples across jobs." << std::endl;
+	std::cout << "  -wavefront         Trace batches of rays stage by stage instead of one sample at a time." << std::endl;
+	std::cout << "  -workers <n>       Split the frame over n worker processes and assemble their results." << std::endl;
+	std::cout << "  -launcher <cmd>    Prefix for launching a worker, e.g. \"srun -N1 -n1\" or \"ssh node%i\", %i is the worker index." << std::endl;
+	std::cout << "  -workdir <dir>     Directory shared by all workers for photon maps and partial renders, . by default." << std::endl;
+	std::cout << "  -trajectory        Render every snapshot of the file, -o is a pattern like frame%05d.png." << std::endl;
+	std::cout << "  -batch             Render every snapshot file given, images are named after them unless -o is a pattern." << std::endl;
+	std::cout << "  -compile <file>    Write the scene with its grid fully built and exit, the file can be given instead of a snapshot." << std::endl;
+	std::cout << "  -photon-interval <k> Re-emit the photon map every k frames of a trajectory, 0 keeps the first one, 1 by default." << std::endl;
+	std::cout << "  -lod <hull> <impostor> Polyhedra smaller on screen than hull pixels get a decimated model, below impostor pixels a sphere." << std::endl;
+	std::cout << "  -ao <rays> <distance> Quick look shading with ambient occlusion from rays of bounded length, no photon map." << std::endl;
+	std::cout << "  -raster            Rasterise the first hits of the camera rays, for scenes of polyhedra. Rays are traced from there on." << std::endl;
+	std::cout << "  -aov <prefix>      Write albedo, normal, depth and object ID of the first hits as prefix_*.pfm." << std::endl;
+	std::cout << "  -denoise <n>       Filter the image with n edge aware a-trous passes guided by the AOVs, e.g. 5 for 1 sample per pixel." << std::endl;
+	std::cout << "  -grid <density> <max> Size the grid's cells for density primitives each, at most max cells per axis. 5 128 by default." << std::endl;
+	std::cout << "  -grid auto         Pick the grid's density and cap with a cost model of the scene, the choice is printed for pinning." << std::endl;
+	std::cout << "  -heatmaps          Write the cycles, grid cells, primitive tests and photons per pixel as false colour images next to -o." << std::endl;
+	std::cout << "  -pin               Pin the threads to the NUMA nodes, spread in proportion to their CPUs." << std::endl;
+	std::cout << "  -numa <mode>       interleave spreads the scene's pages over the nodes, replicate also pins and copies the grid and photon map to each node." << std::endl;
+	std::cout << "  -hugepages         Back the grid and the photon map with transparent huge pages." << std::endl;
+	std::cout << "  -cull <margin>     Leave out particles farther than margin outside the camera's view." << std::endl;
+	std::cout << "  -clip <nx> <ny> <nz> <d> Leave out particles entirely beyond the plane n.p = d, p relative to the box center. Repeatable." << std::endl;
+	std::cout << "  -daemon <socket>   Keep the scenes given loaded and render jobs sent to the Unix socket, see -request." << std::endl;
+	std::cout << "  -request <socket> <command> Send a command to a daemon, a rendered image is written to -o. The commands are" << std::endl;
+	std::cout << "                     load <name> <file>, unload <name>, list, quit and render <name> <w> <h> [samples <n>]" << std::endl;
+	std::cout << "                     [crop <x> <y> <w> <h>] [camera <px> <py> <pz> <lx> <ly> <lz> <fov>], the crop from the top left." << std::endl;
+	std::cout << "Usage: " << program << " -merge <output checkpoint> <checkpoints...> [-o <file>]" << std::endl;
+}
+
+int main(int argc, char *argv[]){
+
+	char const* inputFile = NULL;
+	char const* previewFile = NULL;
+	char const* outputFile = "test.png";
+	bool isOutputSet = false;
+	bool isBatch = false;
+	std::vector<std::string> inputFiles;
+	char const* checkpointFile = NULL;
+	char const* resumeFile = NULL;
+	uint firstPass = 0, nPasses = 0;
+	double timeBudget = 0.0;
+	uint width = 1300, height = 1300;
+	bool isStreaming = false;
+	uint bandHeight = 128;
+	eIntegrator integrator = RECURSIVE;
+	uint nWorkers = 0;
+	int workerID = -1;
+	std::string launcher;
+	std::string workDir = ".";
+	bool isTrajectory = false;
+	char const* compileFile = NULL;
+	uint photonInterval = 1;
+	float lodPixels[2] = {0.0f, 0.0f};
+	float cullMargin = -1.0f;
+	uint nAORays = 0;
+	float aoDistance = 1.0f;
+	bool isRasterized = false;
+	char const* aovPrefix = NULL;
+	uint nDenoiseIterations = 0;
+	float gridDensity = GRID_DENSITY;
+	uint gridMaxResolution = GRID_MAX_RESOLUTION;
+	bool isHeatmapped = false;
+	bool isPinned = false;
+	std::string numaMode;
+	bool isHugePages = false;
+	std::vector<glm::vec4> clipPlanes;
+	char const* daemonSocket = NULL;
+	char const* requestSocket = NULL;
+	std::string requestCommand;
+	std::vector<std::string> forwardedArgs; //Options passed on to the workers
+	for(int i = 1; i < argc; i++){
+		std::string arg(argv[i]);
+		if(arg == "-t" && i + 1 < argc){
+			forwardedArgs.push_back(arg);
+			forwardedArgs.push_back(argv[i + 1]);
+			timeBudget = atof(argv[++i]);
+		}
+		else if(arg == "-preview" && i + 1 < argc) previewFile = argv[++i];
+		else if(arg == "-size" && i + 2 < argc){
+			forwardedArgs.insert(forwardedArgs.end(), argv + i, argv + i + 3);
+			width = atoi(argv[++i]);
+			height = atoi(argv[++i]);
+		}
+		else if(arg == "-stream") isStreaming = true;
+		else if(arg == "-report" && i + 1 < argc) statsReportAtExit(argv[++i]);
+		else if(arg == "-band" && i + 1 < argc) bandHeight = atoi(argv[++i]);
+		else if(arg == "-o" && i + 1 < argc){
+			outputFile = argv[++i];
+			isOutputSet = true;
+		}
+		else if(arg == "-checkpoint" && i + 1 < argc) checkpointFile = argv[++i];
+		else if(arg == "-resume" && i + 1 < argc) resumeFile = argv[++i];
+		else if(arg == "-passes" && i + 2 < argc){
+			forwardedArgs.insert(forwardedArgs.end(), argv + i, argv + i + 3);
+			firstPass = atoi(argv[++i]);
+			nPasses = atoi(argv[++i]);
+		}
+		else if(arg == "-merge" && i + 2 < argc){
+			char const* mergedFile = argv[++i];
+			std::vector<std::string> inputs;
+			for(i++; i < argc && std::string(argv[i]) != "-o"; i++) inputs.push_back(argv[i]);
+			if(i + 1 < argc) outputFile = argv[i + 1];
+			return mergeCheckpoints(inputs, mergedFile, outputFile)? 0: 1;
+		}
+		else if(arg == "-wavefront"){
+			forwardedArgs.push_back(arg);
+			integrator = WAVEFRONT;
+		}
+		else if(arg == "-workers" && i + 1 < argc) nWorkers = atoi(argv[++i]);
+		else if(arg == "-launcher" && i + 1 < argc) launcher = argv[++i];
+		else if(arg == "-workdir" && i + 1 < argc) workDir = argv[++i];
+		else if(arg == "-worker" && i + 2 < argc){
+			workerID = atoi(argv[++i]);
+			nWorkers = atoi(argv[++i]);
+		}
+		else if(arg == "-trajectory") isTrajectory = true;
+		else if(arg == "-batch") isBatch = true;
+		else if(arg == "-compile" && i + 1 < argc) compileFile = argv[++i];
+		else if(arg == "-photon-interval" && i + 1 < argc) photonInterval = atoi(argv[++i]);
+		else if(arg == "-lod" && i + 2 < argc){
+			forwardedArgs.insert(forwardedArgs.end(), argv + i, argv + i + 3);
+			lodPixels[0] = atof(argv[++i]);
+			lodPixels[1] = atof(argv[++i]);
+		}
+		else if(arg == "-ao" && i + 2 < argc){
+			forwardedArgs.insert(forwardedArgs.end(), argv + i, argv + i + 3);
+			nAORays = atoi(argv[++i]);
+			aoDistance = atof(argv[++i]);
+		}
+		else if(arg == "-raster"){
+			forwardedArgs.push_back(arg);
+			isRasterized = true;
+		}
+		else if(arg == "-aov" && i + 1 < argc) aovPrefix = argv[++i];
+		else if(arg == "-denoise" && i + 1 < argc) nDenoiseIterations = atoi(argv[++i]);
+		else if(arg == "-grid" && i + 1 < argc && std::string(argv[i + 1]) == "auto"){
+			forwardedArgs.insert(forwardedArgs.end(), argv + i, argv + i + 2);
+			gridDensity = 0.0f;
+			i++;
+		}
+		else if(arg == "-grid" && i + 2 < argc){
+			forwardedArgs.insert(forwardedArgs.end(), argv + i, argv + i + 3);
+			gridDensity = atof(argv[++i]);
+			gridMaxResolution = atoi(argv[++i]);
+			if(gridDensity <= 0.0f || gridMaxResolution == 0){
+				printUsage(argv[0]);
+				return 1;
+			}
+		}
+		else if(arg == "-heatmaps") isHeatmapped = true;
+		else if(arg == "-pin"){
+			forwardedArgs.push_back(arg);
+			isPinned = true;
+		}
+		else if(arg == "-numa" && i + 1 < argc){
+			forwardedArgs.insert(forwardedArgs.end(), argv + i, argv + i + 2);
+			numaMode = argv[++i];
+		}
+		else if(arg == "-hugepages"){
+			forwardedArgs.push_back(arg);
+			isHugePages = true;
+		}
+		else if(arg == "-cull" && i + 1 < argc){
+			forwardedArgs.insert(forwardedArgs.end(), argv + i, argv + i + 2);
+			cullMargin = atof(argv[++i]);
+		}
+		else if(arg == "-clip" && i + 4 < argc){
+			forwardedArgs.insert(forwardedArgs.end(), argv + i, argv + i + 5);
+			clipPlanes.push_back(glm::vec4(atof(argv[i + 1]), atof(argv[i + 2]), atof(argv[i + 3]), atof(argv[i + 4])));
+			i += 4;
+			//The plane is normalised by the length of its normal
+			if(glm::vec3(clipPlanes.back()) == glm::vec3(0.0f)){
+				printUsage(argv[0]);
+				return 1;
+			}
+		}
+		else if(arg == "-daemon" && i + 1 < argc) daemonSocket = argv[++i];
+		else if(arg == "-request" && i + 2 < argc){
+			requestSocket = argv[++i];
+			requestCommand = argv[++i];
+		}
+		else if(arg[0] == '-'){
+			printUsage(argv[0]);
+			return 1;
+		}
+		else{
+			inputFile = argv[i];
+			inputFiles.push_back(argv[i]);
+		}
+	}
+	if(requestSocket) return runRequest(requestSocket, requestCommand, outputFile)? 0: 1;
+	if(inputFile == NULL && !daemonSocket){
+		printUsage(argv[0]);
+		return 1;
+	}
+	if(isBatch) inputFile = inputFiles[0].c_str();
+	if((isTrajectory || isBatch) && (nWorkers > 0 || resumeFile || checkpointFile)){
+		std::cout << "Trajectories and batches are rendered by a single process without checkpoints." << std::endl;
+		return 1;
+	}
+	if(isStreaming && (isTrajectory || isBatch || nWorkers > 0 || resumeFile || checkpointFile || previewFile || timeBudget > 0.0)){
+		std::cout << "Streamed images are rendered once by a single process, without checkpoints, previews or a time budget." << std::endl;
+		return 1;
+	}
+	if(aovPrefix && (isStreaming || isTrajectory || isBatch || nWorkers > 0)){
+		std::cout << "AOVs are written for single images rendered by one process." << std::endl;
+		return 1;
+	}
+	if(isHeatmapped && (isStreaming || isTrajectory || isBatch || nWorkers > 0)){
+		std::cout << "Heatmaps are written for single images rendered by one process." << std::endl;
+		return 1;
+	}
+	if(isHeatmapped && integrator == WAVEFRONT){
+		std::cout << "The wavefront integrator traces rays of many pixels together, no heatmaps are written." << std::endl;
+		isHeatmapped = false;
+	}
+	if(nDenoiseIterations > 0 && nWorkers > 0){
+		std::cout << "The workers' samples are merged without AOVs, the image is not denoised." << std::endl;
+		nDenoiseIterations = 0;
+	}
+	if(!numaMode.empty() && numaMode != "interleave" && numaMode != "replicate"){
+		printUsage(argv[0]);
+		return 1;
+	}
+	if(width == 0 || height == 0 || bandHeight == 0){
+		printUsage(argv[0]);
+		return 1;
+	}
+	if(isTrajectory && isBatch){
+		std::cout << "A batch can not be rendered as a trajectory." << std::endl;
+		return 1;
+	}
+	if(daemonSocket && (nWorkers > 0 || isTrajectory || isBatch || resumeFile || checkpointFile || compileFile || aovPrefix || isHeatmapped)){
+		std::cout << "The daemon renders whole jobs in one process, without checkpoints, AOVs or heatmaps." << std::endl;
+		return 1;
+	}
+	if(nWorkers > 0 && workerID < 0){
+		return runCoordinator(argv[0], nWorkers, launcher, workDir, forwardedArgs, inputFile, outputFile)? 0: 1;
+	}
+	//Placement has to be settled before the scene is allocated
+	setHugePages(isHugePages);
+	if(isPinned || numaMode == "replicate"){
+		if(!pinThreads()) std::cout << "The threads could not be pinned, they run where the system puts them." << std::endl;
+	}
+	if(numaMode == "interleave") interleaveMemory(true);
+	if(daemonSocket){
+		DaemonOptions options;
+		options.nAORays = nAORays;
+		options.aoDistance = aoDistance;
+		options.isRasterized = isRasterized;
+		options.isReplicated = (numaMode == "replicate");
+		options.gridDensity = gridDensity;
+		options.gridMaxResolution = gridMaxResolution;
+		options.integrator = integrator;
+		options.timeBudget = timeBudget;
+		options.bandHeight = bandHeight;
+		return runDaemon(daemonSocket, inputFiles, options)? 0: 1;
+	}
+	std::string workerCheckpoint;
+	if(workerID >= 0){
+		workerCheckpoint = partFileName(workDir + "/part", workerID);
+		checkpointFile = workerCheckpoint.c_str();
+	}
 	
-	float box[9];
-	s.seekg(0);
-	s.clear();
-	s.str(line);
-	for(uint i = 0; i < 9; i++) s >> box[i];
+	Scene myScene;
+	
+	Material material0;
+	material0.color = colorRGBF(1.0f);
+	material0.reflectivity = 0.0f;
+	material0.diffusivity = 0.5f;
+	material0.Sv = 0.0f;
+	material0.Sp = 0.0f;
+	
+	std::vector<Material> mats = typeMaterials();
+	addLights(myScene);
+	
+	
+	Snapshot snapshot;
+	SnapshotReader reader;
+	CompiledScene compiled;
+	bool isCompiled = isCompiledScene(inputFile);
+	if(isCompiled){
+		if(isTrajectory || isBatch || compileFile){
+			std::cout << "Compiled scenes are rendered one at a time." << std::endl;
+			return 1;
+		}
+		if(!compiled.open(inputFile)) return 1;
+		std::cout << "Loading compiled scene " << inputFile << "." << std::endl;
+		compiled.instantiate(myScene);
+		std::copy(compiled.box(), compiled.box() + 9, snapshot.box);
+	}
+	else{
+		if(!reader.open(inputFile)) return 1;
+		std::cout << "Parsing " << inputFile << "." << std::endl;
+		if(!reader.next(snapshot)){
+			std::cout << "Error parsing file \"" << inputFile << "\" by function " << "'" << __FUNCTION__ << "'" << std::endl;
+			return 1;
+		}
+	}
 	
-	PinholeCamera camera(glm::vec3(0.0f, (box[4] + box[5]), 2.0f * box[8]), glm::vec3(0.0f, 4.0f, 0.0f), 60.0f, (float)width / height, 1.0f, width, height, 2);
+	std::map<std::string, int> typeIDs;
+	PinholeCamera camera = snapshotCamera(snapshot, width, height);
 	// myScene.addPlane(glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, -0.5f * (box[0] + box[1] + box[2]), 0.0f), material0);
 	// myScene.addPlane(glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -0.5f * box[8]), material0);
 	
-	glm::vec3 translation = glm::vec3(
-		-0.5f * (box[0] + box[1] + box[2]),
-		-0.5f * (box[4] + box[5]),
-		-0.5f * box[8]
-	);
-	
-	for(uint i = 0; i < nPart; i++){
-		std::getline(file, line);
-		std::istringstream ss(line);
-		uint typeID;
-		ss >> typeID;
-		glm::vec3 pos;
-		ss >> pos.x >> pos.y >> pos.z;
-		glm::vec4 rot;
-		ss >> rot.x >> rot.y >> rot.z >> rot.w;
-		myScene.addPolyhedron(typeIDs[typeID], pos + translation, mats[typeID], rot, typeScales[typeID]);
+	//Levels of detail depend on the camera, moving or compiled scenes keep the full models
+	bool isLOD = (lodPixels[0] > 0.0f || lodPixels[1] > 0.0f) && !isCompiled && !isTrajectory && !compileFile;
+	if(isLOD) myScene.setLOD(&camera, lodPixels[0], lodPixels[1]);
+	//So does culling, which would also leave the particles without their objects
+	bool isCulling = (cullMargin >= 0.0f || !clipPlanes.empty()) && !isCompiled && !isTrajectory && !compileFile;
+	if(isCulling){
+		if(cullMargin >= 0.0f) myScene.setCulling(&camera, cullMargin);
+		for(uint i = 0; i < clipPlanes.size(); i++) myScene.addClipPlane(glm::vec3(clipPlanes[i]), clipPlanes[i].w);
 	}
 	
+	glm::vec3 translation = -snapshot.center();
+	if(!isCompiled){
+		uint nCulled = addSnapshot(myScene, snapshot, typeIDs, mats);
+		if(isCulling) std::cout << "Culling: " << nCulled << " of " << snapshot.particles.size() << " particles left out." << std::endl;
+	}
+	if(isLOD){
+		std::cout << "Levels of detail: " << myScene.lodCount(LOD_FULL) << " full, " << myScene.lodCount(LOD_HULL) << " hulls, ";
+		std::cout << myScene.lodCount(LOD_IMPOSTOR) << " impostors." << std::endl;
+	}
 	
-	file.close();
+	if((isTrajectory || compileFile) && myScene.sphereSystem().size() > 0){
+		std::cout << "Sphere systems can not be rendered as trajectories or compiled." << std::endl;
+		return 1;
+	}
+	//Trajectories keep the file mapped for the following frames
+	if((isTrajectory || compileFile) && myScene.nObjects() != snapshot.particles.size()){
+		std::cout << "Every particle type of a trajectory or compiled scene needs a valid model." << std::endl;
+		return 1;
+	}
+	if(compileFile){
+		std::vector<CompiledInstance> instances(snapshot.particles.size());
+		for(uint i = 0; i < snapshot.particles.size(); i++){
+			SnapshotParticle const& particle = snapshot.particles[i];
+			instances[i].position = particle.position + translation;
+			instances[i].rotation = particle.rotation;
+			instances[i].scale = snapshot.typeScales[particle.type];
+		}
+		return compileScene(compileFile, myScene, instances, snapshot.box, gridDensity, gridMaxResolution)? 0: 1;
+	}
+	//A single image needs only the box from here on, large systems should not keep two copies of the particles
+	if(!isTrajectory && !isBatch) std::vector<SnapshotParticle>().swap(snapshot.particles);
 	
 	
 	
-	RayTracer raytracer(width, height);
+	RayTracer raytracer(width, isStreaming? std::min(bandHeight, height): height);
+	raytracer.setAmbientOcclusion(nAORays, aoDistance);
+	raytracer.setRasterization(isRasterized);
+	raytracer.setAOVs(aovPrefix != NULL);
+	raytracer.setDenoising(nDenoiseIterations);
+	raytracer.setReplication(numaMode == "replicate");
+	raytracer.setCostRecording(isHeatmapped);
+	raytracer.setGridResolution(gridDensity, gridMaxResolution);
 	
 	StartCounter();
-	raytracer.Init(&myScene);
-	std::cout << "Initialization: " << GetCounter() / 1000.0 << "s" << std::endl;
+	if(workerID >= 0){
+		raytracer.setTilePartition(workerID, nWorkers);
+		if(!raytracer.InitShared(&myScene, workDir + "/photons", workerID, nWorkers)) return 1;
+	}
+	else if(isCompiled) raytracer.Init(&myScene, compiled);
+	else{
+		raytracer.setRefittable(isTrajectory);
+		raytracer.Init(&myScene);
+	}
+	std::cout << "Initialization: " << GetCounter() / 1000.0 << "s, " << isaName(kernelISA()) << " kernels" << std::endl;
+	
+	FreeImage_Initialise();
+	
+	PassOutput passOutput;
+	passOutput.width = width;
+	passOutput.height = height;
+	passOutput.previewFile = previewFile;
+	passOutput.checkpointFile = checkpointFile;
+	if(previewFile || checkpointFile) raytracer.setPassCallback(savePass, &passOutput);
+	raytracer.setTimeBudget(timeBudget);
+	raytracer.setIntegrator(integrator);
+	raytracer.setPassRange(firstPass, nPasses);
+	if(resumeFile && !raytracer.loadCheckpoint(resumeFile)) return 1;
+	
+	//Batches parse the next snapshot while this one is traced
+	char const* batchPattern = isOutputSet? outputFile: NULL;
+	Snapshot nextSnapshot;
+	bool isNextParsed = false;
+	std::thread parser;
+	if(isBatch && inputFiles.size() > 1) parser = std::thread(prefetchSnapshot, inputFiles[1], &nextSnapshot, &isNextParsed);
 	
 	StartCounter();
-	raytracer.Trace(camera);
+	if(isStreaming){
+		PngStream png;
+		if(!png.open(outputFile, width, height) || !traceStreaming(raytracer, camera, width, height, bandHeight, png)) return 1;
+	}
+	else raytracer.Trace(camera);
 	std::cout << "Ray Tracing: " << GetCounter() / 1000.0 << "s" << std::endl;
+	std::cout << "Rays: " << statsTotal(COUNTER_RAYS) << std::endl;
 	
-	FreeImage_Initialise();
-	
-	FIBITMAP *bitmap = FreeImage_Allocate(width, height, 24);
-	const uchar* data = raytracer.readBuffer();
-	RGBQUAD color;
-	for(uint i = 0; i < width; i++){
-		for(uint j = 0; j < height; j++){
-			color.rgbRed = data[3*i + 3*width*j + 0];
-		    color.rgbGreen = data[3*i + 3*width*j + 1];
-		    color.rgbBlue = data[3*i + 3*width*j + 2];
-			FreeImage_SetPixelColor(bitmap, i, j, &color);
+	ImageWriter writer;
+	if(isBatch){
+		writer.write(raytracer.readBuffer(), width, height, batchFileName(inputFiles[0], batchPattern, 0));
+		for(uint i = 1; i < inputFiles.size(); i++){
+			parser.join();
+			if(!isNextParsed) return 1;
+			std::swap(snapshot, nextSnapshot);
+			if(i + 1 < inputFiles.size()) parser = std::thread(prefetchSnapshot, inputFiles[i + 1], &nextSnapshot, &isNextParsed);
+			
+			StartCounter();
+			camera = snapshotCamera(snapshot, width, height);
+			myScene.clearObjects();
+			addSnapshot(myScene, snapshot, typeIDs, mats);
+			raytracer.Init(&myScene);
+			raytracer.clearAccumulation();
+			std::cout << inputFiles[i] << ": initialization: " << GetCounter() / 1000.0 << "s" << std::endl;
+			
+			StartCounter();
+			raytracer.Trace(camera);
+			std::cout << "Ray Tracing: " << GetCounter() / 1000.0 << "s" << std::endl;
+			writer.write(raytracer.readBuffer(), width, height, batchFileName(inputFiles[i], batchPattern, i));
 		}
+		writer.wait();
 	}
 	
-	FreeImage_Save(FIF_PNG, bitmap, "test.png", 0);
+	//Workers only hand back their checkpoint
+	if(isTrajectory) saveImage(raytracer.readBuffer(), width, height, frameFileName(outputFile, 0).c_str());
+	else if(workerID < 0 && !isBatch && !isStreaming) saveImage(raytracer.readBuffer(), width, height, outputFile);
+	if(aovPrefix && !raytracer.readAOVs().save(aovPrefix)) return 1;
+	if(isHeatmapped) saveHeatmaps(raytracer.readCosts(), outputFile);
+	if(checkpointFile && !raytracer.saveCheckpoint(checkpointFile)) return 1;
+	
+	//Following frames only move particles, the grid is refitted around them
+	Snapshot frame;
+	for(uint frameID = 1; isTrajectory && reader.next(frame); frameID++){
+		if(frame.particles.size() != snapshot.particles.size()){
+			std::cout << "Frame " << frameID << " has " << frame.particles.size() << " particles instead of " << snapshot.particles.size() << "." << std::endl;
+			return 1;
+		}
+		StartCounter();
+		glm::vec3 frameTranslation = -frame.center();
+		std::vector<uint> movedObjects;
+		for(uint i = 0; i < frame.particles.size(); i++){
+			SnapshotParticle const& particle = frame.particles[i];
+			SnapshotParticle const& previous = snapshot.particles[i];
+			if(particle.position == previous.position && particle.rotation == previous.rotation && frameTranslation == translation) continue;
+			float scale = (particle.type < frame.typeScales.size())? frame.typeScales[particle.type]: snapshot.typeScales[particle.type];
+			myScene.moveObject(i, particle.position + frameTranslation, particle.rotation, scale);
+			movedObjects.push_back(i);
+		}
+		bool isPhotonMapStale = photonInterval > 0 && frameID % photonInterval == 0;
+		raytracer.Refit(movedObjects, isPhotonMapStale);
+		std::cout << "Frame " << frameID << ": " << movedObjects.size() << " particles moved, refit: " << GetCounter() / 1000.0 << "s" << std::endl;
+		
+		camera = snapshotCamera(frame, width, height);
+		raytracer.clearAccumulation();
+		StartCounter();
+		raytracer.Trace(camera);
+		std::cout << "Ray Tracing: " << GetCounter() / 1000.0 << "s" << std::endl;
+		saveImage(raytracer.readBuffer(), width, height, frameFileName(outputFile, frameID).c_str());
+		
+		std::swap(snapshot, frame);
+		translation = frameTranslation;
+	}
 	
 	FreeImage_DeInitialise();
 	
-	return 1;
+	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,76 @@
+#include "../include/mappedfile.h"
+#include <iostream>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(void):
+	mData(NULL), mSize(0)
+#ifdef _WIN32
+	, mFile(INVALID_HANDLE_VALUE), mMapping(NULL)
+#endif
+{}
+
+MappedFile::~MappedFile(void){
+	close();
+}
+
+bool MappedFile::open(char const* filename){
+	close();
+#ifdef _WIN32
+	mFile = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if(mFile == INVALID_HANDLE_VALUE){
+		std::cout << "Error opening file \"" << filename << "\" by function " << "'" << __FUNCTION__ << "'" << std::endl;
+		return false;
+	}
+	LARGE_INTEGER size;
+	GetFileSizeEx(mFile, &size);
+	mSize = (size_t)size.QuadPart;
+	if(mSize == 0) return true;
+	mMapping = CreateFileMappingA(mFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if(mMapping) mData = (char const*)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+#else
+	int fd = ::open(filename, O_RDONLY);
+	if(fd < 0){
+		std::cout << "Error opening file \"" << filename << "\" by function " << "'" << __FUNCTION__ << "'" << std::endl;
+		return false;
+	}
+	struct stat info;
+	if(fstat(fd, &info) == 0) mSize = (size_t)info.st_size;
+	if(mSize == 0){
+		::close(fd);
+		return true;
+	}
+	void *data = mmap(NULL, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd); //The mapping keeps the file alive
+	if(data != MAP_FAILED){
+		mData = (char const*)data;
+		madvise(data, mSize, MADV_SEQUENTIAL);
+	}
+#endif
+	if(mData == NULL){
+		std::cout << "Error mapping file \"" << filename << "\" by function " << "'" << __FUNCTION__ << "'" << std::endl;
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::close(void){
+#ifdef _WIN32
+	if(mData) UnmapViewOfFile(mData);
+	if(mMapping) CloseHandle(mMapping);
+	if(mFile != INVALID_HANDLE_VALUE) CloseHandle(mFile);
+	mMapping = NULL;
+	mFile = INVALID_HANDLE_VALUE;
+#else
+	if(mData) munmap((void*)mData, mSize);
+#endif
+	mData = NULL;
+	mSize = 0;
+}
@@ -63,7 +63,7 @@ Sphere::Sphere(glm::vec3 position, float radius, Material& material){
 }
 
 
-bool Sphere::intersect(Ray ray, float &t){
+bool Sphere::intersect(Ray ray, float &t, glm::vec3 *normal)const{
 	glm::vec3 direction = mPosition - ray.r0;
 	float B = glm::dot(ray.dir, direction);
 	float det = sqrf(B) - glm::dot(direction, direction) + sqrf(mRadius);
@@ -73,14 +73,13 @@ bool Sphere::intersect(Ray ray, float &t){
 	bool retValue = false;
 	if((t0 < t) && (t0 > 0.0001f)){
 		t = t0;
-		mIntersection = ray.r0 + t * ray.dir;
 		retValue = true;
 	}
 	if((t1 < t) && (t1 > 0.0001f)){
 		t = t1;
-		mIntersection = ray.r0 + t * ray.dir;
 		retValue = true;
 	}
+	if(retValue && normal) *normal = glm::normalize(ray.r0 + t * ray.dir - mPosition);
 	return retValue;
 }
 
@@ -92,7 +91,7 @@ Plane::Plane(glm::vec3 normal, glm::vec3 point, Material& material){
 	mAABB.setExtends(glm::vec3(-10000.0f), glm::vec3(10000.0f)); //Does not really matter
 }
 
-bool Plane::intersect(Ray ray, float &t){
+bool Plane::intersect(Ray ray, float &t, glm::vec3 *normal)const{
 	float denominator = glm::dot(mNormal, ray.dir);
 	if(fabs(denominator) < 0.0001f) return false;
 	float numerator = glm::dot(mNormal, (mPoint - ray.r0));
@@ -100,6 +99,7 @@ bool Plane::intersect(Ray ray, float &t){
 		float t1 = numerator / denominator;
 		if(t1 < t && t1 > 0.0001f){
 			t = t1;
+			if(normal) *normal = mNormal;
 			return true;
 		}
 	}
@@ -148,13 +148,37 @@ Triangle::Triangle(glm::vec3 *v0, glm::vec3 *v1, glm::vec3 *v2, Material& materi
 	mAABB.setExtends(min, max);
 }
 
+Triangle::Triangle(glm::vec3 *v0, glm::vec3 *v1, glm::vec3 *v2, glm::vec3 normal, AABB const& aabb, Material& material){
+	isAllocated = false;
+	mVertices[0] = v0;
+	mVertices[1] = v1;
+	mVertices[2] = v2;
+	mNormal = normal;
+	mMaterial = material;
+	mType = TRIANGLE;
+	mAABB = aabb;
+}
+
+void Triangle::update(void){
+	mNormal = glm::normalize(glm::cross(*mVertices[1] - *mVertices[0], *mVertices[2] - *mVertices[0]));
+	glm::vec3 min(10000.0f);
+	glm::vec3 max(-10000.0f);
+	for(uint i = 0; i < 3; i++){
+		for(uint j = 0; j < 3; j++){
+			if((*mVertices[i])[j] < min[j]) min[j] = (*mVertices[i])[j];
+			if((*mVertices[i])[j] > max[j]) max[j] = (*mVertices[i])[j];
+		}
+	}
+	mAABB.setExtends(min, max);
+}
+
 Triangle::~Triangle(void){
 	if(isAllocated){
 		for(uint i = 0; i < 3; i++) delete mVertices[i];
 	}
 }
 
-bool Triangle::intersect(Ray ray, float &t){
+bool Triangle::intersect(Ray ray, float &t, glm::vec3 *normal)const{
 	glm::vec3 AC = *mVertices[2] - *mVertices[0];
 	glm::vec3 AB = *mVertices[1] - *mVertices[0];
 	glm::vec3 P = glm::cross(ray.dir, AC);
@@ -170,6 +194,7 @@ bool Triangle::intersect(Ray ray, float &t){
 	float v = glm::dot(ray.dir, Q) * invDet;
 	if(v < 0.0f || u + v > 1.0f) return false;
 	t = t1;
+	if(normal) *normal = mNormal;
 	return true;
 }
 
@@ -244,6 +269,7 @@ bool Triangle::intersect(Ray ray, float &t){
 Polyhedron::Polyhedron(PolyhedronType const& polyType, glm::vec3 position, Material& material, glm::vec4 rotation, float scale){
 	mType = POLYHEDRON;
 	mMaterial = material;
+	mPolyType = &polyType;
 	
 	mVertices = polyType.mVertices;
 	std::vector<glm::vec3>::iterator vIter;
@@ -273,16 +299,200 @@ Polyhedron::Polyhedron(PolyhedronType const& polyType, glm::vec3 position, Mater
 	mAABB.setExtends(min, max);
 }
 
-bool Polyhedron::intersect(Ray ray, float &t){
-	bool retValue = false;
+Polyhedron::Polyhedron(PolyhedronType const& polyType, Material& material, glm::vec3 const* vertices, glm::vec3 const* normals, AABB const* triangleAABBs, AABB const& aabb){
+	mType = POLYHEDRON;
+	mMaterial = material;
+	mPolyType = &polyType;
+	mAABB = aabb;
+	
+	mVertices.assign(vertices, vertices + polyType.mVertices.size());
+	mNTriangles = polyType.mTrVertIndices.size();
+	mTriangles.reserve(mNTriangles);
+	for(uint i = 0; i < mNTriangles; i++){
+		glm::ivec3 const& indices = polyType.mTrVertIndices[i];
+		mTriangles.push_back(Triangle(&mVertices[indices.x], &mVertices[indices.y], &mVertices[indices.z], normals[i], triangleAABBs[i], mMaterial));
+	}
+}
+
+void Polyhedron::setTransform(glm::vec3 position, glm::vec4 rotation, float scale){
+	glm::vec3 axis = rotation.yzw();
+	glm::mat3 rotMatrix = glm::mat3(glm::rotate(glm::mat4(1.0), rotation.x, axis));
+	for(uint i = 0; i < mVertices.size(); i++){
+		mVertices[i] = rotMatrix * (scale * mPolyType->mVertices[i]) + position;
+	}
+	
+	glm::vec3 min(10000.0f);
+	glm::vec3 max(-10000.0f);
 	for(uint i = 0; i < mNTriangles; i++){
-		if(glm::dot(ray.dir, mTriangles[i].normal()) < 0.0f){
-			if(mTriangles[i].intersect(ray, t)){
+		mTriangles[i].update();
+		for(uint j = 0; j < 3; j++){
+			if(mTriangles[i].mAABB.bounds[0][j] < min[j]) min[j] = mTriangles[i].mAABB.bounds[0][j];
+			if(mTriangles[i].mAABB.bounds[1][j] > max[j]) max[j] = mTriangles[i].mAABB.bounds[1][j];
+		}
+	}
+	mAABB.setExtends(min, max);
+}
+
+bool Polyhedron::intersect(Ray ray, float &t, glm::vec3 *normal)const{
+	for(uint i = 0; i < mNTriangles; i++){
+		if(glm::dot(ray.dir, mTriangles[i].normal()) < 0.0f && mTriangles[i].intersect(ray, t, normal)) return true;
+	}
+	return false;
+}
+
+Spherocylinder::Spherocylinder(glm::vec3 position, glm::vec4 rotation, float radius, float length, Material& material){
+	mType = SPHEROCYLINDER;
+	mMaterial = material;
+	mRadius = radius;
+	mHalfLength = 0.5f * length;
+	setTransform(position, rotation);
+}
+
+void Spherocylinder::setTransform(glm::vec3 position, glm::vec4 rotation){
+	glm::vec3 axis = rotation.yzw();
+	glm::mat3 rotMatrix = glm::mat3(glm::rotate(glm::mat4(1.0), rotation.x, axis));
+	mPosition = position;
+	mAxis = rotMatrix * glm::vec3(0.0f, 0.0f, 1.0f);
+	glm::vec3 extent = glm::abs(mHalfLength * mAxis) + mRadius;
+	mAABB.setExtends(position - extent, position + extent);
+}
+
+bool Spherocylinder::intersect(Ray ray, float &t, glm::vec3 *normal)const{
+	bool retValue = false;
+	glm::vec3 relative = ray.r0 - mPosition;
+	float dirAxial = glm::dot(ray.dir, mAxis);
+	float relAxial = glm::dot(relative, mAxis);
+	//Cylinder, the roots at the radius from the axis that lie between the caps
+	glm::vec3 dirRadial = ray.dir - dirAxial * mAxis;
+	glm::vec3 relRadial = relative - relAxial * mAxis;
+	float A = glm::dot(dirRadial, dirRadial);
+	if(A > 1e-12f){
+		float B = glm::dot(dirRadial, relRadial);
+		float det = sqrf(B) - A * (glm::dot(relRadial, relRadial) - sqrf(mRadius));
+		if(det >= 0.0f){
+			float root = sqrt(det);
+			float roots[2] = {(-B - root) / A, (-B + root) / A};
+			for(uint i = 0; i < 2; i++){
+				if((roots[i] < t) && (roots[i] > 0.0001f) && (fabs(relAxial + roots[i] * dirAxial) <= mHalfLength)){
+					t = roots[i];
+					retValue = true;
+				}
+			}
+		}
+	}
+	//Caps, the roots on each sphere that lie beyond its end of the cylinder
+	for(int side = -1; side <= 1; side += 2){
+		glm::vec3 direction = mPosition + (side * mHalfLength) * mAxis - ray.r0;
+		float B = glm::dot(ray.dir, direction);
+		float det = sqrf(B) - glm::dot(direction, direction) + sqrf(mRadius);
+		if(det < 0.0f) continue;
+		float root = sqrt(det);
+		float roots[2] = {B - root, B + root};
+		for(uint i = 0; i < 2; i++){
+			if((roots[i] < t) && (roots[i] > 0.0001f) && (side * (relAxial + roots[i] * dirAxial) >= mHalfLength)){
+				t = roots[i];
 				retValue = true;
-				mIntersTriangle = i;
-				break;
 			}
 		}
 	}
+	if(retValue && normal) *normal = this->normal(ray.r0 + t * ray.dir);
 	return retValue;
-}
\ No newline at end of file
+}
+
+glm::vec3 Spherocylinder::normal(glm::vec3 const& point)const{
+	glm::vec3 relative = point - mPosition;
+	float axial = maxf(-mHalfLength, minf(glm::dot(relative, mAxis), mHalfLength));
+	return glm::normalize(relative - axial * mAxis);
+}
+
+#define SUPERELLIPSOID_MAX_STEPS 64
+
+Superellipsoid::Superellipsoid(glm::vec3 position, glm::vec4 rotation, glm::vec3 semiAxes, float exponent, Material& material){
+	mType = SUPERELLIPSOID;
+	mMaterial = material;
+	mSemiAxes = semiAxes;
+	mExponent = maxf(exponent, 1.0f);
+	setTransform(position, rotation);
+}
+
+void Superellipsoid::setTransform(glm::vec3 position, glm::vec4 rotation){
+	glm::vec3 axis = rotation.yzw();
+	mRotation = glm::mat3(glm::rotate(glm::mat4(1.0), rotation.x, axis));
+	mPosition = position;
+	//The extent along a world axis is the norm of the rotated semi axes with the dual exponent p / (p - 1)
+	glm::vec3 extent;
+	for(uint i = 0; i < 3; i++){
+		glm::vec3 projected = glm::abs(glm::vec3(mRotation[0][i], mRotation[1][i], mRotation[2][i]) * mSemiAxes);
+		if(mExponent < 1.001f) extent[i] = maxf(projected.x, maxf(projected.y, projected.z));
+		else{
+			float dual = mExponent / (mExponent - 1.0f);
+			extent[i] = pow(pow(projected.x, dual) + pow(projected.y, dual) + pow(projected.z, dual), 1.0f / dual);
+		}
+	}
+	mAABB.setExtends(position - extent, position + extent);
+}
+
+//The implicit function |x|^p + |y|^p + |z|^p - 1 at point, and its derivative along dir
+float Superellipsoid::implicit(glm::vec3 const& point, glm::vec3 const& dir, float &derivative)const{
+	float value = -1.0f;
+	derivative = 0.0f;
+	for(uint i = 0; i < 3; i++){
+		float coordinate = fabs(point[i]);
+		float power = pow(coordinate, mExponent - 1.0f);
+		value += power * coordinate;
+		derivative += mExponent * power * ((point[i] < 0.0f)? -dir[i]: dir[i]);
+	}
+	return value;
+}
+
+//The ray is taken to the frame of the unit shape, where t stays the same. Along the ray the implicit function
+//is convex, so Newton steps from the entry of a slightly larger bounding box approach the first root from the outside
+//without overshooting, and a step that no longer goes down means the ray misses. Rays starting inside step
+//back from the far end to the exit in the same way.
+bool Superellipsoid::intersect(Ray ray, float &t, glm::vec3 *normal)const{
+	glm::mat3 inverse = glm::transpose(mRotation);
+	glm::vec3 origin = (inverse * (ray.r0 - mPosition)) / mSemiAxes;
+	glm::vec3 dir = (inverse * ray.dir) / mSemiAxes;
+	float tNear = 0.0001f;
+	float tFar = t;
+	for(uint i = 0; i < 3; i++){
+		float invDir = 1.0f / dir[i];
+		float t1 = (-1.001f - origin[i]) * invDir;
+		float t2 = (1.001f - origin[i]) * invDir;
+		tNear = maxf(tNear, minf(t1, t2));
+		tFar = minf(tFar, maxf(t1, t2));
+	}
+	if(tNear > tFar) return false;
+	
+	float tolerance = 1e-5f * minf(mSemiAxes.x, minf(mSemiAxes.y, mSemiAxes.z));
+	float derivative;
+	float value = implicit(origin + tNear * dir, dir, derivative);
+	float tHit = tNear;
+	float direction = 1.0f;
+	if(value < 0.0f){
+		tHit = tFar;
+		direction = -1.0f;
+		value = implicit(origin + tFar * dir, dir, derivative);
+		if(value < 0.0f) return false; //The exit is beyond t
+	}
+	for(uint i = 0; value > 0.0f; i++){
+		if(direction * derivative >= 0.0f || i == SUPERELLIPSOID_MAX_STEPS) return false;
+		float step = value / derivative;
+		tHit -= step;
+		if(tHit < tNear || tHit > tFar) return false;
+		if(fabs(step) < tolerance) break;
+		value = implicit(origin + tHit * dir, dir, derivative);
+	}
+	t = tHit;
+	if(normal) *normal = this->normal(origin + tHit * dir);
+	return true;
+}
+
+glm::vec3 Superellipsoid::normal(glm::vec3 const& point)const{
+	glm::vec3 gradient;
+	for(uint i = 0; i < 3; i++){
+		float power = pow(fabs(point[i]), mExponent - 1.0f);
+		gradient[i] = (point[i] < 0.0f)? -power: power;
+	}
+	return glm::normalize(mRotation * (gradient / mSemiAxes));
+}
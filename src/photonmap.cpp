@@ -1,6 +1,10 @@
 #include "../include/photonmap.h"
+#include "../include/stats.h"
+#include "../include/affinity.h"
 #include <algorithm>
 #include <iostream>
+#include <cstdio>
+#include <string>
 
 typedef bool (*compFunc) (Photon, Photon);
 
@@ -32,7 +36,19 @@ void PhotonMap::kdClear(kdNode* node){
 	delete node;
 }
 
+void PhotonMap::clear(void){
+	if(mRoot != NULL) kdClear(mRoot);
+	mRoot = NULL;
+	mPhotons.clear();
+}
+
+size_t PhotonMap::memoryUsage(void)const{
+	size_t nNodes = mRoot? 2 * mPhotons.size() - 1: 0; //A leaf per photon
+	return mPhotons.capacity() * sizeof(Photon) + nNodes * sizeof(kdNode);
+}
+
 void PhotonMap::construct(void){
+	PhaseTimer timer(PHASE_KDTREE);
 	// Find Photon Map Extends
 	glm::vec3 min(10000.0f);
 	glm::vec3 max(-10000.0f);
@@ -47,9 +63,74 @@ void PhotonMap::construct(void){
 	min = min - 0.1f;
 	max = max + 0.1f;
 	mAABB.setExtends(min, max);
+	adviseHugePages(&mPhotons[0], mPhotons.size() * sizeof(Photon));
 	mRoot = balance(0, mPhotons.size() - 1);
 }
 
+void PhotonMap::replicate(PhotonMap const& other){
+	clear();
+	mPhotons = other.mPhotons;
+	mAABB = other.mAABB;
+	if(other.mRoot == NULL) return;
+	adviseHugePages(&mPhotons[0], mPhotons.size() * sizeof(Photon));
+	mRoot = kdCopy(other.mRoot, &other.mPhotons[0]);
+}
+
+PhotonMap::kdNode* PhotonMap::kdCopy(kdNode const* node, Photon const* otherPhotons){
+	kdNode* copy = new kdNode(*node);
+	if(node->isLeaf){
+		copy->photon = &mPhotons[0] + (node->photon - otherPhotons);
+		return copy;
+	}
+	copy->left = kdCopy(node->left, otherPhotons);
+	copy->right = kdCopy(node->right, otherPhotons);
+	return copy;
+}
+
+//Photons are stored raw after a small header, the files are only meant to be shared between processes of the same build
+bool PhotonMap::save(char const* filename)const{
+	std::string tempFile = std::string(filename) + ".tmp";
+	FILE *file = fopen(tempFile.c_str(), "wb");
+	if(!file){
+		std::cout << "Error writing file \"" << tempFile << "\" by function " << "'" << __FUNCTION__ << "'" << std::endl;
+		return false;
+	}
+	uint nPhotons = mPhotons.size();
+	fprintf(file, "RTPHOTONS %u %u\n", (uint)sizeof(Photon), nPhotons);
+	bool isGood = (nPhotons == 0 || fwrite(&mPhotons[0], sizeof(Photon), nPhotons, file) == nPhotons);
+	if(fclose(file) != 0) isGood = false;
+	//Rename so that readers waiting for the file never see it half written
+	if(!isGood || rename(tempFile.c_str(), filename) != 0){
+		std::cout << "Error writing file \"" << filename << "\" by function " << "'" << __FUNCTION__ << "'" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool PhotonMap::load(char const* filename){
+	FILE *file = fopen(filename, "rb");
+	if(!file){
+		std::cout << "Error parsing file \"" << filename << "\" by function " << "'" << __FUNCTION__ << "'" << std::endl;
+		return false;
+	}
+	uint photonSize, nPhotons;
+	if(fscanf(file, "RTPHOTONS %u %u", &photonSize, &nPhotons) != 2 || fgetc(file) != '\n' || photonSize != sizeof(Photon)){
+		std::cout << "File \"" << filename << "\" is not a photon map of this build." << std::endl;
+		fclose(file);
+		return false;
+	}
+	uint offset = mPhotons.size();
+	mPhotons.resize(offset + nPhotons);
+	bool isGood = (nPhotons == 0 || fread(&mPhotons[offset], sizeof(Photon), nPhotons, file) == nPhotons);
+	fclose(file);
+	if(!isGood){
+		std::cout << "Photon map \"" << filename << "\" is truncated." << std::endl;
+		mPhotons.resize(offset);
+		return false;
+	}
+	return true;
+}
+
 PhotonMap::kdNode* PhotonMap::balance(uint start, uint end){
 	kdNode* node = new kdNode();
 	if(start == end){
@@ -91,29 +172,5 @@ PhotonMap::kdNode* PhotonMap::balance(uint start, uint end){
 
 
 std::vector<Photon const*> PhotonMap::locate(glm::vec3 position, float radius)const{
-	std::vector<Photon const*> retPhotons;
-	recLocate(mRoot, retPhotons, position, radius);
-	return retPhotons;
+	ISA_DISPATCH(locateISA, (position, radius))
 }
-
-void PhotonMap::recLocate(kdNode* node, std::vector<Photon const*> &retPhotons, glm::vec3 position, float radius)const{
-	if(node->isLeaf){
-		Photon const* photon = node->photon;
-		glm::vec3 distance = photon->p - position;
-		if(glm::length(distance) < radius) retPhotons.push_back(photon);
-		return;
-	}
-	float dl, dr;
-	uchar axis = node->splitAxis;
-	dl = position[axis] - radius;
-	dr = position[axis] + radius;
-	
-	float splitPos = node->splitPosition;
-	
-	if(dl < splitPos){
-		recLocate(node->left, retPhotons, position, radius);
-	}
-	if(dr > splitPos){
-		recLocate(node->right, retPhotons, position, radius);
-	}
-}
\ No newline at end of file
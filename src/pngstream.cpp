@@ -0,0 +1,180 @@
+#include "../include/pngstream.h"
+#include "../include/stats.h"
+#include <zlib.h>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+
+#define CHUNK_BYTES (1 << 20) //Unfiltered bytes deflated together, smaller chunks compress worse
+
+static void putBigEndian(uchar *out, uint value){
+	out[0] = uchar(value >> 24);
+	out[1] = uchar(value >> 16);
+	out[2] = uchar(value >> 8);
+	out[3] = uchar(value);
+}
+
+static inline uchar paeth(int a, int b, int c){
+	int p = a + b - c;
+	int pa = abs(p - a);
+	int pb = abs(p - b);
+	int pc = abs(p - c);
+	if(pa <= pb && pa <= pc) return uchar(a);
+	if(pb <= pc) return uchar(b);
+	return uchar(c);
+}
+
+//Filters a row with each of the five PNG filters and keeps the one with the smallest sum of absolute
+//differences, the heuristic libpng uses. out receives the filter type followed by the filtered bytes.
+static void filterRow(uchar const* row, uchar const* prev, uint rowBytes, uchar *out, uchar *scratch){
+	static const uint bpp = 3;
+	unsigned long bestSum = (unsigned long)-1;
+	for(uint type = 0; type < 5; type++){
+		unsigned long sum = 0;
+		for(uint i = 0; i < rowBytes; i++){
+			int left = (i >= bpp)? row[i - bpp]: 0;
+			int up = prev[i];
+			int upLeft = (i >= bpp)? prev[i - bpp]: 0;
+			uchar predictor = 0;
+			if(type == 1) predictor = uchar(left);
+			else if(type == 2) predictor = uchar(up);
+			else if(type == 3) predictor = uchar((left + up) / 2);
+			else if(type == 4) predictor = paeth(left, up, upLeft);
+			uchar value = uchar(row[i] - predictor);
+			scratch[i] = value;
+			sum += (value < 128)? value: 256 - value;
+		}
+		if(sum < bestSum){
+			bestSum = sum;
+			out[0] = uchar(type);
+			memcpy(out + 1, scratch, rowBytes);
+		}
+	}
+}
+
+PngStream::PngStream(void): mFile(NULL), mWidth(0), mHeight(0), mRowsWritten(0), mAdler(1){}
+
+PngStream::~PngStream(void){
+	if(mFile) fclose(mFile);
+}
+
+bool PngStream::writeChunk(char const* type, uchar const* data, size_t size){
+	uchar header[8];
+	putBigEndian(header, (uint)size);
+	memcpy(header + 4, type, 4);
+	uLong crc = crc32(0L, header + 4, 4);
+	if(size > 0) crc = crc32(crc, data, (uInt)size);
+	uchar trailer[4];
+	putBigEndian(trailer, (uint)crc);
+	return fwrite(header, 1, 8, mFile) == 8 && (size == 0 || fwrite(data, 1, size, mFile) == size) && fwrite(trailer, 1, 4, mFile) == 4;
+}
+
+bool PngStream::open(char const* filename, uint width, uint height){
+	FILE *file = fopen(filename, "wb");
+	if(!file){
+		std::cout << "Error writing file \"" << filename << "\" by function " << "'" << __FUNCTION__ << "'" << std::endl;
+		return false;
+	}
+	return open(file, filename, width, height);
+}
+
+bool PngStream::open(FILE *file, char const* filename, uint width, uint height){
+	mFilename = filename;
+	mFile = file;
+	mWidth = width;
+	mHeight = height;
+	mRowsWritten = 0;
+	mAdler = adler32(0L, NULL, 0);
+	mPrevRow.assign((size_t)3 * width, 0);
+	
+	static const uchar signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+	uchar ihdr[13];
+	putBigEndian(ihdr, width);
+	putBigEndian(ihdr + 4, height);
+	ihdr[8] = 8; //Bit depth
+	ihdr[9] = 2; //Truecolor
+	ihdr[10] = ihdr[11] = ihdr[12] = 0; //Deflate, adaptive filtering, no interlace
+	static const uchar zlibHeader[2] = {0x78, 0x9C};
+	bool isGood = fwrite(signature, 1, 8, mFile) == 8 && writeChunk("IHDR", ihdr, 13) && writeChunk("IDAT", zlibHeader, 2);
+	if(!isGood) std::cout << "Error writing file \"" << filename << "\" by function " << "'" << __FUNCTION__ << "'" << std::endl;
+	return isGood;
+}
+
+bool PngStream::writeRows(uchar const* rows, uint nRows, ptrdiff_t rowStride){
+	PhaseTimer timer(PHASE_ENCODE);
+	if(mRowsWritten + nRows > mHeight){
+		std::cout << "More rows than the height of " << mFilename << "." << std::endl;
+		return false;
+	}
+	size_t rowBytes = (size_t)3 * mWidth;
+	uint rowsPerChunk = (uint)(CHUNK_BYTES / rowBytes);
+	if(rowsPerChunk == 0) rowsPerChunk = 1;
+	int nChunks = (nRows + rowsPerChunk - 1) / rowsPerChunk;
+	std::vector<std::vector<uchar> > compressed(nChunks);
+	std::vector<unsigned long> adlers(nChunks);
+	std::vector<size_t> filteredSizes(nChunks);
+	bool isGood = true;
+	
+	#pragma omp parallel for schedule(dynamic)
+	for(int c = 0; c < nChunks; c++){
+		uint first = c * rowsPerChunk;
+		uint last = (first + rowsPerChunk < nRows)? first + rowsPerChunk: nRows;
+		std::vector<uchar> filtered((last - first) * (rowBytes + 1));
+		std::vector<uchar> scratch(rowBytes);
+		for(uint j = first; j < last; j++){
+			uchar const* row = rows + (ptrdiff_t)j * rowStride;
+			uchar const* prev = (j == 0)? &mPrevRow[0]: row - rowStride;
+			filterRow(row, prev, rowBytes, &filtered[(j - first) * (rowBytes + 1)], &scratch[0]);
+		}
+		filteredSizes[c] = filtered.size();
+		adlers[c] = adler32(adler32(0L, NULL, 0), &filtered[0], (uInt)filtered.size());
+		
+		//Raw deflate, the zlib header and trailer are written once for the whole image
+		z_stream stream;
+		memset(&stream, 0, sizeof(stream));
+		bool isChunkGood = deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+		if(isChunkGood){
+			std::vector<uchar> &out = compressed[c];
+			out.resize(deflateBound(&stream, filtered.size()) + 16);
+			stream.next_in = &filtered[0];
+			stream.avail_in = (uInt)filtered.size();
+			stream.next_out = &out[0];
+			stream.avail_out = (uInt)out.size();
+			isChunkGood = deflate(&stream, Z_SYNC_FLUSH) == Z_OK && stream.avail_in == 0;
+			out.resize(stream.total_out);
+			deflateEnd(&stream);
+		}
+		if(!isChunkGood){
+			#pragma omp atomic write
+			isGood = false;
+		}
+	}
+	if(!isGood){
+		std::cout << "Error compressing rows of " << mFilename << "." << std::endl;
+		return false;
+	}
+	
+	for(int c = 0; c < nChunks && isGood; c++){
+		mAdler = adler32_combine(mAdler, adlers[c], (z_off_t)filteredSizes[c]);
+		isGood = writeChunk("IDAT", &compressed[c][0], compressed[c].size());
+	}
+	if(nRows > 0) memcpy(&mPrevRow[0], rows + (ptrdiff_t)(nRows - 1) * rowStride, rowBytes);
+	mRowsWritten += nRows;
+	if(!isGood) std::cout << "Error writing file \"" << mFilename << "\" by function " << "'" << __FUNCTION__ << "'" << std::endl;
+	return isGood;
+}
+
+bool PngStream::close(void){
+	if(!mFile) return false;
+	PhaseTimer timer(PHASE_ENCODE);
+	bool isGood = (mRowsWritten == mHeight);
+	if(!isGood) std::cout << "Only " << mRowsWritten << " of " << mHeight << " rows were written to " << mFilename << "." << std::endl;
+	//An empty final block ends the deflate stream, followed by the checksum of the uncompressed data
+	uchar tail[6] = {0x03, 0x00};
+	putBigEndian(tail + 2, (uint)mAdler);
+	isGood = isGood && writeChunk("IDAT", tail, 6) && writeChunk("IEND", NULL, 0);
+	if(fclose(mFile) != 0) isGood = false;
+	mFile = NULL;
+	if(!isGood) std::cout << "Error writing file \"" << mFilename << "\" by function " << "'" << __FUNCTION__ << "'" << std::endl;
+	return isGood;
+}
@@ -0,0 +1,196 @@
+#include "../include/raster.h"
+#include <omp.h>
+#include <cmath>
+#include <algorithm>
+
+#define RASTER_TILE_SIZE 32
+//Samples this many pixels outside of a triangle still count as covered. Rounding must not open cracks between
+//triangles that share an edge, a ray that then misses the triangle is traced instead.
+#define RASTER_EPSILON 1e-3f
+
+bool Rasterizer::isRasterizable(Scene const& scene){
+	if(scene.sphereSystem().size() > 0) return false;
+	for(uint i = 0; i < scene.nObjects(); i++){
+		eObjectType type = scene.object(i)->mType;
+		if(type != POLYHEDRON && type != TRIANGLE) return false;
+	}
+	return true;
+}
+
+Triangle *Rasterizer::triangle(Scene const& scene, uint objectID, uint triangleID){
+	Object *object = scene.object(objectID);
+	if(object->mType == POLYHEDRON) return static_cast<Polyhedron*>(object)->triangle(triangleID);
+	return static_cast<Triangle*>(object);
+}
+
+//Projects the vertices of an object, the triangles of a polyhedron share them. The number of triangles is returned.
+static uint projectObject(CameraBase const& camera, Object *object, std::vector<glm::vec3> &screen, std::vector<uchar> &isInFront){
+	if(object->mType == POLYHEDRON){
+		Polyhedron *polyhedron = static_cast<Polyhedron*>(object);
+		glm::vec3 const* vertices = polyhedron->vertices();
+		uint nVertices = polyhedron->polyType()->mVertices.size();
+		screen.resize(nVertices);
+		isInFront.resize(nVertices);
+		for(uint i = 0; i < nVertices; i++) isInFront[i] = camera.project(vertices[i], screen[i]);
+		return polyhedron->nTriangles();
+	}
+	screen.resize(3);
+	isInFront.resize(3);
+	Triangle *triangle = static_cast<Triangle*>(object);
+	for(uint i = 0; i < 3; i++) isInFront[i] = camera.project(triangle->vertex(i), screen[i]);
+	return 1;
+}
+
+static inline glm::ivec3 vertexIndices(Object *object, uint triangleID){
+	if(object->mType == POLYHEDRON) return static_cast<Polyhedron*>(object)->polyType()->mTrVertIndices[triangleID];
+	return glm::ivec3(0, 1, 2);
+}
+
+//Counter clockwise on screen is front facing, the same side the ray triangle test accepts
+static inline bool isFrontFacing(glm::vec3 const* screen){
+	float area = (screen[1].x - screen[0].x) * (screen[2].y - screen[0].y) - (screen[1].y - screen[0].y) * (screen[2].x - screen[0].x);
+	return (area > 0.0f);
+}
+
+//Pixels x0, y0, x1, y1 of the buffer whose samples can lie in the bounding box of the triangle, the last ones
+//inclusive. The sample offsets within the pixels range from minOffset to maxOffset.
+static inline bool sampleBounds(glm::vec3 const* screen, glm::vec2 const& minOffset, glm::vec2 const& maxOffset, uint firstRow, uint width, uint height, uint *bounds){
+	glm::vec3 minimum = glm::min(glm::min(screen[0], screen[1]), screen[2]);
+	glm::vec3 maximum = glm::max(glm::max(screen[0], screen[1]), screen[2]);
+	float x0 = ceil(minimum.x - maxOffset.x - RASTER_EPSILON);
+	float x1 = floor(maximum.x - minOffset.x + RASTER_EPSILON);
+	float y0 = ceil(minimum.y - maxOffset.y - RASTER_EPSILON) - firstRow;
+	float y1 = floor(maximum.y - minOffset.y + RASTER_EPSILON) - firstRow;
+	if(x0 < 0.0f) x0 = 0.0f;
+	if(y0 < 0.0f) y0 = 0.0f;
+	if(x1 > width - 1.0f) x1 = width - 1.0f;
+	if(y1 > height - 1.0f) y1 = height - 1.0f;
+	if(x0 > x1 || y0 > y1) return false;
+	bounds[0] = (uint)x0;
+	bounds[1] = (uint)y0;
+	bounds[2] = (uint)x1;
+	bounds[3] = (uint)y1;
+	return true;
+}
+
+bool Rasterizer::bin(Scene const& scene, CameraBase const& camera, uint width, uint firstRow, uint height){
+	mWidth = width;
+	mHeight = height;
+	mFirstRow = firstRow;
+	mNTilesX = (width + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+	mNTilesY = (height + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+	uint nTiles = mNTilesX * mNTilesY;
+	mNThreads = omp_get_max_threads();
+	mBins.resize((size_t)mNThreads * nTiles);
+	for(size_t i = 0; i < mBins.size(); i++) mBins[i].clear();
+
+	//Each triangle goes to the tiles its bounding box of samples overlaps for any of the sample offsets
+	bool isBehind = false;
+	uint nObjects = scene.nObjects();
+	#pragma omp parallel
+	{
+		std::vector<TriangleRef> *bins = &mBins[(size_t)omp_get_thread_num() * nTiles];
+		std::vector<glm::vec3> screen;
+		std::vector<uchar> isInFront;
+		#pragma omp for schedule(dynamic, 64)
+		for(int i = 0; i < (int)nObjects; i++){
+			Object *object = scene.object(i);
+			uint nTriangles = projectObject(camera, object, screen, isInFront);
+			for(uint k = 0; k < nTriangles; k++){
+				glm::ivec3 indices = vertexIndices(object, k);
+				uint nInFront = isInFront[indices.x] + isInFront[indices.y] + isInFront[indices.z];
+				if(nInFront == 0) continue; //No camera ray reaches it
+				if(nInFront < 3){
+					#pragma omp atomic write
+					isBehind = true;
+					continue;
+				}
+				glm::vec3 triangle[3] = {screen[indices.x], screen[indices.y], screen[indices.z]};
+				if(!isFrontFacing(triangle)) continue;
+				uint bounds[4];
+				if(!sampleBounds(triangle, glm::vec2(0.0f), glm::vec2(1.0f), firstRow, width, height, bounds)) continue; //Covers no sample
+				TriangleRef ref = {(uint)i, k};
+				for(uint ty = bounds[1] / RASTER_TILE_SIZE; ty <= bounds[3] / RASTER_TILE_SIZE; ty++){
+					for(uint tx = bounds[0] / RASTER_TILE_SIZE; tx <= bounds[2] / RASTER_TILE_SIZE; tx++) bins[tx + ty * mNTilesX].push_back(ref);
+				}
+			}
+		}
+	}
+	return !isBehind;
+}
+
+void Rasterizer::render(Scene const& scene, CameraBase const& camera, uint sample){
+	Fragment background = {NO_FRAGMENT, 0, 0.0f};
+	mFragments.assign((size_t)mWidth * mHeight, background);
+	glm::vec2 offset = camera.sampleOffset(sample);
+	uint nTiles = mNTilesX * mNTilesY;
+	//Each tile is filled by one thread from the bins of all threads
+	#pragma omp parallel for schedule(dynamic, 1)
+	for(int tileID = 0; tileID < (int)nTiles; tileID++){
+		uint tile[4];
+		tile[0] = (tileID % mNTilesX) * RASTER_TILE_SIZE;
+		tile[1] = (tileID / mNTilesX) * RASTER_TILE_SIZE;
+		tile[2] = std::min(tile[0] + RASTER_TILE_SIZE, mWidth) - 1;
+		tile[3] = std::min(tile[1] + RASTER_TILE_SIZE, mHeight) - 1;
+		for(uint t = 0; t < mNThreads; t++){
+			std::vector<TriangleRef> const& bin = mBins[(size_t)t * nTiles + tileID];
+			for(uint i = 0; i < bin.size(); i++){
+				Triangle const* tri = triangle(scene, bin[i].objectID, bin[i].triangleID);
+				glm::vec3 screen[3];
+				for(uint v = 0; v < 3; v++) camera.project(tri->vertex(v), screen[v]);
+				uint bounds[4];
+				if(!sampleBounds(screen, offset, offset, mFirstRow, mWidth, mHeight, bounds)) continue;
+				bounds[0] = std::max(bounds[0], tile[0]);
+				bounds[1] = std::max(bounds[1], tile[1]);
+				bounds[2] = std::min(bounds[2], tile[2]);
+				bounds[3] = std::min(bounds[3], tile[3]);
+				if(bounds[0] > bounds[2] || bounds[1] > bounds[3]) continue;
+				rasterize(bin[i], screen, offset, bounds);
+			}
+		}
+	}
+}
+
+//Tests the samples of the pixels in bounds against the edge functions of the triangle. The depth key is
+//interpolated from the vertices with the normalised edge functions as barycentric coordinates.
+void Rasterizer::rasterize(TriangleRef const& ref, glm::vec3 const* screen, glm::vec2 const& offset, uint const* bounds){
+	float A[3], B[3], tolerance[3];
+	for(uint e = 0; e < 3; e++){
+		glm::vec3 const& a = screen[(e + 1) % 3];
+		glm::vec3 const& b = screen[(e + 2) % 3];
+		A[e] = a.y - b.y;
+		B[e] = b.x - a.x;
+		tolerance[e] = -RASTER_EPSILON * sqrt(A[e] * A[e] + B[e] * B[e]);
+	}
+	float invArea = 1.0f / (A[0] * (screen[0].x - screen[1].x) + B[0] * (screen[0].y - screen[1].y)); //Edge function 0 at vertex 0
+	for(uint y = bounds[1]; y <= bounds[3]; y++){
+		float py = (float)(mFirstRow + y) + offset.y;
+		for(uint x = bounds[0]; x <= bounds[2]; x++){
+			float px = (float)x + offset.x;
+			//Edge e is opposite of vertex e and its function is zero there
+			float E[3];
+			bool isInside = true;
+			for(uint e = 0; e < 3; e++){
+				glm::vec3 const& a = screen[(e + 1) % 3];
+				E[e] = A[e] * (px - a.x) + B[e] * (py - a.y);
+				if(E[e] < tolerance[e]){
+					isInside = false;
+					break;
+				}
+			}
+			if(!isInside) continue;
+			float depth = (E[0] * screen[0].z + E[1] * screen[1].z + E[2] * screen[2].z) * invArea;
+			Fragment &fragment = mFragments[x + (size_t)y * mWidth];
+			if(fragment.objectID != NO_FRAGMENT && depth <= fragment.depth) continue;
+			fragment.objectID = ref.objectID;
+			fragment.triangleID = ref.triangleID;
+			fragment.depth = depth;
+		}
+	}
+}
+
+size_t Rasterizer::memoryUsage(void)const{
+	size_t bytes = mFragments.capacity() * sizeof(Fragment) + mBins.capacity() * sizeof(std::vector<TriangleRef>);
+	for(size_t i = 0; i < mBins.size(); i++) bytes += mBins[i].capacity() * sizeof(TriangleRef);
+	return bytes;
+}
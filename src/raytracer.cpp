@@ -1,38 +1,81 @@
 #include "../include/raytracer.h"
+#include "../include/distributed.h"
+#include "../include/stats.h"
+#include "../include/affinity.h"
 #include <iostream>
+#include <cstring>
 #include <boost/random/uniform_int_distribution.hpp>
 #include <boost/random/uniform_01.hpp>
 
-RayTracer::RayTracer(uint width, uint height): mWidth(width), mHeight(height){
-	mDepth = 3;
+RayTracer::RayTracer(uint width, uint height):
+	mWidth(width), mHeight(height),
+	mNAORays(0), mAODistance(1.0f),
+	mIntegrator(RECURSIVE), mWavefrontSize(16384), mIsRefittable(false), mIsRasterized(false),
+	mIsAOVRecorded(false), mNDenoiseIterations(0), mIsReplicated(false), mIsCostRecorded(false),
+	mTilePart(0), mNTileParts(1), mSharedTimeout(3600.0),
+	mFirstPass(0), mNPasses(0), mFirstRow(0), mNRows(height),
+	mTimeBudget(0.0), mPassCallback(NULL), mPassCallbackData(NULL),
+	mAccum(width, height)
+{
 	mPhotonDepth = 6;
 	mNPhotons = 1000000;
-	mBuffer = new uchar[3*width*height]();
+	mPhotonCount = 0;
+	mTileSize = 32;
+	mBuffer = new uchar[(size_t)3*width*height]();
 	randGen_.seed(0);
 }
 
 RayTracer::~RayTracer(void){
 	delete[] mBuffer;
+	clearReplicas();
 }
 
 float RayTracer::mtRandf(float x, bool isSymmetric)const{
-	static boost::random::uniform_01<boost::mt19937, float> mtUniReal(randGen_);
-	return isSymmetric? x * (2.0f * mtUniReal() - 1.0f) : x * mtUniReal();
+	boost::random::uniform_01<float> mtUniReal;
+	return isSymmetric? x * (2.0f * mtUniReal(randGen_) - 1.0f) : x * mtUniReal(randGen_);
 }
 
 int RayTracer::mtRandi(int x){
-	static boost::random::uniform_int_distribution<> mtUniInt(0);
+	boost::random::uniform_int_distribution<> mtUniInt(0);
 	return mtUniInt(randGen_) % x;
 }
 
-glm::vec3 RayTracer::mtRandSphere(void)const{
-	float x1 = mtRandf(1.0f, true);
-	float x2 = mtRandf(1.0f, true);
+//Random numbers in [-1, 1) hashed from a position, for sampling during the parallel trace where the photon
+//generator can not be shared. The same hit gets the same numbers whichever thread traces it.
+struct HashRandom{
+	HashRandom(glm::vec3 const& position){
+		uint bits[3];
+		memcpy(bits, &position.x, sizeof(uint));
+		memcpy(bits + 1, &position.y, sizeof(uint));
+		memcpy(bits + 2, &position.z, sizeof(uint));
+		state = bits[0];
+		state = next() ^ bits[1];
+		state = next() ^ bits[2];
+	}
+	//SplitMix64
+	unsigned long long next(void){
+		state += 0x9E3779B97F4A7C15ull;
+		unsigned long long z = state;
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		return z ^ (z >> 31);
+	}
+	float operator()(void){
+		return (next() >> 40) * (2.0f / 16777216.0f) - 1.0f;
+	}
+	unsigned long long state;
+};
+
+//Marsaglia's method, uniform() returns numbers in [-1, 1]
+template<class Uniform>
+static glm::vec3 randSphere(Uniform &uniform){
+	float x1 = uniform();
+	float x2 = uniform();
 	float s = x1 * x1 + x2 * x2;
 	while(s > 1.0f){
-		x1 = mtRandf(1.0f, true);
-		x2 = mtRandf(1.0f, true);	
-		s = x1 * x1 + x2 * x2;	
+		x1 = uniform();
+		x2 = uniform();
+		s = x1 * x1 + x2 * x2;
 	}
 	float z = 1.0f - 2.0f * s;
 	s = sqrt(1.0f - s);
@@ -41,16 +84,27 @@ glm::vec3 RayTracer::mtRandSphere(void)const{
 	return glm::vec3(x, y, z);
 }
 
-glm::vec3 RayTracer::mtRandCosine(glm::vec3 dir)const{
-	glm::vec3 w = mtRandSphere() + dir;
+template<class Uniform>
+static glm::vec3 randCosine(glm::vec3 const& dir, Uniform &uniform){
+	glm::vec3 w = randSphere(uniform) + dir;
 	float a = glm::length(w);
 	while(a < 0.0001f){
-		w = mtRandSphere() + dir;
+		w = randSphere(uniform) + dir;
 		a = glm::length(w);
 	}
 	return w / a;
 }
 
+glm::vec3 RayTracer::mtRandSphere(void)const{
+	auto uniform = [this](){ return mtRandf(1.0f, true); };
+	return randSphere(uniform);
+}
+
+glm::vec3 RayTracer::mtRandCosine(glm::vec3 dir)const{
+	auto uniform = [this](){ return mtRandf(1.0f, true); };
+	return randCosine(dir, uniform);
+}
+
 glm::vec3 RayTracer::mtRandCone(float mincos)const{
 	float phi = mtRandf(2.0f * M_PI, false);
 	float z = mtRandf(1.0f - mincos, false);
@@ -69,21 +123,46 @@ static inline glm::vec3 reflect(glm::vec3 I, glm::vec3 N){
 	return glm::normalize(I - 2.0f * glm::dot(N, I) * N);
 }
 
-static inline float minf(float a, float b){
-	if(a < b) return a;
-	else return b;
-}
-
 static inline float maxf(float a, float b){
 	if(a > b) return a;
 	else return b;
 }
 
-static uint photonCount = 0;
-void RayTracer::genPhotonMap(void){
+bool RayTracer::intersect(Ray const& ray, float &t, uint &objectID, glm::vec3 &normal)const{
+	bool isHit = (mNObjects > 0) && grid().intersect(ray, t, objectID, normal);
+	uint sphereID;
+	if(mScene->sphereSystem().intersect(ray, t, sphereID, normal)){
+		objectID = mNObjects + sphereID;
+		isHit = true;
+	}
+	return isHit;
+}
 
-	//Get Scene BBox
+bool RayTracer::shadowIntersect(Ray const& ray, float &t)const{
+	statsCount(COUNTER_SHADOW_RAYS, 1);
+	if(mNObjects > 0 && grid().shadowIntersect(ray, t)) return true;
+	return mScene->sphereSystem().shadowIntersect(ray, t);
+}
+
+Material const& RayTracer::material(uint objectID)const{
+	if(objectID < mNObjects) return mScene->object(objectID)->mMaterial;
+	return mScene->sphereSystem().material(objectID - mNObjects);
+}
+
+AABB RayTracer::sceneAABB(void)const{
+	SphereSystem const& spheres = mScene->sphereSystem();
+	if(spheres.size() == 0) return mGrid.getAABB();
+	if(mNObjects == 0) return spheres.aabb();
 	AABB aabb = mGrid.getAABB();
+	return AABB(glm::min(aabb.bounds[0], spheres.aabb().bounds[0]), glm::max(aabb.bounds[1], spheres.aabb().bounds[1]));
+}
+
+void RayTracer::genPhotonMap(uint nPhotons){
+	PhaseTimer timer(PHASE_PHOTONS);
+	mPhotonCount = 0;
+
+	//Get Scene BBox
+	AABB aabb = sceneAABB();
 	glm::vec3 aabbPosition = 0.5f * (aabb.bounds[1] + aabb.bounds[0]);
 	glm::vec3 aabbVertices[8] = {
 		glm::vec3(aabb.bounds[0].x, aabb.bounds[0].y, aabb.bounds[0].z),
@@ -135,7 +214,7 @@ void RayTracer::genPhotonMap(void){
 	}
 	
 	//////////////////////Generate Photons//////////////////////
-	while(photonCount < mNPhotons){
+	while(mPhotonCount < nPhotons){
 		//distribute photons to the different lights
 		float rnd = mtRandf(1.0f, false);
 		uint lightID = 0;
@@ -155,7 +234,6 @@ void RayTracer::genPhotonMap(void){
 		tracePhoton(photon, 0);
 		//To Add: Scale Photon
 	}
-	mPhotonMap.construct();
 }
 
 void RayTracer::tracePhoton(Photon &photon, uint level){
@@ -165,14 +243,14 @@ void RayTracer::tracePhoton(Photon &photon, uint level){
 	bool isIntersect = false;
 	uint currObject = 0;
 	glm::vec3 normal;
-	if(mGrid.intersect(ray, t, currObject, normal)) isIntersect = true;
+	if(intersect(ray, t, currObject, normal)) isIntersect = true;
 	if(!isIntersect) return;
-	Material objectMaterial = mScene->object(currObject)->mMaterial;
+	Material objectMaterial = material(currObject);
 	photon.p = ray.r0 + ray.dir * t;
 	if(level > 0){
 		photon.rgb *= objectMaterial.color;
 		mPhotonMap.storePhoton(photon); //First hit is direct light. We already calculate that with ray tracing
-		photonCount++;
+		mPhotonCount++;
 	}
 	// else traceShadowPhoton(Ray(photon.p, ray.dir), currObject);
 	
@@ -195,7 +273,7 @@ void RayTracer::traceShadowPhoton(Ray ray, uint objectID){
 	while(objectID == currObject){
 		t = 2000.0f;
 		shadowRay.r0 += shadowRay.dir * 0.0001f;
-		if(mGrid.intersect(shadowRay, t, currObject, normal)) isIntersect = true;
+		if(intersect(shadowRay, t, currObject, normal)) isIntersect = true;
 		if(!isIntersect) return;
 	}
 	// if(glm::dot(normal, -shadowRay.dir) < 0.0f) return;
@@ -207,88 +285,72 @@ void RayTracer::traceShadowPhoton(Ray ray, uint objectID){
 	return;
 }
 
-static uint nRays = 0;
-void RayTracer::traceRay(Ray &ray, colorRGBF &pixelColor, uint level, float Rcoef)const{
-	if(level > mDepth || Rcoef < 0.01f) return;
+template<bool isOcclusion, uint level>
+void RayTracer::traceRay(Ray &ray, colorRGBF &pixelColor, float Rcoef)const{
+	if(Rcoef < 0.01f) return;
+	statsCount(COUNTER_RAYS, 1);
 	float t = 2000.0f;
-	bool isIntersect = false;
 	uint currObject = 0;
 	glm::vec3 normal;
-	if(mGrid.intersect(ray, t, currObject, normal)) isIntersect = true;
-	
-	if(!isIntersect){
+	if(!intersect(ray, t, currObject, normal)){
 		if(level == 0) pixelColor = colorRGBF(1.0f); //background color
 		return;
 	}
-	nRays++;
+	shade<isOcclusion, level>(ray, t, currObject, normal, pixelColor, Rcoef);
+}
+
+//Lighting of the hit at t along the ray and the reflected ray from there
+template<bool isOcclusion, uint level>
+void RayTracer::shade(Ray &ray, float t, uint objectID, glm::vec3 const& normal, colorRGBF &pixelColor, float Rcoef)const{
 	glm::vec3 intersection = ray.r0 + ray.dir * t;
-	Material objectMaterial = mScene->object(currObject)->mMaterial;
+	Material objectMaterial = material(objectID);
 	
-	float nShadowPhotons;
-	pixelColor += Rcoef * calcIndirect(intersection, normal, nShadowPhotons);
-	
-	pixelColor += Rcoef * calcDiffuse(intersection, ray.dir, normal, objectMaterial);
+	if(isOcclusion) pixelColor += Rcoef * calcOcclusion(intersection, normal) * objectMaterial.color;
+	else{
+		float nShadowPhotons;
+		pixelColor += Rcoef * calcIndirect(intersection, normal, nShadowPhotons);
+		
+		pixelColor += Rcoef * calcDiffuse(intersection, ray.dir, normal, objectMaterial);
+	}
 	
-	colorRGBF reflColor;
-	ray.r0 += glm::cross(normal, glm::cross(ray.dir, normal));
-	Ray reflectedray = Ray(intersection, reflect(ray.dir, normal));
-	traceRay(reflectedray, reflColor, level + 1, Rcoef * objectMaterial.reflectivity);
-	pixelColor += Rcoef * reflColor * objectMaterial.color;
+	//Nothing is traced beyond the last level, its reflection would add black
+	if constexpr(level < TRACE_DEPTH){
+		colorRGBF reflColor;
+		ray.r0 += glm::cross(normal, glm::cross(ray.dir, normal));
+		Ray reflectedray = Ray(intersection, reflect(ray.dir, normal));
+		traceRay<isOcclusion, level + 1>(reflectedray, reflColor, Rcoef * objectMaterial.reflectivity);
+		pixelColor += Rcoef * reflColor * objectMaterial.color;
+	}
 	return;
 }
 
+//The hit is recomputed on the rasterised triangle, so that it is the same as the traced one. Samples at the edges
+//of a triangle that the ray misses by rounding are traced.
+bool RayTracer::primaryIntersect(Ray const& ray, uint x, uint y, float &t, uint &objectID, glm::vec3 &normal)const{
+	uint triangleID;
+	if(!mRaster.lookup(x, y, objectID, triangleID)) return false;
+	Triangle *triangle = Rasterizer::triangle(*mScene, objectID, triangleID);
+	if(triangle->intersect(ray, t, &normal)) return true;
+	return intersect(ray, t, objectID, normal);
+}
+
 colorRGBF RayTracer::calcIndirect(glm::vec3 position, glm::vec3 N, float &nShadowPhotons)const{
-	colorRGBF pixelColor;
-	nShadowPhotons = 0.0f;
-	std::vector<Photon const*> photons = mPhotonMap.locate(position, 0.2f);
-	uint nPhotons = photons.size();
-	static float normalization = mNPointLights * (200.0f / M_PI) / (mNPhotons * 0.2f * 0.2f);
-	if(nPhotons > 8){
-		colorRGBF indColor;
-		for(uint i = 0; i < nPhotons; i++){
-			// if(photons[i]->isShadow) nShadowPhotons++;
-			// else{
-				float diffuse = glm::dot(-photons[i]->dir, N);
-				if(diffuse < 0) continue;
-				colorRGBF photonColor = photons[i]->rgb;
-				indColor += diffuse * photonColor;
-			// }
-		}
-		pixelColor += indColor * normalization;
-		// nShadowPhotons = nShadowPhotons / nPhotons;
-	}
-	return pixelColor;
+	ISA_DISPATCH(calcIndirectISA, (position, N, nShadowPhotons))
 }
 
 colorRGBF RayTracer::calcDiffuse(glm::vec3 position, glm::vec3 I, glm::vec3 N, Material mat)const{
-	colorRGBF pixelColor;
-	Ray lightRay;
-	lightRay.r0 = position;
-	for(uint lightID = 0; lightID < mNPointLights; lightID++){
-		colorRGBF lightColor = mScene->pointLight(lightID).mColor;
-		lightRay.dir = mScene->pointLight(lightID).mPosition - lightRay.r0;
-		float d = glm::length(lightRay.dir);
-		if(glm::dot(lightRay.dir, N) <= 0.0f) continue;
-		lightRay.dir = lightRay.dir / d;
-		// lightRay.r0 += lightRay.dir * 1.0001f; //Bump Ray
-		bool isInShadow = false;
-		isInShadow = mGrid.shadowIntersect(lightRay, d);
-		if(!isInShadow){
-			// lambert
-			float diffuse = glm::dot(lightRay.dir, N);
-			pixelColor += diffuse * lightColor * mat.color;
-			// blinn
-			glm::vec3 halfVector = lightRay.dir - I;
-			float temp = glm::length(halfVector);
-			if(temp > 0.0f){
-				halfVector = halfVector / temp;
-				float spec = maxf(glm::dot(halfVector, N), 0.0f);
-				spec = mat.Sv * pow(spec, mat.Sp);
-				pixelColor += spec * lightColor;
-			}
-		}
+	ISA_DISPATCH(calcDiffuseISA, (position, I, N, mat))
+}
+
+float RayTracer::calcOcclusion(glm::vec3 const& position, glm::vec3 const& N)const{
+	HashRandom random(position);
+	uint nOpen = 0;
+	for(uint i = 0; i < mNAORays; i++){
+		Ray ray(position, randCosine(N, random));
+		float t = mAODistance;
+		if(!shadowIntersect(ray, t)) nOpen++;
 	}
-	return pixelColor;
+	return (float)nOpen / mNAORays;
 }
 
 
@@ -297,45 +359,405 @@ void RayTracer::Init(Scene *scene){
 	mNObjects = scene->nObjects();
 	mNPointLights = scene->nPointLights();
 	mNPlanes = scene->nPlanes();
-	mGrid.construct(mScene);
-	genPhotonMap();
+	mGrid.construct(mScene, mIsRefittable);
+	mScene->sphereSystem().construct();
+	randGen_.seed(0); //Every scene starts the same sequence, so a batch renders as its snapshots would alone
+	mPhotonMap.clear();
+	if(mNAORays == 0){
+		genPhotonMap(mNPhotons);
+		mPhotonMap.construct();
+	}
+	replicate();
+	recordMemory();
 }
 
-static inline uchar srgbEncode(float c){
-	static const float gamma = 1.0f / 2.2f;
-	if (c < 0.018) return uchar(1118.93f * c); 
-	else return uchar(275.141f * pow(c, gamma) - 20.141f); // Inverse gamma 2.2
+void RayTracer::Init(Scene *scene, CompiledScene const& compiled){
+	mScene = scene;
+	mNObjects = scene->nObjects();
+	mNPointLights = scene->nPointLights();
+	mNPlanes = scene->nPlanes();
+	compiled.loadGrid(mGrid, mScene);
+	randGen_.seed(0);
+	mPhotonMap.clear();
+	if(mNAORays == 0){
+		genPhotonMap(mNPhotons);
+		mPhotonMap.construct();
+	}
+	replicate();
+	recordMemory();
+}
+
+//Brings the acceleration structures up to date after the objects in movedObjects were transformed in place.
+//The grid is refitted incrementally unless an object left it. Moving objects also changes the lighting,
+//but re-emitting photons is the most expensive part of a frame, so it is left to the caller.
+void RayTracer::Refit(std::vector<uint> const& movedObjects, bool isPhotonMapStale){
+	bool isRefitted = true;
+	for(uint i = 0; i < movedObjects.size() && isRefitted; i++){
+		isRefitted = mGrid.update(mScene, movedObjects[i]);
+	}
+	if(!isRefitted){
+		std::cout << "Objects left the grid, constructing it again." << std::endl;
+		mGrid.construct(mScene, mIsRefittable);
+	}
+	if(isPhotonMapStale && mNAORays == 0){
+		mPhotonMap.clear();
+		genPhotonMap(mNPhotons);
+		mPhotonMap.construct();
+	}
+	replicate();
+	recordMemory();
 }
 
+//Copies the grid and the photon map for the NUMA nodes other than the first, each on a thread of its node so that
+//the pages are placed there when they are first touched. The originals serve node 0.
+void RayTracer::replicate(void){
+	clearReplicas();
+	uint nNodes = numaNodes();
+	if(!mIsReplicated || nNodes < 2) return;
+	std::vector<uint> cellStarts;
+	std::vector<GridItem> items;
+	if(mNObjects > 0) mGrid.exportCells(mScene, cellStarts, items);
+	for(uint node = 1; node < nNodes; node++){
+		Grid *grid = new Grid;
+		PhotonMap *photonMap = new PhotonMap;
+		runOnNode(node, [&](){
+			if(mNObjects > 0) grid->load(mScene, mGrid.resolution(), mGrid.getAABB(), &cellStarts[0], &items[0]);
+			photonMap->replicate(mPhotonMap);
+		});
+		mNodeGrids.push_back(grid);
+		mNodePhotonMaps.push_back(photonMap);
+	}
+}
+
+void RayTracer::clearReplicas(void){
+	for(uint i = 0; i < mNodeGrids.size(); i++){
+		delete mNodeGrids[i];
+		delete mNodePhotonMaps[i];
+	}
+	mNodeGrids.clear();
+	mNodePhotonMaps.clear();
+}
+
+Grid const& RayTracer::grid(void)const{
+	uint node = threadNode();
+	if(node == 0 || node > mNodeGrids.size()) return mGrid;
+	return *mNodeGrids[node - 1];
+}
+
+PhotonMap const& RayTracer::photonMap(void)const{
+	uint node = threadNode();
+	if(node == 0 || node > mNodePhotonMaps.size()) return mPhotonMap;
+	return *mNodePhotonMaps[node - 1];
+}
+
+void RayTracer::recordMemory(void)const{
+	statsMemory("scene", mScene->memoryUsage());
+	statsMemory("grid", mGrid.memoryUsage());
+	statsMemory("sphere_system", mScene->sphereSystem().memoryUsage());
+	statsMemory("photon_map", mPhotonMap.memoryUsage());
+	size_t replicaBytes = 0;
+	for(uint i = 0; i < mNodeGrids.size(); i++) replicaBytes += mNodeGrids[i]->memoryUsage() + mNodePhotonMaps[i]->memoryUsage();
+	statsMemory("numa_replicas", replicaBytes);
+	statsMemory("frame_buffer", (size_t)3 * mWidth * mHeight);
+	statsMemory("accumulation_buffer", mAccum.memoryUsage());
+}
+
+//Like Init, but each of the nParts processes only emits its share of the photons and publishes them
+//as <photonPrefix>.<part>. The photon map is then built from all the shares, so every process ends up
+//with the same map while paying for a fraction of the emission. The coordinator creates <photonPrefix>.failed
+//when a process fails, so that the others stop waiting for a share that will never come.
+bool RayTracer::InitShared(Scene *scene, std::string const& photonPrefix, uint part, uint nParts){
+	mScene = scene;
+	mNObjects = scene->nObjects();
+	mNPointLights = scene->nPointLights();
+	mNPlanes = scene->nPlanes();
+	mGrid.construct(mScene, mIsRefittable);
+	mScene->sphereSystem().construct();
+	if(mNAORays > 0){
+		mPhotonMap.clear();
+		replicate();
+		recordMemory();
+		return true;
+	}
+	
+	uint begin = (uint)((unsigned long long)mNPhotons * part / nParts);
+	uint end = (uint)((unsigned long long)mNPhotons * (part + 1) / nParts);
+	randGen_.seed(part);
+	genPhotonMap(end - begin);
+	if(!mPhotonMap.save(partFileName(photonPrefix, part).c_str())) return false;
+	
+	mPhotonMap.clear();
+	for(uint i = 0; i < nParts; i++){
+		std::string filename = partFileName(photonPrefix, i);
+		if(!waitForFile(filename, mSharedTimeout, photonPrefix + ".failed") || !mPhotonMap.load(filename.c_str())) return false;
+	}
+	mPhotonMap.construct();
+	replicate();
+	recordMemory();
+	return true;
+}
+
+void RayTracer::setTimeBudget(double seconds){
+	mTimeBudget = seconds;
+}
+
+void RayTracer::setPassCallback(PassCallback callback, void *userData){
+	mPassCallback = callback;
+	mPassCallbackData = userData;
+}
+
+//Prints the percentage of tiles done and an ETA capped by the deadline (if any), whenever the percentage changes
+static void printProgress(uint done, uint total, double startTime, double deadline, int &percentage){
+	int percentage_new = int(100.0 * done / total);
+	if(percentage_new == percentage) return;
+	percentage = percentage_new;
+	double now = omp_get_wtime();
+	std::cout << "\r" << percentage << "% ";
+	if(done > 0){
+		double eta = (now - startTime) * (total - done) / done;
+		if(deadline > 0.0 && deadline - now < eta) eta = deadline - now;
+		if(eta < 0.0) eta = 0.0;
+		std::cout << "ETA " << int(eta) << "s   ";
+	}
+	std::cout << std::flush;
+}
+
+void RayTracer::setTilePartition(uint part, uint nParts){
+	mTilePart = part;
+	mNTileParts = nParts;
+}
+
+void RayTracer::setPassRange(uint firstPass, uint nPasses){
+	mFirstPass = firstPass;
+	mNPasses = nPasses;
+	mAccum.setPassRange(firstPass, nPasses);
+}
+
+void RayTracer::setRowWindow(uint firstRow, uint nRows){
+	mFirstRow = firstRow;
+	mNRows = (nRows < mHeight)? nRows: mHeight;
+}
+
+bool RayTracer::loadCheckpoint(char const* filename){
+	AccumBuffer checkpoint(mWidth, mHeight);
+	if(!checkpoint.load(filename)) return false;
+	if(checkpoint.width() != mWidth || checkpoint.height() != mHeight){
+		std::cout << "Checkpoint \"" << filename << "\" does not match the image size." << std::endl;
+		return false;
+	}
+	//Its samples were taken from its own passes, continuing them with other passes would repeat or skip samples
+	if(checkpoint.firstPass() != mFirstPass || checkpoint.nPasses() != mNPasses){
+		std::cout << "Checkpoint \"" << filename << "\" was rendered with -passes " << checkpoint.firstPass() << " " << checkpoint.nPasses()
+			<< ", not " << mFirstPass << " " << mNPasses << "." << std::endl;
+		return false;
+	}
+	mAccum.clear();
+	mAccum.merge(checkpoint);
+	return true;
+}
+
+bool RayTracer::saveCheckpoint(char const* filename)const{
+	return mAccum.save(filename);
+}
+
+void RayTracer::clearAccumulation(void){
+	mAccum.clear();
+}
+
+void RayTracer::resize(uint width, uint height){
+	if(width != mWidth || height != mHeight){
+		delete[] mBuffer;
+		mBuffer = new uchar[(size_t)3*width*height]();
+		mWidth = width;
+		mHeight = height;
+	}
+	else memset(mBuffer, 0, (size_t)3*width*height);
+	mAccum.resize(width, height);
+	mFirstRow = 0;
+	mNRows = height;
+}
+
+template<uint features, class Camera>
+void RayTracer::traceTile(CameraBase const& baseCamera, Tile const& tile, uint sample, uint pass, colorRGBF *tileBuffer){
+	Camera const& camera = static_cast<Camera const&>(baseCamera);
+	uint tileWidth = tile.x1 - tile.x0;
+	for(uint j = tile.y0; j < tile.y1; j++){
+		for(uint i = tile.x0; i < tile.x1; i++){
+			//Pixels that already have this pass' sample (e.g. from a resumed checkpoint) are skipped
+			if(mAccum.samples(i, j) != pass) continue;
+			CostBuffer::Mark costMark;
+			if constexpr((features & TRACE_COSTS) != 0) CostBuffer::mark(costMark);
+			float coef = 1.0f;
+			colorRGBF sampleColor;
+			Ray ray = camera.shootRay(i, mFirstRow + j, sample);
+			float t = 2000.0f;
+			uint objectID = 0;
+			glm::vec3 normal;
+			bool isHit;
+			statsCount(COUNTER_RAYS, 1);
+			if constexpr((features & TRACE_RASTERIZED) != 0) isHit = primaryIntersect(ray, i, j, t, objectID, normal);
+			else isHit = intersect(ray, t, objectID, normal);
+			if(isHit){
+				if constexpr((features & TRACE_AOVS) != 0) mAOVs.set(i, j, material(objectID).color, normal, t, objectID);
+				shade<(features & TRACE_OCCLUSION) != 0, 0>(ray, t, objectID, normal, sampleColor, coef);
+			}
+			else sampleColor = colorRGBF(1.0f); //background color
+			if constexpr((features & TRACE_COSTS) != 0) mCosts.add(i, j, costMark);
+			tileBuffer[(i - tile.x0) + (j - tile.y0) * tileWidth] = sampleColor;
+		}
+	}
+}
+
+template<class Camera, uint... features>
+RayTracer::TileTracer RayTracer::tileTracer(uint variant, std::integer_sequence<uint, features...>){
+	static const TileTracer variants[] = {&RayTracer::traceTile<features, Camera>...};
+	return variants[variant];
+}
+
+//The cameras main renders with are final, so that their calls in the tile loop are direct
+RayTracer::TileTracer RayTracer::tileTracer(CameraBase const& camera, uint features){
+	std::make_integer_sequence<uint, N_TRACE_VARIANTS> variants;
+	if(dynamic_cast<PinholeCamera const*>(&camera)) return tileTracer<PinholeCamera>(features, variants);
+	if(dynamic_cast<OrthographicCamera const*>(&camera)) return tileTracer<OrthographicCamera>(features, variants);
+	return tileTracer<CameraBase>(features, variants);
+}
+
+//Renders the image progressively, one sample per pixel per pass. After each pass the resolved image
+//can be inspected through the pass callback. If a time budget is set, no new tiles are started after
+//the deadline and each pixel keeps the samples it has accumulated so far. Samples already in the
+//accumulation buffer (e.g. from a checkpoint) are kept and only the missing ones are traced.
 void RayTracer::Trace(CameraBase &camera){
+	PhaseTimer timer(PHASE_TRACE);
 	uint nSamples = camera.getSamples();
 	nSamples *= nSamples;
-	std::cout.precision(3);
-	std::cout.width(3);
+	uint nPasses = 0;
+	if(mFirstPass < nSamples) nPasses = nSamples - mFirstPass;
+	if(mNPasses > 0 && mNPasses < nPasses) nPasses = mNPasses;
+	uint startPass = mAccum.minSamples();
+	if(startPass > nPasses) startPass = nPasses;
+	
+	std::vector<Tile> tiles = genTiles(mWidth, mNRows, mTileSize);
+	if(mNTileParts > 1){
+		//Keep only this part's contiguous range of the Morton ordered tiles
+		uint nAllTiles = tiles.size();
+		uint begin = (uint)((unsigned long long)nAllTiles * mTilePart / mNTileParts);
+		uint end = (uint)((unsigned long long)nAllTiles * (mTilePart + 1) / mNTileParts);
+		tiles = std::vector<Tile>(tiles.begin() + begin, tiles.begin() + end);
+	}
+	uint nTiles = tiles.size();
+	uint nThreads = omp_get_max_threads();
+	
+	double startTime = omp_get_wtime();
+	bool hasDeadline = (mTimeBudget > 0.0);
+	double deadline = hasDeadline? startTime + mTimeBudget: 0.0;
+	uint tilesDone = 0;
+	uint totalTiles = nTiles * (nPasses - startPass);
+	bool isExpired = false;
 	int percentage = -1;
-	#pragma omp parallel for schedule(dynamic)
-	for(uint i = 0; i < mWidth; i++){
-		for(uint j = 0; j < mHeight; j++){
-			// int percentage_new = int(100.0f * (mHeight * i + j) / (mWidth * mHeight - 1.0f));
-			// if(percentage_new != percentage){
-				// std::cout << "\r" << std::flush;
-				// std::cout << percentage_new << "\%";
-				// percentage = percentage_new;
-			// }
-			colorRGBF pixelColor;
-			for(uint sample = 0; sample < nSamples; sample++){
-				float coef = 1.0f;
-				colorRGBF sampleColor;
-				Ray ray = camera.shootRay(i, j, sample);
-				uint level = 0;
-				traceRay(ray, sampleColor, level, coef);
-				pixelColor += sampleColor;
+	bool isAOVRecorded = mIsAOVRecorded || mNDenoiseIterations > 0;
+	if(isAOVRecorded){
+		if(mAOVs.width() != mWidth || mAOVs.height() != mHeight) mAOVs.resize(mWidth, mHeight);
+		else mAOVs.clear();
+		statsMemory("aov_buffers", mAOVs.memoryUsage());
+	}
+	bool isCostRecorded = mIsCostRecorded && mIntegrator != WAVEFRONT;
+	if(isCostRecorded){
+		if(mCosts.width() != mWidth || mCosts.height() != mHeight) mCosts.resize(mWidth, mHeight);
+		else mCosts.clear();
+		statsMemory("cost_buffer", mCosts.memoryUsage());
+	}
+	bool isRasterized = false;
+	if(mIsRasterized){
+		PhaseTimer rasterTimer(PHASE_RASTER);
+		if(!Rasterizer::isRasterizable(*mScene)) std::cout << "Only polyhedra and triangles can be rasterised, the first hits are traced." << std::endl;
+		else if(!mRaster.bin(*mScene, camera, mWidth, mFirstRow, mNRows)) std::cout << "Triangles reach behind the camera, the first hits are traced." << std::endl;
+		else isRasterized = true;
+	}
+	
+	for(uint pass = startPass; pass < nPasses && !isExpired; pass++){
+		uint sample = mFirstPass + pass;
+		bool isAOVPass = isAOVRecorded && pass == startPass;
+		if(isRasterized){
+			PhaseTimer rasterTimer(PHASE_RASTER);
+			mRaster.render(*mScene, camera, sample);
+			statsMemory("visibility_buffer", mRaster.memoryUsage());
+		}
+		if(mIntegrator == WAVEFRONT){
+			//Batches of consecutive tiles are traced stage by stage, each stage runs in parallel over the batch
+			std::vector<uint> pixels;
+			std::vector<colorRGBF> colors;
+			uint tileID = 0;
+			while(tileID < nTiles){
+				if(hasDeadline && omp_get_wtime() > deadline){
+					isExpired = true;
+					break;
+				}
+				uint firstTile = tileID;
+				pixels.clear();
+				while(tileID < nTiles && pixels.size() < mWavefrontSize){
+					Tile const& tile = tiles[tileID++];
+					for(uint j = tile.y0; j < tile.y1; j++){
+						for(uint i = tile.x0; i < tile.x1; i++){
+							if(mAccum.samples(i, j) == pass) pixels.push_back(i + mWidth * j);
+						}
+					}
+				}
+				if(!pixels.empty()){
+					colors.resize(pixels.size());
+					traceWavefront(camera, pixels, sample, isRasterized, isAOVPass? &mAOVs: NULL, &colors[0]);
+					for(uint k = 0; k < pixels.size(); k++) mAccum.add(pixels[k] % mWidth, pixels[k] / mWidth, colors[k], 1);
+				}
+				tilesDone += tileID - firstTile;
+				printProgress(tilesDone, totalTiles, startTime, deadline, percentage);
 			}
-			mBuffer[3*i + 3*mWidth*j + 0] = srgbEncode(minf(pixelColor.r / nSamples, 1.0f));
-			mBuffer[3*i + 3*mWidth*j + 1] = srgbEncode(minf(pixelColor.g / nSamples, 1.0f));
-			mBuffer[3*i + 3*mWidth*j + 2] = srgbEncode(minf(pixelColor.b / nSamples, 1.0f));
 		}
+		else{
+			uint features = (isRasterized? TRACE_RASTERIZED: 0) | (isAOVPass? TRACE_AOVS: 0) | (isCostRecorded? TRACE_COSTS: 0) | ((mNAORays > 0)? TRACE_OCCLUSION: 0);
+			TileTracer traceTilePass = tileTracer(camera, features);
+			TileScheduler scheduler(nTiles, nThreads);
+			#pragma omp parallel
+			{
+				//Pixels are accumulated in a thread local tile buffer and written out row by row once the tile is done,
+				//so that threads never write to the same cache lines of the frame buffer.
+				colorRGBF *tileBuffer = new colorRGBF[mTileSize * mTileSize];
+				uint threadID = omp_get_thread_num();
+				uint tileID;
+				while(scheduler.next(threadID, tileID)){
+					if(hasDeadline && omp_get_wtime() > deadline){
+						#pragma omp atomic write
+						isExpired = true;
+						break;
+					}
+					Tile const& tile = tiles[tileID];
+					uint tileWidth = tile.x1 - tile.x0;
+					(this->*traceTilePass)(camera, tile, sample, pass, tileBuffer);
+					for(uint j = tile.y0; j < tile.y1; j++){
+						colorRGBF const* tileRow = tileBuffer + (j - tile.y0) * tileWidth;
+						for(uint i = 0; i < tileWidth; i++){
+							if(mAccum.samples(tile.x0 + i, j) == pass) mAccum.add(tile.x0 + i, j, tileRow[i], 1);
+						}
+					}
+					
+					uint done;
+					#pragma omp atomic capture
+					done = ++tilesDone;
+					//Only the master thread reports, the others just bump the counter
+					if(threadID == 0) printProgress(done, totalTiles, startTime, deadline, percentage);
+				}
+				delete[] tileBuffer;
+			}
+		}
+		mAccum.resolve(mBuffer);
+		if(mPassCallback) mPassCallback(*this, pass, mPassCallbackData);
+	}
+	mAccum.resolve(mBuffer);
+	if(mNDenoiseIterations > 0){
+		AccumBuffer filtered(mAccum.width(), mAccum.height());
+		denoise(mAccum, mAOVs, mNDenoiseIterations, filtered);
+		filtered.resolve(mBuffer);
 	}
+	percentage = -1;
+	if(totalTiles > 0) printProgress(tilesDone, totalTiles, startTime, deadline, percentage);
 	std::cout << std::endl;
-	std::cout << nRays << std::endl;
-}
\ No newline at end of file
+	if(isExpired) std::cout << "Time budget exhausted after " << tilesDone << " of " << totalTiles << " tile passes." << std::endl;
+}
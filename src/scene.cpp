@@ -1,6 +1,8 @@
 #define GLM_SWIZZLE
 #include <glm/gtc/matrix_transform.hpp>
 #include "../include/scene.h"
+#include "../include/mappedfile.h"
+#include "../include/stats.h"
 #include <sstream>
 #include <fstream>
 #include <iostream>
@@ -18,6 +20,9 @@ Scene::~Scene(void){
 	for(uint i = 0; i < mNAreaLights; i++){
 		delete mAreaLights[i];
 	}
+	for(uint i = 0; i < mNTypes; i++){
+		delete mTypes[i];
+	}
 }
 
 void Scene::addSphere(glm::vec3 position, float radius, Material& material){
@@ -26,6 +31,16 @@ void Scene::addSphere(glm::vec3 position, float radius, Material& material){
 	mNObjects++;
 }
 
+void Scene::addSpherocylinder(glm::vec3 position, glm::vec4 rotation, float radius, float length, Material& material){
+	mObjects.push_back(new Spherocylinder(position, rotation, radius, length, material));
+	mNObjects++;
+}
+
+void Scene::addSuperellipsoid(glm::vec3 position, glm::vec4 rotation, glm::vec3 semiAxes, float exponent, Material& material){
+	mObjects.push_back(new Superellipsoid(position, rotation, semiAxes, exponent, material));
+	mNObjects++;
+}
+
 void Scene::addPlane(glm::vec3 normal, glm::vec3 point, Material& material){
 	Plane* tempPlane = new Plane(normal, point, material);
 	mPlanes.push_back(tempPlane);
@@ -53,23 +68,168 @@ void Scene::addAreaLight(glm::vec3 position, glm::vec3 normal, float radius, col
 }
 
 int Scene::addPolyhedronType(std::string objFile){
-	PolyhedronType tempPolyType ;
-	if(!parsePolyObj(objFile, tempPolyType)) return -1;
+	PolyhedronType *tempPolyType = new PolyhedronType;
+	if(!parsePolyObj(objFile, *tempPolyType)){
+		delete tempPolyType;
+		return -1;
+	}
 	mTypes.push_back(tempPolyType);
 	mNTypes++;
 	return mNTypes - 1;
 }
 
+int Scene::addPolyhedronType(PolyhedronType const& polyType){
+	mTypes.push_back(new PolyhedronType(polyType));
+	mNTypes++;
+	return mNTypes - 1;
+}
+
+void Scene::addPolyhedron(int objectID, Material &material, glm::vec3 const* vertices, glm::vec3 const* normals, AABB const* triangleAABBs, AABB const& aabb){
+	Polyhedron* tempPolyhedron = new Polyhedron(*mTypes[objectID], material, vertices, normals, triangleAABBs, aabb);
+	mObjects.push_back(tempPolyhedron);
+	mNObjects++;
+}
+
+void Scene::setLOD(CameraBase const* camera, float hullPixels, float impostorPixels){
+	mLODCamera = camera;
+	mLODPixels[0] = hullPixels;
+	mLODPixels[1] = impostorPixels;
+}
+
+void Scene::setCulling(CameraBase const* camera, float margin){
+	mCullCamera = camera;
+	mCullMargin = margin;
+}
+
+void Scene::addClipPlane(glm::vec3 normal, float offset){
+	float length = glm::length(normal);
+	mClipPlanes.push_back(glm::vec4(normal / length, offset / length));
+}
+
+bool Scene::isCulled(glm::vec3 const& position, float radius)const{
+	radius += mCullMargin;
+	for(uint i = 0; i < mClipPlanes.size(); i++){
+		glm::vec4 const& plane = mClipPlanes[i];
+		if(glm::dot(glm::vec3(plane), position) - radius > plane.w) return true;
+	}
+	return mCullCamera && !mCullCamera->isVisible(position, radius);
+}
+
+//Vertex clustering: the vertices are merged per cell of a 4x4x4 grid over the model, and the triangles
+//that collapse are dropped
+static void decimate(PolyhedronType const& type, PolyhedronType &hull){
+	const int res = 4;
+	glm::vec3 min(1e30f);
+	glm::vec3 max(-1e30f);
+	for(uint i = 0; i < type.mVertices.size(); i++){
+		min = glm::min(min, type.mVertices[i]);
+		max = glm::max(max, type.mVertices[i]);
+	}
+	glm::vec3 cellDim = (max - min) / (float)res + 1e-6f;
+	std::vector<int> cellVertex(res * res * res, -1);
+	std::vector<uint> counts;
+	std::vector<int> vertexMap(type.mVertices.size());
+	for(uint i = 0; i < type.mVertices.size(); i++){
+		glm::ivec3 cell = glm::ivec3((type.mVertices[i] - min) / cellDim);
+		int &vertex = cellVertex[cell.x + res * (cell.y + res * cell.z)];
+		if(vertex < 0){
+			vertex = hull.mVertices.size();
+			hull.mVertices.push_back(glm::vec3(0.0f));
+			counts.push_back(0);
+		}
+		hull.mVertices[vertex] = hull.mVertices[vertex] + type.mVertices[i];
+		counts[vertex]++;
+		vertexMap[i] = vertex;
+	}
+	for(uint i = 0; i < hull.mVertices.size(); i++) hull.mVertices[i] = hull.mVertices[i] / (float)counts[i];
+	for(uint i = 0; i < type.mTrVertIndices.size(); i++){
+		glm::ivec3 const& triangle = type.mTrVertIndices[i];
+		glm::ivec3 merged(vertexMap[triangle.x], vertexMap[triangle.y], vertexMap[triangle.z]);
+		if(merged.x == merged.y || merged.y == merged.z || merged.z == merged.x) continue;
+		hull.mTrVertIndices.push_back(merged);
+	}
+}
+
+void Scene::buildLOD(uint typeID){
+	if(mHullTypes.size() < mNTypes){
+		mHullTypes.resize(mNTypes, -1);
+		mImpostorRadii.resize(mNTypes, 0.0f);
+	}
+	PolyhedronType const& type = *mTypes[typeID];
+	//A convex body's mean projected area is a quarter of its surface, as for the sphere of the same surface
+	float area = 0.0f;
+	for(uint i = 0; i < type.mTrVertIndices.size(); i++){
+		glm::ivec3 const& triangle = type.mTrVertIndices[i];
+		glm::vec3 const& v0 = type.mVertices[triangle.x];
+		area += 0.5f * glm::length(glm::cross(type.mVertices[triangle.y] - v0, type.mVertices[triangle.z] - v0));
+	}
+	mImpostorRadii[typeID] = sqrt(area / (4.0f * M_PI));
+	
+	PolyhedronType hull;
+	decimate(type, hull);
+	if(2 * hull.mTrVertIndices.size() <= type.mTrVertIndices.size()){
+		mHullTypes[typeID] = addPolyhedronType(hull);
+		mHullTypes.push_back(-1);
+		mImpostorRadii.push_back(mImpostorRadii[typeID]);
+	}
+}
+
 void Scene::addPolyhedron(int objectID, glm::vec3 position, Material &material, glm::vec4 rotation, float scale){
 	if(objectID < 0){
 		std::cout << "Polyhedron type unknown." << std::endl;
 		return;
 	}
-	Polyhedron* tempPolyhedron = new Polyhedron(mTypes[objectID], position, material, rotation, scale);
+	if(mLODCamera){
+		if((uint)objectID >= mImpostorRadii.size() || mImpostorRadii[objectID] == 0.0f) buildLOD(objectID);
+		float pixels = 2.0f * mImpostorRadii[objectID] * scale / mLODCamera->pixelSize(position);
+		if(pixels < mLODPixels[1]){
+			addSphere(position, mImpostorRadii[objectID] * scale, material);
+			mLODCounts[LOD_IMPOSTOR]++;
+			return;
+		}
+		if(pixels < mLODPixels[0] && mHullTypes[objectID] >= 0){
+			objectID = mHullTypes[objectID];
+			mLODCounts[LOD_HULL]++;
+		}
+		else mLODCounts[LOD_FULL]++;
+	}
+	Polyhedron* tempPolyhedron = new Polyhedron(*mTypes[objectID], position, material, rotation, scale);
 	mObjects.push_back(tempPolyhedron);
 	mNObjects++;
 }
 
+void Scene::moveObject(uint objectID, glm::vec3 position, glm::vec4 rotation, float scale){
+	Object *object = mObjects[objectID];
+	if(object->mType == POLYHEDRON) ((Polyhedron*)object)->setTransform(position, rotation, scale);
+	else if(object->mType == SPHEROCYLINDER) ((Spherocylinder*)object)->setTransform(position, rotation);
+	else if(object->mType == SUPERELLIPSOID) ((Superellipsoid*)object)->setTransform(position, rotation);
+}
+
+void Scene::clearObjects(void){
+	for(uint i = 0; i < mNObjects; i++){
+		delete mObjects[i];
+	}
+	mObjects.clear();
+	mNObjects = 0;
+	mSphereSystem.clear();
+	clearLODCounts();
+}
+
+size_t Scene::memoryUsage(void)const{
+	size_t bytes = mObjects.capacity() * sizeof(Object*);
+	for(uint i = 0; i < mNObjects; i++){
+		if(mObjects[i]->mType == POLYHEDRON) bytes += ((Polyhedron*)mObjects[i])->memoryUsage();
+		else if(mObjects[i]->mType == SPHERE) bytes += sizeof(Sphere);
+		else if(mObjects[i]->mType == SPHEROCYLINDER) bytes += sizeof(Spherocylinder);
+		else if(mObjects[i]->mType == SUPERELLIPSOID) bytes += sizeof(Superellipsoid);
+		else bytes += sizeof(Triangle) + 3 * sizeof(glm::vec3);
+	}
+	for(uint i = 0; i < mNTypes; i++){
+		bytes += sizeof(PolyhedronType) + mTypes[i]->mVertices.capacity() * sizeof(glm::vec3) + mTypes[i]->mTrVertIndices.capacity() * sizeof(glm::ivec3);
+	}
+	return bytes;
+}
+
 void Scene::translate(glm::vec3 trVector){
 	mModelMatrix = glm::translate(mModelMatrix, trVector);
 }
@@ -93,40 +253,39 @@ PointLight const& Scene::pointLight(uint i)const{
 
 bool Scene::parsePolyObj(std::string objFile, PolyhedronType &pType){
 	/* Parse File */
-	const char *filepath = objFile.c_str();
-	std::ifstream file(filepath);
-	if(!file){
+	PhaseTimer timer(PHASE_PARSE);
+	MappedFile file;
+	if(!file.open(objFile.c_str())){
 		std::cout << "Error parsing file \"" << objFile << "\" by function " << "'" << __FUNCTION__ << "'" << std::endl;
 		return false;
 	}
 	std::cout << "Parsing " << objFile << "." << std::endl;
 	
-	std::string line;
-	while(std::getline(file, line)){
-		if(line[0] == 'v'){
-			std::istringstream s(line.substr(2));
+	char const* pos = file.begin();
+	char const* end = file.end();
+	std::vector<uint> face;
+	while(pos < end){
+		if(pos + 1 < end && pos[0] == 'v' && (pos[1] == ' ' || pos[1] == '\t')){
+			pos++;
 			glm::vec3 vertex;
-			s >> vertex[0] >> vertex[1] >> vertex[2] >> std::ws;
+			for(uint i = 0; i < 3; i++) parseFloat(pos, end, vertex[i]);
 			pType.mVertices.push_back(vertex);
 		}
-		else if(line[0] == 'f'){
-			std::istringstream s(line.substr(2));
-			std::vector<uint> face;
+		else if(pos + 1 < end && pos[0] == 'f' && (pos[1] == ' ' || pos[1] == '\t')){
+			pos++;
+			face.clear();
 			uint faceVertexIndex;
-			while(s >> faceVertexIndex) face.push_back(faceVertexIndex - 1);
-			uint facesize = face.size();
-			if(facesize > 3){
-				for(uint i = 1; i < facesize - 1; i++){
-					glm::ivec3 triangle(face[0], face[i], face[i + 1]);
-					pType.mTrVertIndices.push_back(triangle);
-				}
+			while(parseUint(pos, end, faceVertexIndex)){
+				face.push_back(faceVertexIndex - 1);
+				while(pos < end && *pos == '/') parseUint(++pos, end, faceVertexIndex); //Skip texture and normal indices
 			}
-			else{
-				glm::ivec3 triangle(face[0], face[1], face[2]);
+			uint facesize = face.size();
+			for(uint i = 1; i + 1 < facesize; i++){
+				glm::ivec3 triangle(face[0], face[i], face[i + 1]);
 				pType.mTrVertIndices.push_back(triangle);
 			}
 		}
+		skipLine(pos, end);
 	}
-	file.close();
 	return true;
-}
\ No newline at end of file
+}
@@ -0,0 +1,84 @@
+#include "../include/snapshot.h"
+#include "../include/stats.h"
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+
+#define LINES_PER_CHUNK 4096
+
+//Parses one particle line: the type, the position, then the angle and the axis. The rest of the line is ignored.
+static bool parseParticle(char const* &pos, char const* end, SnapshotParticle &particle){
+	bool isValid = parseUint(pos, end, particle.type);
+	for(uint i = 0; i < 3 && isValid; i++) isValid = parseFloat(pos, end, particle.position[i]);
+	for(uint i = 0; i < 4 && isValid; i++) isValid = parseFloat(pos, end, particle.rotation[i]);
+	skipLine(pos, end);
+	return isValid;
+}
+
+bool SnapshotReader::open(char const* filename){
+	if(!mFile.open(filename)) return false;
+	mPos = mFile.begin();
+	return true;
+}
+
+bool SnapshotReader::next(Snapshot &snapshot){
+	PhaseTimer timer(PHASE_PARSE);
+	char const* end = mFile.end();
+	char const* pos = mPos;
+	while(pos < end && (*pos == '\n' || *pos == '\r' || *pos == ' ' || *pos == '\t')) pos++;
+	if(pos >= end) return false;
+	
+	uint nPart, nTypes;
+	if(!parseUint(pos, end, nPart)) return false;
+	skipLine(pos, end);
+	if(!parseUint(pos, end, nTypes)) return false;
+	skipLine(pos, end);
+	for(uint i = 0; i < 9; i++){
+		if(!parseFloat(pos, end, snapshot.box[i])) return false;
+	}
+	skipLine(pos, end);
+	
+	//Finding the line ends is much cheaper than parsing the lines, so the block is split
+	//serially into chunks of whole lines that are then parsed in parallel
+	std::vector<char const*> chunks;
+	for(uint i = 0; i < nPart; i++){
+		if(i % LINES_PER_CHUNK == 0) chunks.push_back(pos);
+		if(pos >= end) return false;
+		char const* lineEnd = (char const*)memchr(pos, '\n', end - pos);
+		pos = lineEnd? lineEnd + 1: end;
+	}
+	chunks.push_back(pos);
+	
+	snapshot.particles.resize(nPart);
+	int nChunks = (int)chunks.size() - 1;
+	bool isValid = true;
+	#pragma omp parallel for schedule(dynamic) reduction(&&: isValid)
+	for(int c = 0; c < nChunks; c++){
+		char const* chunkPos = chunks[c];
+		uint first = c * LINES_PER_CHUNK;
+		uint last = std::min(first + LINES_PER_CHUNK, nPart);
+		for(uint i = first; i < last; i++){
+			isValid = parseParticle(chunkPos, chunks[c + 1], snapshot.particles[i]) && isValid;
+		}
+	}
+	if(!isValid) return false;
+	
+	snapshot.typeNames.resize(nTypes);
+	snapshot.typeScales.resize(nTypes);
+	snapshot.typeShapes.assign(nTypes, glm::vec4(0.0f));
+	for(uint i = 0; i < nTypes; i++){
+		skipBlanks(pos, end);
+		char const* nameEnd = pos;
+		while(nameEnd < end && *nameEnd != ' ' && *nameEnd != '\t' && *nameEnd != '\r' && *nameEnd != '\n') nameEnd++;
+		if(nameEnd == pos) return false;
+		snapshot.typeNames[i].assign(pos, nameEnd);
+		pos = nameEnd;
+		if(!parseFloat(pos, end, snapshot.typeScales[i])) snapshot.typeScales[i] = 1.0f;
+		else{
+			for(uint j = 0; j < 4 && parseFloat(pos, end, snapshot.typeShapes[i][j]); j++);
+		}
+		skipLine(pos, end);
+	}
+	mPos = pos;
+	return true;
+}
@@ -0,0 +1,162 @@
+#include "../include/spheresystem.h"
+#include "../include/stats.h"
+#include <cmath>
+#include <iostream>
+
+static inline float maxf(float a, float b){
+	if(a > b) return a;
+	else return b;
+}
+
+static inline float minf(float a, float b){
+	if(a < b) return a;
+	else return b;
+}
+
+static inline int clampi(int input, int min, int max){
+	if(input > max) input = max;
+	if(input < min) input = min;
+	return input;
+}
+
+uint SphereSystem::addMaterial(Material const& material){
+	if(mMaterials.size() == 256){
+		std::cout << "Sphere systems support at most 256 materials, using the last one." << std::endl;
+		return 255;
+	}
+	mMaterials.push_back(material);
+	return mMaterials.size() - 1;
+}
+
+void SphereSystem::reserve(uint nSpheres){
+	mX.reserve(nSpheres);
+	mY.reserve(nSpheres);
+	mZ.reserve(nSpheres);
+	mRadius.reserve(nSpheres);
+	mMaterialIDs.reserve(nSpheres);
+}
+
+void SphereSystem::add(glm::vec3 position, float radius, uint material){
+	mX.push_back(position.x);
+	mY.push_back(position.y);
+	mZ.push_back(position.z);
+	mRadius.push_back(radius);
+	mMaterialIDs.push_back(material);
+}
+
+void SphereSystem::clear(void){
+	std::vector<float>().swap(mX);
+	std::vector<float>().swap(mY);
+	std::vector<float>().swap(mZ);
+	std::vector<float>().swap(mRadius);
+	std::vector<uchar>().swap(mMaterialIDs);
+	mMaterials.clear();
+	std::vector<uint>().swap(mCellStarts);
+	std::vector<uint>().swap(mItems);
+	mRes[0] = mRes[1] = mRes[2] = 0;
+}
+
+//Applies the permutation new[i] = old[order[i]] one array at a time, to keep the extra memory low
+template<typename T>
+static void reorder(std::vector<T> &values, std::vector<uint> const& order){
+	std::vector<T> sorted(values.size());
+	for(size_t i = 0; i < order.size(); i++) sorted[i] = values[order[i]];
+	values.swap(sorted);
+}
+
+void SphereSystem::construct(void){
+	PhaseTimer timer(PHASE_GRID);
+	std::vector<uint>().swap(mCellStarts);
+	std::vector<uint>().swap(mItems);
+	uint nSpheres = size();
+	if(nSpheres == 0) return;
+
+	glm::vec3 min(1e30f);
+	glm::vec3 max(-1e30f);
+	for(uint i = 0; i < nSpheres; i++){
+		glm::vec3 position(mX[i], mY[i], mZ[i]);
+		min = glm::min(min, position - mRadius[i]);
+		max = glm::max(max, position + mRadius[i]);
+	}
+	// Add 0.1 so that we don't get out of bounds
+	min = min - 0.1f;
+	max = max + 0.1f;
+	mAABB.setExtends(min, max);
+
+	//About two spheres per cell, so that a sphere overlaps a handful of cells
+	glm::vec3 gridSize = max - min;
+	float cubeRoot = cbrt((0.5f * nSpheres) / (gridSize[0] * gridSize[1] * gridSize[2]));
+	for(uint i = 0; i < 3; i++) mRes[i] = (uint)maxf(1.0f, minf(gridSize[i] * cubeRoot, 1024.0f));
+	mCellDim = gridSize / glm::vec3(mRes[0], mRes[1], mRes[2]);
+	size_t nCells = (size_t)mRes[0] * mRes[1] * mRes[2];
+
+	//Counting sort of the spheres by the cell of their centre, so that neighbours are close in memory
+	std::vector<uint> cells(nSpheres);
+	std::vector<uint> starts(nCells + 1, 0);
+	for(uint i = 0; i < nSpheres; i++){
+		glm::ivec3 cell = glm::ivec3((glm::vec3(mX[i], mY[i], mZ[i]) - min) / mCellDim);
+		for(uint k = 0; k < 3; k++) cell[k] = clampi(cell[k], 0, mRes[k] - 1);
+		cells[i] = cell[0] + mRes[0] * (cell[1] + mRes[1] * cell[2]);
+		starts[cells[i] + 1]++;
+	}
+	for(size_t c = 0; c < nCells; c++) starts[c + 1] += starts[c];
+	std::vector<uint> order(nSpheres);
+	for(uint i = 0; i < nSpheres; i++) order[starts[cells[i]]++] = i;
+	std::vector<uint>().swap(cells);
+	std::vector<uint>().swap(starts);
+	reorder(mX, order);
+	reorder(mY, order);
+	reorder(mZ, order);
+	reorder(mRadius, order);
+	reorder(mMaterialIDs, order);
+	std::vector<uint>().swap(order);
+
+	//Each sphere goes into the cells its bounding box overlaps that are actually within its radius.
+	//One pass counts, the second fills the flattened cell lists.
+	mCellStarts.assign(nCells + 1, 0);
+	for(uint pass = 0; pass < 2; pass++){
+		if(pass == 1){
+			for(size_t c = 0; c < nCells; c++) mCellStarts[c + 1] += mCellStarts[c];
+			mItems.resize(mCellStarts[nCells]);
+		}
+		for(uint i = 0; i < nSpheres; i++){
+			glm::vec3 center(mX[i], mY[i], mZ[i]);
+			float radius2 = mRadius[i] * mRadius[i];
+			glm::ivec3 first = glm::ivec3((center - mRadius[i] - min) / mCellDim);
+			glm::ivec3 last = glm::ivec3((center + mRadius[i] - min) / mCellDim);
+			for(uint k = 0; k < 3; k++){
+				first[k] = clampi(first[k], 0, mRes[k] - 1);
+				last[k] = clampi(last[k], 0, mRes[k] - 1);
+			}
+			for(int z = first.z; z <= last.z; z++){
+				for(int y = first.y; y <= last.y; y++){
+					for(int x = first.x; x <= last.x; x++){
+						glm::vec3 cellMin = min + glm::vec3(x, y, z) * mCellDim;
+						glm::vec3 closest = glm::clamp(center, cellMin, cellMin + mCellDim);
+						glm::vec3 distance = closest - center;
+						if(glm::dot(distance, distance) > radius2) continue;
+						uint cell = x + mRes[0] * (y + mRes[1] * z);
+						if(pass == 0) mCellStarts[cell + 1]++;
+						else mItems[mCellStarts[cell]++] = i;
+					}
+				}
+			}
+		}
+	}
+	//The fill pass advanced every start to the end of its cell
+	for(size_t c = nCells; c > 0; c--) mCellStarts[c] = mCellStarts[c - 1];
+	mCellStarts[0] = 0;
+}
+
+bool SphereSystem::intersect(Ray const& ray, float &t, uint &sphereID, glm::vec3 &normal)const{
+	ISA_DISPATCH(intersectISA, (ray, t, sphereID, normal))
+}
+
+bool SphereSystem::shadowIntersect(Ray const& ray, float &t)const{
+	ISA_DISPATCH(shadowIntersectISA, (ray, t))
+}
+
+size_t SphereSystem::memoryUsage(void)const{
+	return sizeof(SphereSystem) + (mX.capacity() + mY.capacity() + mZ.capacity() + mRadius.capacity()) * sizeof(float) + mMaterialIDs.capacity() +
+		mMaterials.capacity() * sizeof(Material) + (mCellStarts.capacity() + mItems.capacity()) * sizeof(uint);
+}
@@ -0,0 +1,150 @@
+#include "../include/stats.h"
+#include "../include/isa.h"
+#include <atomic>
+#include <mutex>
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#ifdef _WIN32
+#define PSAPI_VERSION 2 //GetProcessMemoryInfo from kernel32, no psapi library needed
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#define MAX_STATS_THREADS 256
+
+static const char *phaseNames[N_PHASES] = {"parse", "grid_build", "photon_emission", "kd_build", "trace", "raster", "encode"};
+static const char *counterNames[N_COUNTERS] = {"rays", "cells_visited", "primitive_tests", "shadow_rays", "photon_gathers", "photons_examined"};
+
+static ThreadCounters threadSlots[MAX_STATS_THREADS];
+static std::atomic<uint> nThreadSlots(0);
+static thread_local ThreadCounters *localCounters = NULL;
+
+static std::mutex statsMutex;
+static double phaseSeconds[N_PHASES];
+static uint phaseCalls[N_PHASES];
+static std::map<std::string, size_t> peakMemory;
+static std::string reportFile;
+static std::vector<uint> freeSlots; //Of threads that exited, their counts stay in the totals
+
+//Hands the thread's slot back when it exits, so that processes which keep starting threads (e.g. the daemon's
+//jobs with their OpenMP teams) do not run out of slots
+struct SlotRelease{
+	~SlotRelease(void){
+		if(localCounters == NULL || localCounters == &threadSlots[MAX_STATS_THREADS - 1]) return;
+		std::lock_guard<std::mutex> lock(statsMutex);
+		freeSlots.push_back(localCounters - threadSlots);
+	};
+};
+
+ThreadCounters &threadCounters(void){
+	if(localCounters == NULL){
+		static thread_local SlotRelease release;
+		(void)release;
+		uint slot;
+		{
+			std::lock_guard<std::mutex> lock(statsMutex);
+			if(!freeSlots.empty()){
+				slot = freeSlots.back();
+				freeSlots.pop_back();
+			}
+			//Threads beyond the last slot share it, their counts are then approximate
+			else slot = std::min(nThreadSlots++, (uint)MAX_STATS_THREADS - 1);
+		}
+		localCounters = &threadSlots[slot];
+	}
+	return *localCounters;
+}
+
+static uint nUsedSlots(void){
+	uint nSlots = nThreadSlots;
+	return (nSlots < MAX_STATS_THREADS)? nSlots: MAX_STATS_THREADS;
+}
+
+unsigned long long statsTotal(eCounter counter){
+	unsigned long long total = 0;
+	for(uint i = 0; i < nUsedSlots(); i++) total += threadSlots[i].counts[counter];
+	return total;
+}
+
+void statsAddPhase(ePhase phase, double seconds){
+	std::lock_guard<std::mutex> lock(statsMutex);
+	phaseSeconds[phase] += seconds;
+	phaseCalls[phase]++;
+}
+
+void statsMemory(char const* structure, size_t bytes){
+	std::lock_guard<std::mutex> lock(statsMutex);
+	size_t &peak = peakMemory[structure];
+	if(bytes > peak) peak = bytes;
+}
+
+static size_t peakResidentBytes(void){
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return counters.PeakWorkingSetSize;
+	return 0;
+#else
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+	return usage.ru_maxrss;
+#else
+	return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+bool statsWriteReport(char const* filename){
+	FILE *file = fopen(filename, "w");
+	if(!file){
+		std::cout << "Error writing file \"" << filename << "\" by function " << "'" << __FUNCTION__ << "'" << std::endl;
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(statsMutex);
+	fprintf(file, "{\n\t\"isa\": \"%s\",\n\t\"phases\": {\n", isaName(kernelISA()));
+	for(uint i = 0; i < N_PHASES; i++){
+		fprintf(file, "\t\t\"%s\": {\"seconds\": %.6f, \"calls\": %u}%s\n", phaseNames[i], phaseSeconds[i], phaseCalls[i], (i + 1 < N_PHASES)? ",": "");
+	}
+	fprintf(file, "\t},\n\t\"counters\": {\n");
+	for(uint i = 0; i < N_COUNTERS; i++){
+		fprintf(file, "\t\t\"%s\": %llu,\n", counterNames[i], statsTotal(eCounter(i)));
+	}
+	unsigned long long nGathers = statsTotal(COUNTER_PHOTON_GATHERS);
+	fprintf(file, "\t\t\"photons_per_gather\": %.3f\n\t},\n", nGathers? double(statsTotal(COUNTER_PHOTONS_EXAMINED)) / nGathers: 0.0);
+
+	//Per thread, to spot load imbalance
+	fprintf(file, "\t\"threads\": [\n");
+	uint nSlots = nUsedSlots();
+	for(uint t = 0; t < nSlots; t++){
+		fprintf(file, "\t\t{");
+		for(uint i = 0; i < N_COUNTERS; i++){
+			fprintf(file, "\"%s\": %llu%s", counterNames[i], threadSlots[t].counts[i], (i + 1 < N_COUNTERS)? ", ": "");
+		}
+		fprintf(file, "}%s\n", (t + 1 < nSlots)? ",": "");
+	}
+	fprintf(file, "\t],\n\t\"memory\": {\n\t\t\"peak_resident_bytes\": %llu,\n\t\t\"structures\": {\n", (unsigned long long)peakResidentBytes());
+	std::map<std::string, size_t>::const_iterator itr;
+	for(itr = peakMemory.begin(); itr != peakMemory.end(); itr++){
+		std::map<std::string, size_t>::const_iterator next = itr;
+		next++;
+		fprintf(file, "\t\t\t\"%s\": %llu%s\n", itr->first.c_str(), (unsigned long long)itr->second, (next != peakMemory.end())? ",": "");
+	}
+	fprintf(file, "\t\t}\n\t}\n}\n");
+	return fclose(file) == 0;
+}
+
+static void writeReportAtExit(void){
+	statsWriteReport(reportFile.c_str());
+}
+
+void statsReportAtExit(char const* filename){
+	if(reportFile.empty()) atexit(writeReportAtExit);
+	reportFile = filename;
+}
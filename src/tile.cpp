@@ -0,0 +1,113 @@
+#include "../include/tile.h"
+#include <algorithm>
+
+//Spread the lower 16 bits of x so that there is a zero bit between each of them
+static inline uint part1By1(uint x){
+	x &= 0x0000ffff;
+	x = (x ^ (x << 8)) & 0x00ff00ff;
+	x = (x ^ (x << 4)) & 0x0f0f0f0f;
+	x = (x ^ (x << 2)) & 0x33333333;
+	x = (x ^ (x << 1)) & 0x55555555;
+	return x;
+}
+
+static inline uint mortonCode(uint x, uint y){
+	return (part1By1(y) << 1) + part1By1(x);
+}
+
+struct MortonTile{
+	uint code;
+	Tile tile;
+};
+
+static bool compMorton(MortonTile const& a, MortonTile const& b){
+	return (a.code < b.code);
+}
+
+std::vector<Tile> genTiles(uint width, uint height, uint tileSize){
+	uint nTilesX = (width + tileSize - 1) / tileSize;
+	uint nTilesY = (height + tileSize - 1) / tileSize;
+	std::vector<MortonTile> mortonTiles;
+	mortonTiles.reserve(nTilesX * nTilesY);
+	for(uint ty = 0; ty < nTilesY; ty++){
+		for(uint tx = 0; tx < nTilesX; tx++){
+			MortonTile mt;
+			mt.code = mortonCode(tx, ty);
+			uint x = tx * tileSize;
+			uint y = ty * tileSize;
+			mt.tile = Tile(x, y, std::min(tileSize, width - x), std::min(tileSize, height - y));
+			mortonTiles.push_back(mt);
+		}
+	}
+	std::sort(mortonTiles.begin(), mortonTiles.end(), compMorton);
+	
+	std::vector<Tile> tiles;
+	tiles.reserve(mortonTiles.size());
+	for(uint i = 0; i < mortonTiles.size(); i++) tiles.push_back(mortonTiles[i].tile);
+	return tiles;
+}
+
+TileScheduler::TileScheduler(uint nTiles, uint nThreads): mNThreads(nThreads){
+	mRanges = new Range[nThreads];
+	for(uint i = 0; i < nThreads; i++){
+		mRanges[i].begin = (uint)((unsigned long long)nTiles * i / nThreads);
+		mRanges[i].end = (uint)((unsigned long long)nTiles * (i + 1) / nThreads);
+		omp_init_lock(&mRanges[i].lock);
+	}
+}
+
+TileScheduler::~TileScheduler(void){
+	for(uint i = 0; i < mNThreads; i++) omp_destroy_lock(&mRanges[i].lock);
+	delete[] mRanges;
+}
+
+bool TileScheduler::next(uint threadID, uint &tileID){
+	Range &range = mRanges[threadID];
+	bool retValue = false;
+	omp_set_lock(&range.lock);
+	if(range.begin < range.end){
+		tileID = range.begin++;
+		retValue = true;
+	}
+	omp_unset_lock(&range.lock);
+	if(retValue) return true;
+	return steal(threadID, tileID);
+}
+
+bool TileScheduler::steal(uint threadID, uint &tileID){
+	while(1){
+		//Find the victim with the most remaining work. The sizes are only a hint, they are checked again under the lock.
+		uint victim = threadID;
+		uint maxRemaining = 0;
+		for(uint i = 0; i < mNThreads; i++){
+			if(i == threadID) continue;
+			omp_set_lock(&mRanges[i].lock);
+			uint remaining = mRanges[i].end - mRanges[i].begin;
+			omp_unset_lock(&mRanges[i].lock);
+			if(remaining > maxRemaining){
+				maxRemaining = remaining;
+				victim = i;
+			}
+		}
+		if(maxRemaining == 0) return false;
+		
+		//Take the back half of the victim's range, so that the stolen tiles are also contiguous
+		Range &range = mRanges[victim];
+		uint begin = 0, end = 0;
+		omp_set_lock(&range.lock);
+		if(range.begin < range.end){
+			begin = range.begin + (range.end - range.begin) / 2;
+			end = range.end;
+			range.end = begin;
+		}
+		omp_unset_lock(&range.lock);
+		if(begin < end){
+			tileID = begin;
+			omp_set_lock(&mRanges[threadID].lock);
+			mRanges[threadID].begin = begin + 1;
+			mRanges[threadID].end = end;
+			omp_unset_lock(&mRanges[threadID].lock);
+			return true;
+		}
+	}
+}
@@ -0,0 +1,313 @@
+#include "../include/raytracer.h"
+#include "../include/wavefront.h"
+#include "../include/stats.h"
+#include <algorithm>
+#include <cmath>
+
+static inline glm::vec3 reflect(glm::vec3 I, glm::vec3 N){
+	return glm::normalize(I - 2.0f * glm::dot(N, I) * N);
+}
+
+template<typename T>
+static void gather(std::vector<T> &v, std::vector<uint> const& order){
+	std::vector<T> temp(order.size());
+	for(uint i = 0; i < order.size(); i++) temp[i] = v[order[i]];
+	v.swap(temp);
+}
+
+void RayQueue::resize(uint n){
+	ox.resize(n); oy.resize(n); oz.resize(n);
+	dx.resize(n); dy.resize(n); dz.resize(n);
+	wr.resize(n); wg.resize(n); wb.resize(n);
+	coef.resize(n);
+	pixel.resize(n);
+	level.resize(n);
+}
+
+void RayQueue::set(uint i, Ray const& ray, uint pixelID, colorRGBF const& weight, float rcoef, uint rlevel){
+	ox[i] = ray.r0.x; oy[i] = ray.r0.y; oz[i] = ray.r0.z;
+	dx[i] = ray.dir.x; dy[i] = ray.dir.y; dz[i] = ray.dir.z;
+	wr[i] = weight.r; wg[i] = weight.g; wb[i] = weight.b;
+	coef[i] = rcoef;
+	pixel[i] = pixelID;
+	level[i] = rlevel;
+}
+
+void RayQueue::push(Ray const& ray, uint pixelID, colorRGBF const& weight, float rcoef, uint rlevel){
+	resize(size() + 1);
+	set(size() - 1, ray, pixelID, weight, rcoef, rlevel);
+}
+
+void RayQueue::permute(std::vector<uint> const& order){
+	gather(ox, order); gather(oy, order); gather(oz, order);
+	gather(dx, order); gather(dy, order); gather(dz, order);
+	gather(wr, order); gather(wg, order); gather(wb, order);
+	gather(coef, order);
+	gather(pixel, order);
+	gather(level, order);
+}
+
+void HitQueue::resize(uint n){
+	px.resize(n); py.resize(n); pz.resize(n);
+	nx.resize(n); ny.resize(n); nz.resize(n);
+	ix.resize(n); iy.resize(n); iz.resize(n);
+	wr.resize(n); wg.resize(n); wb.resize(n);
+	coef.resize(n);
+	objectID.resize(n);
+	pixel.resize(n);
+	level.resize(n);
+	firstShadow.resize(n + 1);
+}
+
+void ShadowQueue::resize(uint n){
+	hit.resize(n);
+	light.resize(n);
+	dx.resize(n); dy.resize(n); dz.resize(n);
+	distance.resize(n);
+	isVisible.resize(n);
+}
+
+struct SortKey{
+	uint key;
+	uint index;
+};
+
+static bool compKey(SortKey const& a, SortKey const& b){
+	if(a.key != b.key) return (a.key < b.key);
+	return (a.index < b.index);
+}
+
+//Sorts the rays by the grid cell of their origin and then by their direction octant,
+//so that rays extended one after the other traverse the same cells
+void RayTracer::sortRays(RayQueue &queue)const{
+	uint nRays = queue.size();
+	std::vector<SortKey> keys(nRays);
+	#pragma omp parallel for schedule(static)
+	for(int i = 0; i < (int)nRays; i++){
+		uint octant = (queue.dx[i] < 0.0f) + ((queue.dy[i] < 0.0f) << 1) + ((queue.dz[i] < 0.0f) << 2);
+		keys[i].key = (mGrid.cellIndex(glm::vec3(queue.ox[i], queue.oy[i], queue.oz[i])) << 3) + octant;
+		keys[i].index = i;
+	}
+	std::sort(keys.begin(), keys.end(), compKey);
+	std::vector<uint> order(nRays);
+	for(uint i = 0; i < nRays; i++) order[i] = keys[i].index;
+	queue.permute(order);
+}
+
+//Traces one sample for each of the pixels breadth first. Instead of recursing per sample, all rays of a
+//level go through one stage at a time: extend (grid traversal), gather (photon map lookups), shadow
+//(visibility of the point lights) and shade, and the reflected rays form the queue of the next level.
+//The result is the same as traceRay's, up to the order of floating point additions.
+void RayTracer::traceWavefront(CameraBase const& camera, std::vector<uint> const& pixels, uint sample, bool isRasterized, AOVBuffer *aovs, colorRGBF *colors)const{
+	uint nPixels = pixels.size();
+	RayQueue queue;
+	queue.resize(nPixels);
+	#pragma omp parallel for schedule(static)
+	for(int i = 0; i < (int)nPixels; i++){
+		queue.set(i, camera.shootRay(pixels[i] % mWidth, mFirstRow + pixels[i] / mWidth, sample), i, colorRGBF(1.0f), 1.0f, 0);
+		colors[i] = colorRGBF();
+	}
+
+	HitQueue hits;
+	ShadowQueue shadows;
+	RayQueue nextQueue;
+	std::vector<float> t, hnx, hny, hnz;
+	std::vector<uint> hitObject;
+	std::vector<uchar> isHit;
+	std::vector<float> mr, mg, mb, mSv, mSp, mRefl; //Material of each hit
+	std::vector<float> dr, dg, db; //Direct light of each shadow ray
+	std::vector<float> indr, indg, indb; //Indirect light of each hit
+	std::vector<uint> gatherOrder;
+	while(queue.size() > 0){
+		uint nQueued = queue.size();
+		statsCount(COUNTER_RAYS, nQueued);
+		sortRays(queue);
+
+		/////////////////////////////Extend/////////////////////////////
+		t.resize(nQueued);
+		hnx.resize(nQueued); hny.resize(nQueued); hnz.resize(nQueued);
+		hitObject.resize(nQueued);
+		isHit.resize(nQueued);
+		#pragma omp parallel for schedule(dynamic, 64)
+		for(int i = 0; i < (int)nQueued; i++){
+			float tHit = 2000.0f;
+			uint objectID = 0;
+			glm::vec3 normal;
+			//The first hits of the camera rays may come from the visibility buffer
+			if(isRasterized && queue.level[i] == 0){
+				uint pixelID = pixels[queue.pixel[i]];
+				isHit[i] = primaryIntersect(queue.ray(i), pixelID % mWidth, pixelID / mWidth, tHit, objectID, normal);
+			}
+			else isHit[i] = intersect(queue.ray(i), tHit, objectID, normal);
+			t[i] = tHit;
+			hitObject[i] = objectID;
+			hnx[i] = normal.x; hny[i] = normal.y; hnz[i] = normal.z;
+		}
+
+		//Compact the hits. Primary rays that miss see the background.
+		uint nHits = 0;
+		for(uint i = 0; i < nQueued; i++) nHits += isHit[i];
+		hits.resize(nHits);
+		uint h = 0;
+		for(uint i = 0; i < nQueued; i++){
+			if(!isHit[i]){
+				if(queue.level[i] == 0) colors[queue.pixel[i]] = colorRGBF(1.0f); //background color
+				continue;
+			}
+			if(aovs && queue.level[i] == 0){
+				uint pixelID = pixels[queue.pixel[i]];
+				aovs->set(pixelID % mWidth, pixelID / mWidth, material(hitObject[i]).color, glm::vec3(hnx[i], hny[i], hnz[i]), t[i], hitObject[i]);
+			}
+			hits.px[h] = queue.ox[i]; hits.py[h] = queue.oy[i]; hits.pz[h] = queue.oz[i];
+			hits.ix[h] = queue.dx[i]; hits.iy[h] = queue.dy[i]; hits.iz[h] = queue.dz[i];
+			hits.nx[h] = hnx[i]; hits.ny[h] = hny[i]; hits.nz[h] = hnz[i];
+			hits.wr[h] = queue.wr[i]; hits.wg[h] = queue.wg[i]; hits.wb[h] = queue.wb[i];
+			hits.coef[h] = queue.coef[i];
+			hits.objectID[h] = hitObject[i];
+			hits.pixel[h] = queue.pixel[i];
+			hits.level[h] = queue.level[i];
+			t[h] = t[i];
+			h++;
+		}
+		if(nHits == 0){
+			queue.clear();
+			continue;
+		}
+
+		float *px = &hits.px[0], *py = &hits.py[0], *pz = &hits.pz[0];
+		float const *ix = &hits.ix[0], *iy = &hits.iy[0], *iz = &hits.iz[0];
+		float const *th = &t[0];
+		#pragma omp simd
+		for(int i = 0; i < (int)nHits; i++){
+			px[i] += ix[i] * th[i];
+			py[i] += iy[i] * th[i];
+			pz[i] += iz[i] * th[i];
+		}
+
+		mr.resize(nHits); mg.resize(nHits); mb.resize(nHits);
+		mSv.resize(nHits); mSp.resize(nHits); mRefl.resize(nHits);
+		for(uint i = 0; i < nHits; i++){
+			Material const& objectMaterial = material(hits.objectID[i]);
+			mr[i] = objectMaterial.color.r; mg[i] = objectMaterial.color.g; mb[i] = objectMaterial.color.b;
+			mSv[i] = objectMaterial.Sv; mSp[i] = objectMaterial.Sp;
+			mRefl[i] = objectMaterial.reflectivity;
+		}
+
+		/////////////////////////////Gather/////////////////////////////
+		//Visit the hits in cell order, so that consecutive lookups touch the same part of the kd-tree
+		std::vector<SortKey> keys(nHits);
+		for(uint i = 0; i < nHits; i++){
+			keys[i].key = mGrid.cellIndex(glm::vec3(px[i], py[i], pz[i]));
+			keys[i].index = i;
+		}
+		std::sort(keys.begin(), keys.end(), compKey);
+		gatherOrder.resize(nHits);
+		for(uint i = 0; i < nHits; i++) gatherOrder[i] = keys[i].index;
+		indr.resize(nHits); indg.resize(nHits); indb.resize(nHits);
+		//Ambient occlusion takes the place of the gather and leaves no lights to shade
+		#pragma omp parallel for schedule(dynamic, 64)
+		for(int k = 0; k < (int)nHits; k++){
+			uint i = gatherOrder[k];
+			glm::vec3 position(px[i], py[i], pz[i]);
+			glm::vec3 normal(hits.nx[i], hits.ny[i], hits.nz[i]);
+			if(mNAORays > 0){
+				float occlusion = calcOcclusion(position, normal);
+				indr[i] = occlusion * mr[i]; indg[i] = occlusion * mg[i]; indb[i] = occlusion * mb[i];
+				continue;
+			}
+			float nShadowPhotons;
+			colorRGBF indirect = calcIndirect(position, normal, nShadowPhotons);
+			indr[i] = indirect.r; indg[i] = indirect.g; indb[i] = indirect.b;
+		}
+		uint nShadedLights = (mNAORays > 0)? 0: mNPointLights;
+
+		/////////////////////////////Shadow/////////////////////////////
+		//Count the lights in front of each hit, then queue one shadow ray per light
+		hits.firstShadow[0] = 0;
+		#pragma omp parallel for schedule(static)
+		for(int i = 0; i < (int)nHits; i++){
+			glm::vec3 position(px[i], py[i], pz[i]);
+			glm::vec3 normal(hits.nx[i], hits.ny[i], hits.nz[i]);
+			uint nLights = 0;
+			for(uint lightID = 0; lightID < nShadedLights; lightID++){
+				if(glm::dot(mScene->pointLight(lightID).mPosition - position, normal) > 0.0f) nLights++;
+			}
+			hits.firstShadow[i + 1] = nLights;
+		}
+		for(uint i = 0; i < nHits; i++) hits.firstShadow[i + 1] += hits.firstShadow[i];
+		uint nShadows = hits.firstShadow[nHits];
+		shadows.resize(nShadows);
+		#pragma omp parallel for schedule(static)
+		for(int i = 0; i < (int)nHits; i++){
+			glm::vec3 position(px[i], py[i], pz[i]);
+			glm::vec3 normal(hits.nx[i], hits.ny[i], hits.nz[i]);
+			uint s = hits.firstShadow[i];
+			for(uint lightID = 0; lightID < nShadedLights; lightID++){
+				glm::vec3 direction = mScene->pointLight(lightID).mPosition - position;
+				if(glm::dot(direction, normal) <= 0.0f) continue;
+				float d = glm::length(direction);
+				direction = direction / d;
+				shadows.hit[s] = i;
+				shadows.light[s] = lightID;
+				shadows.dx[s] = direction.x; shadows.dy[s] = direction.y; shadows.dz[s] = direction.z;
+				shadows.distance[s] = d;
+				s++;
+			}
+		}
+		#pragma omp parallel for schedule(dynamic, 256)
+		for(int s = 0; s < (int)nShadows; s++){
+			uint i = shadows.hit[s];
+			Ray lightRay(glm::vec3(px[i], py[i], pz[i]), glm::vec3(shadows.dx[s], shadows.dy[s], shadows.dz[s]));
+			float d = shadows.distance[s];
+			shadows.isVisible[s] = !shadowIntersect(lightRay, d);
+		}
+
+		/////////////////////////////Shade//////////////////////////////
+		//Lambert and Blinn terms of every visible light, computed over the whole shadow queue
+		dr.resize(nShadows); dg.resize(nShadows); db.resize(nShadows);
+		#pragma omp parallel for simd schedule(static)
+		for(int s = 0; s < (int)nShadows; s++){
+			uint i = shadows.hit[s];
+			PointLight const& light = mScene->pointLight(shadows.light[s]);
+			float Lx = shadows.dx[s], Ly = shadows.dy[s], Lz = shadows.dz[s];
+			float Nx = hits.nx[i], Ny = hits.ny[i], Nz = hits.nz[i];
+			float diffuse = Lx * Nx + Ly * Ny + Lz * Nz;
+			float Hx = Lx - ix[i], Hy = Ly - iy[i], Hz = Lz - iz[i];
+			float temp = sqrtf(Hx * Hx + Hy * Hy + Hz * Hz);
+			float spec = 0.0f;
+			if(temp > 0.0f){
+				spec = (Hx * Nx + Hy * Ny + Hz * Nz) / temp;
+				if(spec < 0.0f) spec = 0.0f;
+				spec = mSv[i] * powf(spec, mSp[i]);
+			}
+			float visible = shadows.isVisible[s];
+			dr[s] = visible * (diffuse * light.mColor.r * mr[i] + spec * light.mColor.r);
+			dg[s] = visible * (diffuse * light.mColor.g * mg[i] + spec * light.mColor.g);
+			db[s] = visible * (diffuse * light.mColor.b * mb[i] + spec * light.mColor.b);
+		}
+
+		//Accumulate into the pixels and queue the reflected rays. There is at most one hit per pixel
+		//in a level, so the pixels can be written in parallel.
+		nextQueue.clear();
+		#pragma omp parallel for schedule(static)
+		for(int i = 0; i < (int)nHits; i++){
+			colorRGBF direct;
+			for(uint s = hits.firstShadow[i]; s < hits.firstShadow[i + 1]; s++) direct += colorRGBF(dr[s], dg[s], db[s]);
+			colorRGBF weight(hits.wr[i], hits.wg[i], hits.wb[i]);
+			colorRGBF &pixelColor = colors[hits.pixel[i]];
+			pixelColor += weight * colorRGBF(indr[i], indg[i], indb[i]);
+			pixelColor += weight * direct;
+		}
+		for(uint i = 0; i < nHits; i++){
+			float coef = hits.coef[i] * mRefl[i];
+			uint level = hits.level[i] + 1;
+			if(level > TRACE_DEPTH || coef < 0.01f) continue;
+			glm::vec3 position(px[i], py[i], pz[i]);
+			glm::vec3 normal(hits.nx[i], hits.ny[i], hits.nz[i]);
+			Ray reflectedRay(position, reflect(glm::vec3(ix[i], iy[i], iz[i]), normal));
+			colorRGBF weight = coef * (colorRGBF(hits.wr[i], hits.wg[i], hits.wb[i]) * colorRGBF(mr[i], mg[i], mb[i]));
+			nextQueue.push(reflectedRay, hits.pixel[i], weight, coef, level);
+		}
+		std::swap(queue, nextQueue);
+	}
+}